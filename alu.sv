@@ -10,23 +10,25 @@ module Atomic_alu
     output [63:0] result
 );
     logic [63:0] temp_result;
+    logic [63:0] a_ext; // rs2, sign-extended for .W ops (b already is, it comes from a LW)
     logic signed [63:0] a_sig;
     logic signed [63:0] b_sig;
 
-    assign a_sig = a;
+    assign a_ext = width_32 ? { {32{a[31]}}, a[31:0] } : a;
+    assign a_sig = a_ext;
     assign b_sig = b;
 
     always_comb begin
         temp_result = 0;
         case (alu_op) inside
-            ALU_OP_ADD: temp_result = a + b;
-            ALU_OP_AND: temp_result = a & b;
-            ALU_OP_OR:  temp_result = a | b;
-            ALU_OP_XOR: temp_result = a ^ b;
+            ALU_OP_ADD: temp_result = a_ext + b;
+            ALU_OP_AND: temp_result = a_ext & b;
+            ALU_OP_OR:  temp_result = a_ext | b;
+            ALU_OP_XOR: temp_result = a_ext ^ b;
             ALU_OP_MIN: temp_result = (a_sig < b_sig) ? a_sig : b_sig;
             ALU_OP_MAX: temp_result = (a_sig > b_sig) ? a_sig : b_sig;
-            ALU_OP_MINU: temp_result = (a < b) ? a : b;
-            ALU_OP_MAXU: temp_result = (a > b) ? a : b;
+            ALU_OP_MINU: temp_result = (a_ext < b) ? a_ext : b; // sign-extending both keeps the unsigned .W order
+            ALU_OP_MAXU: temp_result = (a_ext > b) ? a_ext : b;
             default: $display("Invalid alu_op in atomic_alu, alu_op = %x", alu_op);
         endcase
 
@@ -0,0 +1,30 @@
+#ifndef __AXI_TRACE_H
+#define __AXI_TRACE_H
+
+#include <stdint.h>
+
+// Binary trace of the 64-byte DRAM reads and writes the core puts on the bus,
+// written by System when AXI_TRACE=<file> is set and replayed against other
+// DRAMSim2 configurations by dramsweep/.  Device (MMIO) accesses aren't
+// recorded.  The file is one header followed by 8-byte records.
+
+#define AXI_TRACE_MAGIC 0x0031435254495841ULL // "AXITRC1"
+
+struct axi_trace_header {
+    uint64_t magic;
+    uint32_t ps_per_clock; // core clock period the cycle deltas count
+    uint32_t ram_megs;     // memory size the trace was recorded with
+};
+
+// cycle_delta is core cycles since the previous record.  line_write is the
+// line number (offset from the start of DRAM / 64) shifted left by one, with
+// bit 0 set for writes.  A gap longer than 32 bits of cycles is written as
+// extra AXI_TRACE_SKIP records ahead of the access, which only move time.
+struct axi_trace_record {
+    uint32_t cycle_delta;
+    uint32_t line_write;
+};
+
+#define AXI_TRACE_SKIP 0xffffffffU
+
+#endif
@@ -0,0 +1,70 @@
+#include <iostream>
+#include <algorithm>
+#include <vector>
+#include <string>
+#include <assert.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+#include "bbv.h"
+#include "system.h"
+
+using namespace std;
+
+static FILE* open_or_die(const string& filename) {
+    FILE* f = fopen(filename.c_str(), "w");
+    if (!f) {
+        cerr << "Couldn't open " << filename << ": " << strerror(errno) << endl;
+        exit(-1);
+    }
+    return f;
+}
+
+Bbv::Bbv(const char* filename, uint64_t interval)
+    : interval(interval), ops(0), start_cycle(0), last_cycle(0), count(0)
+{
+    out = open_or_die(filename);
+    intervals = open_or_die(string(filename) + ".intervals");
+}
+
+Bbv::~Bbv() {
+    if (ops) write_interval(last_cycle);
+    assert(fclose(out) == 0);
+    assert(fclose(intervals) == 0);
+}
+
+void Bbv::write_interval(uint64_t cycle) {
+    vector<pair<uint64_t, uint64_t> > sorted(counts.begin(), counts.end());
+    sort(sorted.begin(), sorted.end());
+    fputc('T', out);
+    for (size_t i = 0; i < sorted.size(); ++i)
+        fprintf(out, ":%lu:%lu ", sorted[i].first, sorted[i].second);
+    fputc('\n', out);
+    fprintf(intervals, "%lu %lu\n", ops, cycle - start_cycle);
+
+    counts.clear();
+    ops = 0;
+    start_cycle = cycle;
+    ++count;
+}
+
+void Bbv::block(uint64_t first_pc, uint64_t last_pc, uint64_t ops, uint64_t cycle) {
+    uint64_t& id = ids[make_pair(first_pc, last_pc)];
+    if (!id) id = ids.size();
+    counts[id] += ops;
+    this->ops += ops;
+    last_cycle = cycle;
+    if (this->ops >= interval) write_interval(cycle);
+}
+
+extern "C" {
+
+    int bbv_enabled() {
+        return System::sys->bbv != NULL;
+    }
+
+    void bbv_block(long long first_pc, long long last_pc, long long ops, long long cycle) {
+        System::sys->bbv->block(first_pc, last_pc, ops, cycle);
+    }
+
+}
@@ -0,0 +1,42 @@
+#ifndef __BBV_H
+#define __BBV_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <map>
+#include <unordered_map>
+#include <utility>
+
+// BBV=<file>: basic-block vectors in SimPoint's format, one line per
+// BBV_INTERVAL retired ops, for picking simulation points with simpoint/.
+//
+// top.sv reports each block as it finishes retiring: the ops from the one
+// after a taken jump or trap up to the next one.  A block is named by its
+// first and last pc, so not-taken branches don't split blocks but different
+// exits from the same entry are different blocks.  A block that crosses an
+// interval boundary is counted in the interval it ends in.
+//
+// <file>.intervals gets "<ops> <cycles>" for each interval, so simpoint/ can
+// check its CPI estimate against the run the vectors came from.
+class Bbv {
+    FILE* out;
+    FILE* intervals;
+    uint64_t interval;     // ops per interval
+    uint64_t ops;          // retired so far in this interval
+    uint64_t start_cycle;  // of this interval
+    uint64_t last_cycle;   // of the last block
+    uint64_t count;        // intervals written
+    std::map<std::pair<uint64_t, uint64_t>, uint64_t> ids; // (first pc, last pc) -> block id, from 1
+    std::unordered_map<uint64_t, uint64_t> counts;         // block id -> ops this interval
+
+    void write_interval(uint64_t cycle);
+
+public:
+    Bbv(const char* filename, uint64_t interval);
+    ~Bbv(); // writes out the partial last interval
+
+    void block(uint64_t first_pc, uint64_t last_pc, uint64_t ops, uint64_t cycle);
+    uint64_t intervals_written() const { return count; }
+};
+
+#endif
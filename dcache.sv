@@ -18,6 +18,7 @@ module Dcache
     input        [63:0]   in_addr,
     input        [63:0]   wdata,
     input        [ 1:0]   wlen, // len = 2 ^ wlen bytes
+    input        [ 7:0]   wmask, // cached writes: bytes of (wdata << 8*in_addr[2:0]) to write
     input                 dcache_enable,
     input                 wrn, // write = 1 / read = 0
     input                 virtual_mode, // determines "in_addr" is virtual or physical
@@ -98,9 +99,68 @@ module Dcache
     wire [1:0] victim_way = !line_valid[index][0] ? 2'h0 : !line_valid[index][1] ? 2'h1 : !line_valid[index][2] ? 2'h2 : !line_valid[index][3] ? 2'h3 : line_lru[index][1:0];
     reg [1:0] rplc_way;
 
-    wire [LOG_SETS+LOG_LINE_LEN+LOG_WORD_LEN-1:LOG_LINE_LEN+LOG_WORD_LEN] snoop_index = dcache_m_axi_acaddr[LOG_SETS+LOG_LINE_LEN+LOG_WORD_LEN-1:LOG_LINE_LEN+LOG_WORD_LEN];
-    wire [ADDR_WIDTH-1:LOG_SETS+LOG_LINE_LEN+LOG_WORD_LEN] snoop_tag = dcache_m_axi_acaddr[ADDR_WIDTH-1:LOG_SETS+LOG_LINE_LEN+LOG_WORD_LEN];
-    integer snoop_way;
+    // A snoop covers lines acaddr[11:6] to snoop_last of acaddr's 4K page: just the one line,
+    // or for the harness's range snoops, up to the line in acaddr[5:0] (see enums.sv)
+    wire snoop_range = dcache_m_axi_acsnoop == 4'ha || dcache_m_axi_acsnoop == 4'hc;
+    wire [5:0] snoop_last = snoop_range ? dcache_m_axi_acaddr[5:0] : dcache_m_axi_acaddr[11:6];
+    reg [63:0] snoop_line; // each line in turn, in the snoop loops
+    integer snoop_i, snoop_way;
+
+    // CleanInvalid snoops (used before the harness reads memory behind our back, e.g. for DMA)
+    // must write a dirty line back first. acready stays low until that's done.
+    // So must ReadUnique, from another hart about to fill that line (see hart_interconnect.sv).
+    // Snoops are taken when idle, and also while a line fill waits for its AR (state 3), since
+    // that AR may be waiting for this very snoop to finish: a dirty line is written back from
+    // there, and then the fill carries on.
+    reg snoop_wb; // current write-back was started by a snoop, don't refill afterwards
+    reg snoop_resume; // ... but it interrupted a fill: go back to fill_addr/fill_way
+    reg [63:0] fill_addr;
+    reg [1:0] fill_way;
+    // A fill just finished: the access that wanted the line gets one cycle with it before any
+    // snoop can take it away again, or two harts after the same line could starve each other
+    reg fill_hold;
+    wire snoop_seen = dcache_m_axi_acvalid && !fill_hold;
+    wire snoop_cleans = dcache_m_axi_acsnoop == 4'h9 || dcache_m_axi_acsnoop == 4'h7 || dcache_m_axi_acsnoop == 4'ha;
+    wire snoop_invalidates = snoop_cleans || dcache_m_axi_acsnoop == 4'hd || dcache_m_axi_acsnoop == 4'hc;
+    // A dirty line the snoop covers, written back before the snoop can finish.  A range
+    // snoop writes back its dirty lines one after another, then drops them all at once.
+    reg snoop_hit_dirty;
+    reg [1:0] snoop_dirty_way;
+    reg [63:0] snoop_dirty_addr;
+    reg [63:0] dirty_line;
+    integer dirty_i, dirty_way;
+    always_comb begin
+        snoop_hit_dirty = 1'b0;
+        snoop_dirty_way = 2'h0;
+        snoop_dirty_addr = 64'h0;
+        dirty_line = 64'h0;
+        if(dcache_m_axi_acvalid)
+            for (dirty_i = 0; dirty_i < 64; dirty_i = dirty_i + 1)
+                if(dirty_i[5:0] >= dcache_m_axi_acaddr[11:6] && dirty_i[5:0] <= snoop_last) begin
+                    dirty_line = {dcache_m_axi_acaddr[ADDR_WIDTH-1:12], dirty_i[5:0], 6'h0};
+                    for (dirty_way = 0; dirty_way < WAYS; dirty_way = dirty_way + 1)
+                        if(line_tag[dirty_line[LOG_SETS+LOG_LINE_LEN+LOG_WORD_LEN-1:LOG_LINE_LEN+LOG_WORD_LEN]][dirty_way] == dirty_line[ADDR_WIDTH-1:LOG_SETS+LOG_LINE_LEN+LOG_WORD_LEN]
+                           && line_valid[dirty_line[LOG_SETS+LOG_LINE_LEN+LOG_WORD_LEN-1:LOG_LINE_LEN+LOG_WORD_LEN]][dirty_way]
+                           && line_dirty[dirty_line[LOG_SETS+LOG_LINE_LEN+LOG_WORD_LEN-1:LOG_LINE_LEN+LOG_WORD_LEN]][dirty_way]) begin
+                            snoop_hit_dirty = 1'b1;
+                            snoop_dirty_way = dirty_way[1:0];
+                            snoop_dirty_addr = dirty_line;
+                        end
+                end
+    end
+
+    // Drops every line the snoop covers, dirty or not
+    task snoop_invalidate;
+        for (snoop_i = 0; snoop_i < 64; snoop_i = snoop_i + 1)
+            if(snoop_i[5:0] >= dcache_m_axi_acaddr[11:6] && snoop_i[5:0] <= snoop_last) begin
+                snoop_line = {dcache_m_axi_acaddr[ADDR_WIDTH-1:12], snoop_i[5:0], 6'h0};
+                for (snoop_way = 0; snoop_way < WAYS; snoop_way = snoop_way + 1)
+                    if(line_tag[snoop_line[LOG_SETS+LOG_LINE_LEN+LOG_WORD_LEN-1:LOG_LINE_LEN+LOG_WORD_LEN]][snoop_way] == snoop_line[ADDR_WIDTH-1:LOG_SETS+LOG_LINE_LEN+LOG_WORD_LEN]) begin
+                        line_valid[snoop_line[LOG_SETS+LOG_LINE_LEN+LOG_WORD_LEN-1:LOG_LINE_LEN+LOG_WORD_LEN]][snoop_way] <= 1'b0;
+                        line_dirty[snoop_line[LOG_SETS+LOG_LINE_LEN+LOG_WORD_LEN-1:LOG_LINE_LEN+LOG_WORD_LEN]][snoop_way] <= 1'b0;
+                    end
+            end
+    endtask
 
     wire [ADDR_WIDTH-1:0] addr = virtual_mode ? {trns_tag, in_addr[LOG_SETS+LOG_LINE_LEN+LOG_WORD_LEN-1:0]} : in_addr;
     wire [LOG_LINE_LEN+LOG_WORD_LEN-1:LOG_WORD_LEN] offset = addr[LOG_LINE_LEN+LOG_WORD_LEN-1:LOG_WORD_LEN];
@@ -110,6 +170,9 @@ module Dcache
     wire [ADDR_WIDTH-1:LOG_SETS+LOG_LINE_LEN+LOG_WORD_LEN] trns_tag = translated_addr[ADDR_WIDTH-1:LOG_SETS+LOG_LINE_LEN+LOG_WORD_LEN];
 
     wire isIO = addr < RAM_START;
+
+    wire [DATA_WIDTH-1:0] wdata_shifted = wdata << {addr[LOG_WORD_LEN-1:0], 3'b000};
+    integer wbyte;
     reg [DATA_WIDTH-1:0] IO_reg;
 
     always_comb begin
@@ -170,8 +233,8 @@ module Dcache
             for (way = 0; way < WAYS; way = way + 1)
                 if (tag == line_tag[index][way] && line_valid[index][way]) begin
                     rdata = mem[index][way][offset];
-                    dcache_valid = !dcache_m_axi_acvalid && dcache_enable && (!virtual_mode || translated_addr_valid) && !wrn;
-                    write_done = state == 4'h0 && !dcache_m_axi_acvalid && dcache_enable && (!virtual_mode || translated_addr_valid) && wrn;
+                    dcache_valid = !snoop_seen && dcache_enable && (!virtual_mode || translated_addr_valid) && !wrn;
+                    write_done = state == 4'h0 && !snoop_seen && dcache_enable && (!virtual_mode || translated_addr_valid) && wrn;
                     mru = way;
                 end
         end
@@ -185,7 +248,8 @@ module Dcache
     end
 
     assign dcache_m_axi_wdata = (state == 4'h2) ? mem[rplc_index][rplc_way][rplc_offset] : (state == 4'h6) ? IO_reg : 0;
-    assign dcache_m_axi_acready = state == 4'h0;
+    assign dcache_m_axi_acready = (state == 4'h0 || (state == 4'h3 && !dcache_m_axi_arready)) && !fill_hold
+                                  && !(snoop_cleans && snoop_hit_dirty);
     assign dcache_m_axi_awvalid = (state == 4'h1) || (state == 4'h5);
     assign dcache_m_axi_wvalid = (state == 4'h2) || (state == 4'h6);
     assign dcache_m_axi_arvalid = (state == 4'h3) || (state == 4'h7);
@@ -203,6 +267,9 @@ module Dcache
             line_dirty <= '{SETS{'{WAYS{1'b0}}}};
             rplc_addr <= 0;
             IO_reg <= 0;
+            snoop_wb <= 1'b0;
+            snoop_resume <= 1'b0;
+            fill_hold <= 1'b0;
             
             dcache_m_axi_arid <= 1'b1 << (ID_WIDTH-1);      // transaction id
             dcache_m_axi_arburst <= 2'h2;// 2 in enum, bursttype=wrap
@@ -216,15 +283,17 @@ module Dcache
             dcache_m_axi_awprot <= 3'h6; // enum, means something
             dcache_m_axi_bready <= 1'b1;
         end else begin
+            fill_hold <= 1'b0;
             case(state)
             4'h0: begin // idle
-                if(dcache_m_axi_acvalid && (dcache_m_axi_acsnoop == 4'hd)) begin // snoop invalidation
-                    for (snoop_way = 0; snoop_way < WAYS; snoop_way = snoop_way + 1)
-                        if(line_tag[snoop_index][snoop_way] == snoop_tag) begin
-                            line_valid[snoop_index][snoop_way] <= 1'b0;
-                            line_dirty[snoop_index][snoop_way] <= 1'b0;
-                        end
-                end else if(dcache_enable && (!virtual_mode || translated_addr_valid)) begin
+                if(snoop_seen && snoop_cleans && snoop_hit_dirty) begin // snoop clean: write back first
+                    rplc_addr <= snoop_dirty_addr;
+                    rplc_way <= snoop_dirty_way;
+                    snoop_wb <= 1'b1;
+                    state <= 4'h1;
+                end else if(snoop_seen && snoop_invalidates) // snoop invalidation
+                    snoop_invalidate();
+                else if(dcache_enable && (!virtual_mode || translated_addr_valid)) begin
                     rplc_addr <= addr;
                     if(isIO) begin
                         if(wrn) begin // IO write
@@ -236,12 +305,9 @@ module Dcache
                         rplc_way <= victim_way;
                         if(dcache_valid || write_done) begin // hit
                             if(write_done) begin // write
-                                case(wlen)
-                                2'h0: mem[index][mru][offset][8*addr[LOG_WORD_LEN-1:0]+:8] <= wdata;
-                                2'h1: mem[index][mru][offset][16*addr[LOG_WORD_LEN-1:1]+:16] <= wdata;
-                                2'h2: mem[index][mru][offset][32*addr[LOG_WORD_LEN-1]+:32] <= wdata;
-                                2'h3: mem[index][mru][offset] <= wdata;
-                                endcase
+                                for (wbyte = 0; wbyte < WORD_LEN; wbyte = wbyte + 1)
+                                    if (wmask[wbyte])
+                                        mem[index][mru][offset][8*wbyte+:8] <= wdata_shifted[8*wbyte+:8];
 
                                 // TODO: NOT NEEDED, WAS ONLY FOR ECALL HACK
                                 //  // Also notify do_pending_write to make Mike's ecall hacks work 
@@ -273,7 +339,14 @@ module Dcache
                     rplc_offset <= rplc_offset + 1;
                     if(dcache_m_axi_wlast) begin
                         line_dirty[rplc_index][rplc_way] <= 1'b0;
-                        state <= 4'h3;
+                        snoop_wb <= 1'b0;
+                        snoop_resume <= 1'b0;
+                        // snoop write-backs go back to idle (or the fill) to finish the snoop
+                        state <= (snoop_wb && !snoop_resume) ? 4'h0 : 4'h3;
+                        if(snoop_resume) begin
+                            rplc_addr <= fill_addr;
+                            rplc_way <= fill_way;
+                        end
                     end
                 end
             end
@@ -284,6 +357,16 @@ module Dcache
                 rplc_offset <= rplc_addr[LOG_LINE_LEN+LOG_WORD_LEN-1:LOG_WORD_LEN];
                 if(dcache_m_axi_arready)
                     state <= 4'h4;
+                else if(snoop_seen && snoop_cleans && snoop_hit_dirty) begin // write that back, then fill
+                    fill_addr <= rplc_addr;
+                    fill_way <= rplc_way;
+                    rplc_addr <= snoop_dirty_addr;
+                    rplc_way <= snoop_dirty_way;
+                    snoop_wb <= 1'b1;
+                    snoop_resume <= 1'b1;
+                    state <= 4'h1;
+                end else if(snoop_seen && snoop_invalidates)
+                    snoop_invalidate();
             end
             4'h4: begin // data channel
                 if(dcache_m_axi_rvalid) begin
@@ -292,6 +375,7 @@ module Dcache
                     rplc_offset <= rplc_offset + 1;
                     if(dcache_m_axi_rlast) begin
                         line_valid[rplc_index][rplc_way] <= 1'b1;
+                        fill_hold <= 1'b1;
                         state <= 4'h0;
                     end
                 end
@@ -54,6 +54,7 @@ typedef struct packed {
 
     logic is_wfi;
     logic is_sfence_vma; 
+    logic is_fence; // waits in MEM for the store buffer to drain
 
     // Atomic Instructions
     logic is_atomic;
@@ -62,15 +63,75 @@ typedef struct packed {
 
     logic alu_nop; // Don't do anything in the ALU. Pass rs1 through as the alu result.
 
+    logic is_compressed; // expanded from a 2-byte RVC op, so the next op is at pc+2
+
 } decoded_inst_t;
 
 
 
+// =============================================================
+//        Pre-decode (raw instruction bits, for dual-issue pairing in IF)
+
+// Plain integer ALU ops: never trap in decode, never touch memory or CSRs,
+// never jump, so they can run in the second ALU
+function automatic logic predecode_simple_alu(input logic [31:0] inst);
+    case (inst[6:0]) inside
+        OP_OP, OP_OP_32, OP_OP_IMM, OP_IMM_32, OP_LUI, OP_AUIPC: predecode_simple_alu = 1;
+        default: predecode_simple_alu = 0;
+    endcase
+endfunction
+
+// Ops that flush the pipeline behind themselves in MEM and restart at the next op
+// (CSRs, SYSTEM, fences), so nothing may issue alongside them
+function automatic logic predecode_serializing(input logic [31:0] inst);
+    predecode_serializing = inst[6:0] inside { OP_SYSTEM, OP_MISC_MEM };
+endfunction
+
+// Writes a nonzero rd
+function automatic logic predecode_writes_rd(input logic [31:0] inst);
+    predecode_writes_rd = inst[11:7] != 0 && !(inst[6:0] inside { OP_STORE, OP_BRANCH });
+endfunction
+
+// Only meaningful for predecode_simple_alu ops
+function automatic logic predecode_alu_reads(input logic [31:0] inst, input logic [4:0] r);
+    case (inst[6:0]) inside
+        OP_OP, OP_OP_32:       predecode_alu_reads = inst[19:15] == r || inst[24:20] == r;
+        OP_OP_IMM, OP_IMM_32:  predecode_alu_reads = inst[19:15] == r;
+        default:               predecode_alu_reads = 0; // LUI, AUIPC
+    endcase
+endfunction
+
+
+
+// =============================================================
+//        CSRs
+
+// The CSRs Privilege_System implements; any other address is an illegal
+// instruction.  The hpm counters/events and the ID registers read as 0.
+function automatic logic csr_implemented(input logic [11:0] addr);
+    case (addr) inside
+        CSR_CYCLE, CSR_TIME, CSR_INSTRET, [CSR_HPMCOUNTER3:CSR_HPMCOUNTER31],
+        CSR_SSTATUS, CSR_SIE, CSR_STVEC, CSR_SCOUNTEREN,
+        CSR_SSCRATCH, CSR_SEPC, CSR_SCAUSE, CSR_STVAL, CSR_SIP, CSR_SATP,
+        CSR_MVENDORID, CSR_MARCHID, CSR_MIMPID, CSR_MHARTID,
+        CSR_MSTATUS, CSR_MISA, CSR_MEDELEG, CSR_MIDELEG, CSR_MIE, CSR_MTVEC, CSR_MCOUNTEREN,
+        CSR_MSCRATCH, CSR_MEPC, CSR_MCAUSE, CSR_MTVAL, CSR_MIP,
+        CSR_MCYCLE, CSR_MINSTRET, [CSR_MHPMCOUNTER3:CSR_MHPMCOUNTER31],
+        CSR_MCOUNTINHIBIT, [CSR_MHPMEVENT3:CSR_MHPMEVENT31]:
+            csr_implemented = 1;
+        default:
+            csr_implemented = 0;
+    endcase
+endfunction
+
+
+
 // =============================================================
 //                       The Actual Decoder
 module Decoder
 (
     input [31:0] inst,
+    input compressed, // inst was expanded from a 16-bit op in IF
     input valid,
     input [63:0] pc,
     output decoded_inst_t out,
@@ -151,12 +212,14 @@ module Decoder
         out.csr_immed = 0;
 
         out.alu_nop = 0;
+        out.is_compressed = compressed;
 
         // priv
         out.is_trap_ret = 0;
         out.trap_ret_priv = 0;
         out.is_wfi = 0;
         out.is_sfence_vma = 0;
+        out.is_fence = 0;
 
         out.is_atomic = 0;
         out.alu_op = 0;
@@ -310,8 +373,11 @@ module Decoder
 
             OP_MISC_MEM: begin
                 if (funct3 == F3MM_FENCE) begin
-                    //We have no multicore, so FENCE should just be a noop
+                    //FENCE waits in MEM for the store buffer to drain: once in the
+                    //D$, stores are seen by devices and by other harts, which snoop
+                    //lines out of it (see hart_interconnect.sv)
                     out.immed = 0;
+                    out.is_fence = 1;
                     out.funct7 = 0;
                     { out.en_rs1, out.en_rs2, out.en_rd } = 3'b000;
 
@@ -374,8 +440,9 @@ module Decoder
                         end
                         else if (immed_I == 12'b0001_0000_0101) begin
                             // WFI
-                            // spec allows WFI to be a noop
-                            out.is_wfi = 1; //TODO: we shouldn't need any logic for this?
+                            // stalls in MEM until an interrupt is pending (see MEM_Stage),
+                            // which lets the harness skip idle cycles
+                            out.is_wfi = 1;
                             // $display("wfi, inst=%x, pc=%x", inst, pc);
                         end
                         else if (funct7 == 7'b000_1001) begin
@@ -449,6 +516,18 @@ module Decoder
                         $error("Invalid instruction for opcode=OP_SYSTEM. funct3 = %x.", funct3);
                     end
                 endcase
+
+                // CSRs that don't exist, belong to a more privileged mode, or are
+                // read-only and would be written (rs1/zimm of 0 doesn't write for
+                // the set/clear forms) are illegal
+                if (out.is_csr && (!csr_implemented(csr) || curr_priv_mode < csr[9:8] ||
+                                   (csr[11:10] == 2'b11 && (out.csr_rw || zimm != 0)))) begin
+                    $display("Illegal instruction trap: CSR access to 0x%x, pc=%x", csr, pc);
+                    gen_trap = 1;
+                    gen_trap_cause = MCAUSE_ILLEGAL_INST;
+                    { out.is_csr, out.csr_rw, out.csr_rs, out.csr_rc } = 4'b0000;
+                    { out.en_rs1, out.en_rd } = 2'b00;
+                end
             end
             
             OP_AMO: begin 
@@ -0,0 +1,330 @@
+// Replays an AXI trace (recorded with AXI_TRACE=<file>, see ../axi_trace.h)
+// against several DRAMSim2 configurations, one process per configuration so
+// they run in parallel (DRAMSim2 keeps its parameters in globals, so one
+// process can't hold two differently configured instances), and reports
+// latency and bandwidth for each.
+//
+// usage: dramsweep [-j jobs] [-d inidir] [-w window] trace config...
+//   config is DEVICE.ini[,KEY=VALUE...], where each KEY=VALUE overrides a
+//   line of the system ini (SYSTEM=file picks a different one than system.ini)
+//
+// e.g. to compare the default setup with a closed-page policy and two channels:
+//   dramsweep trace.axi DDR2_micron_16M_8b_x8_sg3E.ini
+//       DDR2_micron_16M_8b_x8_sg3E.ini,ROW_BUFFER_POLICY=close_page
+//       DDR2_micron_16M_8b_x8_sg3E.ini,NUM_CHANS=2,ADDRESS_MAPPING_SCHEME=scheme7
+//
+// Requests are issued at the cycle they were recorded at, or later if the
+// memory controller can't take them yet, so this is an open-loop replay: the
+// core's own reaction to different latencies isn't modeled.
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <assert.h>
+#include <algorithm>
+#include <chrono>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <iomanip>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "DRAMSim2/DRAMSim.h"
+#include "../axi_trace.h"
+
+using namespace std;
+
+struct Config {
+    string label;   // as given on the command line
+    string device;
+    string system;
+    vector<pair<string, string> > overrides;
+};
+
+static const axi_trace_header* trace_header;
+static const axi_trace_record* trace_records;
+static size_t trace_count;
+
+static Config parse_config(const string& arg) {
+    Config config;
+    config.label = arg;
+    config.system = "system.ini";
+    stringstream ss(arg);
+    string item;
+    getline(ss, config.device, ',');
+    while (getline(ss, item, ',')) {
+        size_t eq = item.find('=');
+        if (eq == string::npos) {
+            cerr << "Bad override \"" << item << "\" in " << arg << ", expected KEY=VALUE" << endl;
+            exit(-1);
+        }
+        if (item.substr(0, eq) == "SYSTEM")
+            config.system = item.substr(eq+1);
+        else
+            config.overrides.push_back(make_pair(item.substr(0, eq), item.substr(eq+1)));
+    }
+    return config;
+}
+
+// Copy of the system ini with the config's overrides applied.  Debug and
+// visualization output are off unless asked for, since they'd swamp the sweep.
+static string write_system_ini(const string& inidir, const Config& config) {
+    vector<pair<string, string> > overrides;
+    overrides.push_back(make_pair("VIS_FILE_OUTPUT", "false"));
+    overrides.push_back(make_pair("DEBUG_TRANS_Q", "false"));
+    overrides.insert(overrides.end(), config.overrides.begin(), config.overrides.end());
+
+    ifstream in((inidir + "/" + config.system).c_str());
+    if (!in) {
+        cerr << "Could not read " << inidir << "/" << config.system << endl;
+        exit(-1);
+    }
+    stringstream out;
+    string line;
+    while (getline(in, line)) {
+        string key = line.substr(0, line.find_first_of("= \t;"));
+        bool replaced = false;
+        for (size_t i = 0; i < overrides.size(); ++i)
+            if (!key.empty() && overrides[i].first == key) replaced = true;
+        if (!replaced) out << line << endl;
+    }
+    for (size_t i = 0; i < overrides.size(); ++i)
+        out << overrides[i].first << "=" << overrides[i].second << endl;
+
+    char filename[] = "/tmp/dramsweep-system-XXXXXX";
+    int fd = mkstemp(filename);
+    assert(fd != -1);
+    string contents = out.str();
+    assert(write(fd, contents.data(), contents.size()) == (ssize_t)contents.size());
+    assert(close(fd) == 0);
+    return filename;
+}
+
+static uint64_t percentile(const vector<uint64_t>& sorted, int p) {
+    if (sorted.empty()) return 0;
+    return sorted[min(sorted.size()-1, sorted.size()*p/100)];
+}
+
+class Replay {
+    DRAMSim::MultiChannelMemorySystem* dramsim;
+    uint64_t now;
+    map<uint64_t, deque<uint64_t> > outstanding; // address -> cycles the core asked for it, oldest first
+    size_t outstanding_count;
+    uint64_t window;
+    vector<uint64_t> window_bytes;
+
+    void complete(uint64_t address, vector<uint64_t>& latencies) {
+        map<uint64_t, deque<uint64_t> >::iterator it = outstanding.find(address);
+        assert(it != outstanding.end());
+        latencies.push_back(now - it->second.front());
+        it->second.pop_front();
+        if (it->second.empty()) outstanding.erase(it);
+        --outstanding_count;
+        if (window_bytes.size() <= now / window) window_bytes.resize(now / window + 1);
+        window_bytes[now / window] += 64;
+    }
+
+public:
+    vector<uint64_t> read_latency, write_latency; // core cycles, from the recorded request to completion
+    uint64_t delayed, delay_cycles;               // requests the controller couldn't take on time
+    uint64_t end_cycle;
+
+    Replay(DRAMSim::MultiChannelMemorySystem* dramsim, uint64_t window)
+        : dramsim(dramsim), now(0), outstanding_count(0), window(window), delayed(0), delay_cycles(0), end_cycle(0) {}
+
+    void read_done(unsigned id, uint64_t address, uint64_t clock_cycle) { complete(address, read_latency); }
+    void write_done(unsigned id, uint64_t address, uint64_t clock_cycle) { complete(address, write_latency); }
+
+    // Steps next past time-only records, adding every record's cycles into
+    // next_cycle; false once the trace runs out
+    static bool next_access(size_t& next, uint64_t& next_cycle) {
+        for (; next < trace_count; ++next) {
+            next_cycle += trace_records[next].cycle_delta;
+            if (trace_records[next].line_write != AXI_TRACE_SKIP) return true;
+        }
+        return false;
+    }
+
+    void run() {
+        size_t next = 0;
+        uint64_t next_cycle = 0;
+        bool have_next = next_access(next, next_cycle);
+        while (have_next || outstanding_count) {
+            while (have_next && next_cycle <= now && dramsim->willAcceptTransaction()) {
+                const uint32_t line_write = trace_records[next].line_write;
+                const uint64_t address = (uint64_t)(line_write >> 1) * 64;
+                assert(dramsim->addTransaction(line_write & 1, address));
+                outstanding[address].push_back(next_cycle);
+                ++outstanding_count;
+                if (next_cycle < now) {
+                    ++delayed;
+                    delay_cycles += now - next_cycle;
+                }
+                ++next;
+                have_next = next_access(next, next_cycle);
+            }
+
+            // Same shortcut as System::skip_idle_cycles: with nothing in flight,
+            // jump to the next request instead of stepping DRAMSim2 through the gap
+            if (!outstanding_count && have_next && next_cycle > now + 1) now = next_cycle - 1;
+
+            dramsim->update();
+            ++now;
+        }
+        end_cycle = now;
+    }
+
+    void report(ostream& out, const Config& config, double host_seconds) {
+        sort(read_latency.begin(), read_latency.end());
+        sort(write_latency.begin(), write_latency.end());
+
+        const uint64_t ps_per_clock = trace_header->ps_per_clock;
+        const uint64_t bytes = 64 * (read_latency.size() + write_latency.size());
+        // MB/s from bytes over cycles: bytes / (cycles * ps) * 10^6
+        vector<uint64_t> window_mbps; // MB/s, for windows that saw any traffic
+        for (size_t i = 0; i < window_bytes.size(); ++i)
+            if (window_bytes[i]) window_mbps.push_back(window_bytes[i] * 1000 * 1000 / (window * ps_per_clock));
+        sort(window_mbps.begin(), window_mbps.end());
+
+        out << "== " << config.label << endl;
+        out << "   " << read_latency.size() << " reads, " << write_latency.size() << " writes over "
+            << end_cycle << " cycles (replayed in " << fixed << setprecision(1) << host_seconds << "s)" << endl;
+
+        const char* names[] = { "read", "write" };
+        const vector<uint64_t>* latencies[] = { &read_latency, &write_latency };
+        for (int i = 0; i < 2; ++i) {
+            const vector<uint64_t>& lat = *latencies[i];
+            if (lat.empty()) continue;
+            uint64_t sum = 0;
+            for (size_t j = 0; j < lat.size(); ++j) sum += lat[j];
+            out << "   " << setw(5) << names[i] << " latency (cycles): mean " << sum / lat.size()
+                << "  min " << lat.front() << "  p50 " << percentile(lat, 50) << "  p90 " << percentile(lat, 90)
+                << "  p99 " << percentile(lat, 99) << "  max " << lat.back() << endl;
+        }
+        if (end_cycle)
+            out << "   bandwidth: " << bytes * 1000 * 1000 / (end_cycle * ps_per_clock) << " MB/s average; per "
+                << window << "-cycle busy window p50 " << percentile(window_mbps, 50) << "  p90 " << percentile(window_mbps, 90)
+                << "  p99 " << percentile(window_mbps, 99) << "  max " << (window_mbps.empty() ? 0 : window_mbps.back()) << " MB/s" << endl;
+        out << "   " << delayed << " requests waited for the controller, " << delay_cycles << " cycles in total" << endl;
+    }
+};
+
+// Runs in the child: replays the trace against one configuration and writes
+// the report to fd
+static void run_config(const string& inidir, const Config& config, uint64_t window, int fd) {
+    // DRAMSim2 prints its setup to stdout
+    int devnull = open("/dev/null", O_WRONLY);
+    if (devnull != -1) dup2(devnull, STDOUT_FILENO);
+
+    string system_ini = write_system_ini(inidir, config);
+    DRAMSim::MultiChannelMemorySystem* dramsim =
+        DRAMSim::getMemorySystemInstance(config.device, system_ini, inidir, "dramsweep", trace_header->ram_megs);
+    unlink(system_ini.c_str());
+
+    Replay replay(dramsim, window);
+    DRAMSim::TransactionCompleteCB *read_cb = new DRAMSim::Callback<Replay, void, unsigned, uint64_t, uint64_t>(&replay, &Replay::read_done);
+    DRAMSim::TransactionCompleteCB *write_cb = new DRAMSim::Callback<Replay, void, unsigned, uint64_t, uint64_t>(&replay, &Replay::write_done);
+    dramsim->RegisterCallbacks(read_cb, write_cb, NULL);
+    dramsim->setCPUClockSpeed(1000ULL*1000*1000*1000/trace_header->ps_per_clock);
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    replay.run();
+    const double host_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    stringstream out;
+    replay.report(out, config, host_seconds);
+    string text = out.str();
+    assert(write(fd, text.data(), text.size()) == (ssize_t)text.size());
+}
+
+static void usage() {
+    cerr << "usage: dramsweep [-j jobs] [-d inidir] [-w window] trace DEVICE.ini[,KEY=VALUE...]..." << endl;
+    exit(-1);
+}
+
+int main(int argc, char* argv[]) {
+    int jobs = sysconf(_SC_NPROCESSORS_ONLN);
+    string inidir = "../dramsim2";
+    uint64_t window = 10000;
+    int opt;
+    while ((opt = getopt(argc, argv, "j:d:w:")) != -1) {
+        switch (opt) {
+            case 'j': jobs = atoi(optarg); break;
+            case 'd': inidir = optarg; break;
+            case 'w': window = strtoull(optarg, NULL, 0); break;
+            default: usage();
+        }
+    }
+    if (argc - optind < 2 || jobs < 1 || !window) usage();
+
+    // Map the trace before forking, so every replay shares the same pages
+    const char* trace_fn = argv[optind++];
+    int trace_fd = open(trace_fn, O_RDONLY);
+    struct stat st;
+    if (trace_fd == -1 || fstat(trace_fd, &st) != 0 || st.st_size < (off_t)sizeof(axi_trace_header)) {
+        cerr << "Could not read AXI trace " << trace_fn << endl;
+        return -1;
+    }
+    void* trace = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, trace_fd, 0);
+    assert(trace != MAP_FAILED);
+    trace_header = (const axi_trace_header*)trace;
+    trace_records = (const axi_trace_record*)(trace_header + 1);
+    trace_count = (st.st_size - sizeof(axi_trace_header)) / sizeof(axi_trace_record);
+    if (trace_header->magic != AXI_TRACE_MAGIC) {
+        cerr << trace_fn << " is not an AXI trace" << endl;
+        return -1;
+    }
+
+    vector<Config> configs;
+    for (int i = optind; i < argc; ++i) configs.push_back(parse_config(argv[i]));
+    cerr << "Replaying " << trace_count << " records against " << configs.size() << " configurations, "
+         << jobs << " at a time" << endl;
+
+    // Each child writes its report into a pipe; reports are small enough to
+    // fit in the pipe buffer, so they're only read once the child is done
+    vector<int> report_fd(configs.size(), -1);
+    vector<string> reports(configs.size());
+    map<pid_t, size_t> running;
+    size_t next = 0;
+    while (next < configs.size() || !running.empty()) {
+        if (next < configs.size() && (int)running.size() < jobs) {
+            int fds[2];
+            assert(pipe(fds) == 0);
+            pid_t pid = fork();
+            assert(pid != -1);
+            if (pid == 0) {
+                close(fds[0]);
+                run_config(inidir, configs[next], window, fds[1]);
+                _exit(0);
+            }
+            close(fds[1]);
+            report_fd[next] = fds[0];
+            running[pid] = next++;
+            continue;
+        }
+
+        int status;
+        pid_t pid = wait(&status);
+        assert(pid != -1);
+        size_t i = running[pid];
+        running.erase(pid);
+        char buf[4096];
+        ssize_t n;
+        while ((n = read(report_fd[i], buf, sizeof(buf))) > 0) reports[i].append(buf, n);
+        close(report_fd[i]);
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+            reports[i] = "== " + configs[i].label + "\n   replay failed\n";
+        cerr << "Finished " << configs[i].label << endl;
+    }
+
+    for (size_t i = 0; i < reports.size(); ++i) cout << reports[i];
+    return 0;
+}
@@ -19,6 +19,19 @@ typedef enum bit[1:0] {
 	RESERVED	= 2'b11
 } AxBURST; // ARBURST or AWBURST
 
+// ACSNOOP values in use: the harness sends CleanInvalid and MakeInvalid
+// (System::clean_invalidate/invalidate), harts send each other ReadUnique
+// (see hart_interconnect.sv).  The two range snoops aren't ACE: the harness
+// sends them for a run of lines in one 4K page, with acaddr[11:6] the first
+// line and acaddr[5:0] the last.
+typedef enum bit[3:0] {
+	SNOOP_READ_UNIQUE	= 4'h7,
+	SNOOP_CLEAN_INVALID	= 4'h9,
+	SNOOP_CLEAN_INVALID_RANGE	= 4'hA,
+	SNOOP_MAKE_INVALID_RANGE	= 4'hC,
+	SNOOP_MAKE_INVALID	= 4'hD
+} AcSNOOP;
+
 
 // == Enables branch, conditionally or unconditionally
 typedef enum bit[1:0] {
@@ -91,6 +104,9 @@ typedef enum bit[11:0] {
     CSR_SATP        = 12'h180,
 
     // Machine Information Registers
+    CSR_MVENDORID   = 12'hF11,
+    CSR_MARCHID     = 12'hF12,
+    CSR_MIMPID      = 12'hF13,
     CSR_MHARTID     = 12'hF14,
 
     // Machine Trap Setup
@@ -1,4 +1,5 @@
 #include <iostream>
+#include <limits.h>
 #include <set>
 #include <sys/mman.h>
 #include <sys/uio.h>
@@ -43,32 +44,82 @@ extern "C" {
 #define ECALL_DEBUG 0
 #define ECALL_MEMGUARD (10*1024)
 
+    // Heap pages are only backed once touched, and the host kernel returns
+    // EFAULT rather than raising SIGSEGV for buffers it can't reach, so map
+    // every page of a syscall's buffer before handing it over.
+    static void prefault(const long long virt_addr, const long long len) {
+        if (!System::sys->use_virtual_memory || len <= 0) return;
+        for(long long addr = virt_addr & ~(PAGE_SIZE-1); addr < virt_addr+len; addr += PAGE_SIZE)
+            System::sys->virt_to_phy(addr);
+    }
+
+    // read/write and the vectored calls hand the host kernel the guest's
+    // buffers in place, through a host copy of the iovecs with ram_virt
+    // pointers.  What a read wrote is known from its return value, so there's
+    // no snapshot to compare, and its lines are invalidated afterwards.
+    static long long to_host_iov(const vector<iovec>& guest, vector<iovec>& host) {
+        host = guest;
+        for(auto& v : host) {
+            prefault((long long)v.iov_base, v.iov_len);
+            v.iov_base = (char*)v.iov_base + (long long)System::sys->ram_virt;
+        }
+        return (long long)host.data();
+    }
+
+    static void invalidate_filled(const vector<iovec>& guest, long long filled, set<long long>& invalidations) {
+        for(auto& v : guest) {
+            const long long start = (long long)v.iov_base;
+            const long long end = start + min(filled, (long long)v.iov_len);
+            for(long long line = start & ~63; line < end; line += 64)
+                invalidations.insert(System::sys->virt_to_phy(line) & ~63);
+            filled -= end - start;
+            if (filled <= 0) break;
+        }
+    }
+
     void do_ecall(long long a7, long long a0, long long a1, long long a2, long long a3, long long a4, long long a5, long long a6, long long* a0ret) {
         vector<pair<long long, char[ECALL_MEMGUARD+63]> > memargs;
+        vector<iovec> guest_iov, host_iovs; // buffers passed in place (see to_host_iov)
+        bool fills_iov = false;
 
         switch(a7) {
 
         case __NR_brk:
             if (ECALL_DEBUG) cerr << "Allocate " << std::dec << (a0-System::sys->ecall_brk) << " bytes at 0x" << std::hex << System::sys->ecall_brk << std::dec << endl;
-            if ((a0 > System::sys->max_elf_addr) && (a0 < System::sys->ramsize)) {
-                for(long long addr = System::sys->ecall_brk; addr < a0; addr += PAGE_SIZE) System::sys->virt_to_phy(addr); // prefault
-                System::sys->virt_to_phy(a0-1); // prefault
-                System::sys->ecall_brk = a0;
-            }
+            if ((a0 > System::sys->max_elf_addr) && (a0 < System::sys->ramsize))
+                System::sys->ecall_brk = a0; // pages are allocated on first touch, see System::demand_fault
             *a0ret = System::sys->ecall_brk;
             return;
 
         case __NR_mmap:
-            assert(a0 == 0 && (a3 & MAP_ANONYMOUS)); // only support ANONYMOUS mmap with NULL argument
+            if (a3 & MAP_FIXED) { // a0 without MAP_FIXED is only a hint, and ignored
+                cerr << "Unsupported mmap with MAP_FIXED at 0x" << std::hex << a0 << endl;
+                Verilated::gotFinish(true);
+                return;
+            }
             System::sys->ecall_brk = (System::sys->ecall_brk + PAGE_SIZE-1) & ~(PAGE_SIZE-1); // align to 4K boundary
+            if (System::sys->ecall_brk + a1 > System::sys->ramsize) {
+                *a0ret = -ENOMEM;
+                return;
+            }
+            if (!(a3 & MAP_ANONYMOUS)) {
+                const int err = System::sys->map_file(System::sys->ecall_brk, a1, a4, a5, a3 & MAP_SHARED);
+                if (err) {
+                    *a0ret = err;
+                    return;
+                }
+            }
             *a0ret = System::sys->ecall_brk;
-            for(long long addr = System::sys->ecall_brk; addr < System::sys->ecall_brk+a1; addr += PAGE_SIZE) System::sys->virt_to_phy(addr); // prefault
-            System::sys->virt_to_phy(System::sys->ecall_brk+a1-1); // prefault
-            System::sys->ecall_brk += a1;
+            System::sys->ecall_brk += a1; // reserved only, like brk
             System::sys->ecall_brk = (System::sys->ecall_brk + PAGE_SIZE-1) & ~(PAGE_SIZE-1); // align to 4K boundary
             return;
 
-        case __NR_munmap:
+        case __NR_munmap: // address space stays reserved, as with brk
+        case __NR_msync:  // done at the next posedge, once the D$ has given up the dirty lines
+            System::sys->sync_file(a0, a1, a7 == __NR_munmap);
+            *a0ret = 0;
+            return;
+
         case __NR_mprotect:
             *a0ret = 0; // assume we succeeded
             return;
@@ -163,11 +214,38 @@ extern "C" {
             break;
 
         case __NR_read:
-        case __NR_write:
-        case __NR_fstat:
         case __NR_pread64:
+            fills_iov = true;
+            // fall through
+        case __NR_write:
         case __NR_pwrite64:
+            guest_iov.push_back({ (void*)a1, (size_t)a2 });
+            to_host_iov(guest_iov, host_iovs);
+            a1 = (long long)host_iovs[0].iov_base;
+            break;
+
+        case __NR_readv:
+        case __NR_preadv:
+            fills_iov = true;
+            // fall through
         case __NR_writev:
+        case __NR_pwritev:
+            if (a2 < 0 || a2 > IOV_MAX) {
+                *a0ret = -EINVAL;
+                return;
+            }
+            prefault(a1, a2 * sizeof(iovec));
+            guest_iov.assign((iovec*)(System::sys->ram_virt + a1), (iovec*)(System::sys->ram_virt + a1) + a2);
+            a1 = to_host_iov(guest_iov, host_iovs);
+            break;
+
+        case __NR_getdents:
+        case __NR_getdents64:
+            prefault(a1, a2);
+            ECALL_OFFSET(a1);
+            break;
+
+        case __NR_fstat:
         case __NR_shmat:
         case __NR_getitimer:
         case __NR_connect:
@@ -177,7 +255,6 @@ extern "C" {
         case __NR_semop:
         case __NR_msgsnd:
         case __NR_msgrcv:
-        case __NR_getdents:
         case __NR_getrlimit:
         case __NR_getrusage:
         case __NR_syslog:
@@ -194,7 +271,6 @@ extern "C" {
         case __NR_flistxattr:
         case __NR_fremovexattr:
         case __NR_io_setup:
-        case __NR_getdents64:
         case __NR_timer_gettime:
         case __NR_clock_settime:
         case __NR_clock_gettime:
@@ -371,9 +447,6 @@ extern "C" {
         case __NR_renameat2:
         case __NR_seccomp:
         case __NR_kexec_file_load:
-        case __NR_readv:
-        case __NR_preadv:
-        case __NR_pwritev:
             cerr << "Unsupported syscall " << std::dec << a7 << endl;
             Verilated::gotFinish(true);
             return;
@@ -393,11 +466,6 @@ extern "C" {
             }
         if (ECALL_DEBUG) cerr << "Calling syscall " << std::dec << a7;
 
-        iovec* iov = (iovec*)a1;
-        if (a7 == __NR_writev)
-            for(int i = 0; i < a2; ++i)
-                iov[i].iov_base = (char*)iov[i].iov_base + (long long)System::sys->ram_virt;
-
         int old_errno = errno;
         *a0ret = syscall(a7, a0, a1, a2, a3, a4, a5, a6);
         if (old_errno != errno) {
@@ -405,10 +473,6 @@ extern "C" {
             System::sys->set_errno(errno);
         }
 
-        if (a7 == __NR_writev)
-            for(int i = 0; i < a2; ++i)
-                iov[i].iov_base = (char*)iov[i].iov_base - (long long)System::sys->ram_virt;
-
         if (ECALL_DEBUG) cerr << " => " << std::dec << *a0ret << endl;
         set<long long> invalidations;
         for(auto& m : memargs)
@@ -419,6 +483,7 @@ extern "C" {
                     invalidations.insert(physptr & ~63);
                 }
             }
+        if (fills_iov && *a0ret > 0) invalidate_filled(guest_iov, *a0ret, invalidations);
         for(auto& i : invalidations)
             System::sys->invalidate(i);
     }
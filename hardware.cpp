@@ -1,20 +1,80 @@
 #include <iostream>
+#include <algorithm>
+#include <assert.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
 #include "system.h"
 #include "hardware.h"
 
 using namespace std;
 
-static uint64_t ticks_to_timer = 0;
+// ==== CLINT
+// mtime runs at RTC_HZ and is derived from simulated time, so it never has to
+// be stepped.  The interrupt lines only change when mtime crosses mtimecmp or
+// the guest writes a register, so both are computed ahead of time instead of
+// being polled every cycle.  Each hart has its own msip and mtimecmp, at the
+// usual SiFive offsets.
+#define RTC_HZ 32768
+#define PS_PER_RTC (1000000000000ULL/RTC_HZ)
+
+enum { CLINT_MSIP = 0x0000, CLINT_MTIMECMP = 0x4000, CLINT_MTIME = 0xbff8 };
+
+static uint64_t clint_msip[(HARTS+1)/2]; // 32 bits a hart, two to a word
+static uint64_t clint_mtimecmp[4] = { ~0ULL, ~0ULL, ~0ULL, ~0ULL }; // the first HARTS of them
+static_assert(HARTS >= 1 && HARTS <= 4, "top.sv has 1 to 4 harts");
+static uint64_t next_rtc_ticks = 0; // simulated time (ps) of the next mtime change
+
+static bool clint_msip_set(const int hart) {
+    return (clint_msip[hart/2] >> (hart%2 * 32)) & 1;
+}
+
+static uint64_t clint_mtime() {
+    return System::sys->ticks / PS_PER_RTC;
+}
+
 void rtc_tick(Vtop* top) {
-    if (ticks_to_timer == 1) {
-        top->hz32768timer = 1;
-        top->mtime++;
+    if (System::sys->ticks < next_rtc_ticks) return;
+    uint64_t mtime = clint_mtime();
+    top->mtime = mtime;
+    uint32_t mtip = 0, msip = 0;
+    for (int hart = 0; hart < HARTS; ++hart) {
+        if (mtime >= clint_mtimecmp[hart]) mtip |= 1U << hart;
+        if (clint_msip_set(hart)) msip |= 1U << hart;
     }
-    else if (ticks_to_timer == 0) {
-        top->hz32768timer = 0;
-        ticks_to_timer = 1000000000000ULL/32768/System::sys->ps_per_clock;
+    top->mtip = mtip;
+    top->msip = msip;
+    next_rtc_ticks = (mtime+1) * PS_PER_RTC;
+}
+
+// Cycle at which the CLINT will next raise an interrupt.  With no timer armed,
+// this is the next mtime increment, so idle time still advances in steps.
+uint64_t clint_next_event_cycle() {
+    const uint64_t ps_per_clock = System::sys->ps_per_clock;
+    uint64_t event_ticks = ~0ULL;
+    for (int hart = 0; hart < HARTS; ++hart) {
+        if (clint_msip_set(hart)) return System::sys->cycle;
+        // The soonest timer of any hart wakes them all
+        const uint64_t mtimecmp = clint_mtimecmp[hart];
+        if (mtimecmp < ~0ULL / PS_PER_RTC)
+            event_ticks = min<uint64_t>(event_ticks, max<uint64_t>(next_rtc_ticks, mtimecmp * PS_PER_RTC));
     }
-    --ticks_to_timer;
+    if (event_ticks == ~0ULL) event_ticks = next_rtc_ticks;
+    return (event_ticks + ps_per_clock-1) / ps_per_clock;
+}
+
+static uint64_t* clint_reg(const uint64_t offset) {
+    static uint64_t mtime;
+    const uint64_t word = offset & ~7ULL;
+    if (word == CLINT_MTIME) {
+        mtime = clint_mtime();
+        return &mtime;
+    }
+    if (word >= CLINT_MSIP && word < CLINT_MSIP + 4*HARTS)
+        return &clint_msip[(word - CLINT_MSIP) / 8];
+    if (word >= CLINT_MTIMECMP && word < CLINT_MTIMECMP + 8*HARTS)
+        return &clint_mtimecmp[(word - CLINT_MTIMECMP) / 8];
+    return NULL;
 }
 
 void write_one(const Device* self, Vtop* top) {
@@ -22,29 +82,229 @@ void write_one(const Device* self, Vtop* top) {
     System::sys->w_count = 1;
 }
 
+// Reads return the whole aligned 64-bit word; the core picks out the bytes it asked for
 void clint_read(const Device* self, Vtop* top) {
-    //cerr << "Read request of CLINT address (" << std::hex << System::sys->w_addr << ") unsupported, but will return 0 and keep going" << endl;
-    System::sys->read_response(0, top->m_axi_arid, true);
+    uint64_t* reg = clint_reg(top->m_axi_araddr - self->start);
+    if (!reg) cerr << "Read request of CLINT address (" << std::hex << top->m_axi_araddr << ") unsupported, but will return 0 and keep going" << endl;
+    System::sys->read_response(reg ? *reg : 0, top->m_axi_arid, true);
 }
 
+// Write data arrives in the low bytes, with the strobe giving its width
 void clint_write_data(const Device* self, Vtop* top) {
-    //cerr << "Write request of CLINT address (" << std::hex << System::sys->w_addr << ") unsupported, but will keep going anyway" << endl;
+    const uint64_t offset = System::sys->w_addr - self->start;
+    uint64_t* reg = clint_reg(offset);
+    if (!reg || (offset & ~7ULL) == CLINT_MTIME) {
+        cerr << "Write request of CLINT address (" << std::hex << System::sys->w_addr << ") unsupported, but will keep going anyway" << endl;
+        return;
+    }
+    const int shift = (offset & 7) * 8;
+    uint64_t mask;
+    switch(top->m_axi_wstrb) {
+        case 0x0F: mask = 0xffffffffULL; break;
+        case 0xFF: mask = ~0ULL; break;
+        default:
+            cerr << "Write request of CLINT address with unsupported strobe value (" << std::hex << (int)(top->m_axi_wstrb) << ")" << endl;
+            Verilated::gotFinish(true);
+            return;
+    }
+    *reg = (*reg & ~(mask << shift)) | ((top->m_axi_wdata & mask) << shift);
+    next_rtc_ticks = 0; // update the interrupt lines on the next tick
 }
 
+// ==== PLIC
+// Sources are level-triggered: a device calls plic_set_level() whenever its
+// interrupt line changes.  Context 2h is hart h in M mode, context 2h+1 is
+// hart h in S mode, matching the order of interrupts-extended in hardware.dtsi.
+#define PLIC_SOURCES  32
+#define PLIC_CONTEXTS (2*HARTS)
+
+enum { PLIC_PRIORITY = 0x0, PLIC_PENDING = 0x1000, PLIC_ENABLE = 0x2000, PLIC_ENABLE_STRIDE = 0x80,
+       PLIC_CONTEXT = 0x200000, PLIC_CONTEXT_STRIDE = 0x1000, PLIC_THRESHOLD = 0x0, PLIC_CLAIM = 0x4 };
+
+static uint32_t plic_priority[PLIC_SOURCES];
+static uint32_t plic_level = 0;   // current state of each source's line
+static uint32_t plic_pending = 0;
+static uint32_t plic_claimed = 0; // claimed but not yet completed, so not re-pended
+static uint32_t plic_enable[PLIC_CONTEXTS];
+static uint32_t plic_threshold[PLIC_CONTEXTS];
+static bool plic_dirty = true;    // top->meip/seip need recomputing
+
+// Highest-priority pending source enabled for ctx, or 0 if none beats its threshold
+static int plic_best(const int ctx, const bool use_threshold) {
+    int best = 0;
+    uint32_t best_priority = use_threshold ? plic_threshold[ctx] : 0;
+    for(int src = 1; src < PLIC_SOURCES; ++src)
+        if ((plic_pending & plic_enable[ctx] & (1U << src)) && plic_priority[src] > best_priority) {
+            best = src;
+            best_priority = plic_priority[src];
+        }
+    return best;
+}
+
+void plic_set_level(const int src, const bool level) {
+    assert(0 < src && src < PLIC_SOURCES);
+    if (level) plic_level |= 1U << src;
+    else plic_level &= ~(1U << src);
+    plic_dirty = true;
+}
+
+void plic_update(Vtop* top) {
+    if (!plic_dirty) return;
+    plic_pending |= plic_level & ~plic_claimed;
+    uint32_t meip = 0, seip = 0;
+    for (int hart = 0; hart < HARTS; ++hart) {
+        if (plic_best(2*hart, true)) meip |= 1U << hart;
+        if (plic_best(2*hart+1, true)) seip |= 1U << hart;
+    }
+    top->meip = meip;
+    top->seip = seip;
+    plic_dirty = false;
+}
+
+static uint32_t plic_read_reg(const uint64_t offset) {
+    if (offset < PLIC_PENDING) return plic_priority[offset/4 % PLIC_SOURCES];
+    if (offset == PLIC_PENDING) return plic_pending;
+    if (offset >= PLIC_ENABLE && offset < PLIC_ENABLE + PLIC_ENABLE_STRIDE*PLIC_CONTEXTS) {
+        if ((offset - PLIC_ENABLE) % PLIC_ENABLE_STRIDE) return 0; // sources 32 and up
+        return plic_enable[(offset - PLIC_ENABLE) / PLIC_ENABLE_STRIDE];
+    }
+    if (offset >= PLIC_CONTEXT && offset < PLIC_CONTEXT + PLIC_CONTEXT_STRIDE*PLIC_CONTEXTS) {
+        const int ctx = (offset - PLIC_CONTEXT) / PLIC_CONTEXT_STRIDE;
+        switch((offset - PLIC_CONTEXT) % PLIC_CONTEXT_STRIDE) {
+            case PLIC_THRESHOLD: return plic_threshold[ctx];
+            case PLIC_CLAIM: {
+                const int src = plic_best(ctx, false);
+                plic_pending &= ~(1U << src);
+                if (src) plic_claimed |= 1U << src;
+                plic_dirty = true;
+                return src;
+            }
+        }
+    }
+    cerr << "Read request of PLIC offset (" << std::hex << offset << ") unsupported, but will return 0 and keep going" << endl;
+    return 0;
+}
+
+static void plic_write_reg(const uint64_t offset, const uint32_t val) {
+    plic_dirty = true;
+    if (offset < PLIC_PENDING) {
+        plic_priority[offset/4 % PLIC_SOURCES] = val;
+        return;
+    }
+    if (offset >= PLIC_ENABLE && offset < PLIC_ENABLE + PLIC_ENABLE_STRIDE*PLIC_CONTEXTS) {
+        if ((offset - PLIC_ENABLE) % PLIC_ENABLE_STRIDE == 0) plic_enable[(offset - PLIC_ENABLE) / PLIC_ENABLE_STRIDE] = val & ~1U;
+        return;
+    }
+    if (offset >= PLIC_CONTEXT && offset < PLIC_CONTEXT + PLIC_CONTEXT_STRIDE*PLIC_CONTEXTS) {
+        const int ctx = (offset - PLIC_CONTEXT) / PLIC_CONTEXT_STRIDE;
+        switch((offset - PLIC_CONTEXT) % PLIC_CONTEXT_STRIDE) {
+            case PLIC_THRESHOLD: plic_threshold[ctx] = val; return;
+            case PLIC_CLAIM: if (val < PLIC_SOURCES) plic_claimed &= ~(1U << val); return; // complete
+        }
+    }
+    cerr << "Write request of PLIC offset (" << std::hex << offset << ") unsupported, but will keep going anyway" << endl;
+}
+
+void plic_read(const Device* self, Vtop* top) {
+    const uint64_t offset = top->m_axi_araddr - self->start;
+    if (top->m_axi_arsize != 2) {
+        cerr << "Read request of PLIC address (" << std::hex << top->m_axi_araddr << ") with size " << std::dec << (1 << top->m_axi_arsize) << " unsupported" << endl;
+        Verilated::gotFinish(true);
+    }
+    System::sys->read_response((uint64_t)plic_read_reg(offset) << ((offset & 7)*8), top->m_axi_arid, true);
+    plic_update(top);
+}
+
+void plic_write_data(const Device* self, Vtop* top) {
+    if (top->m_axi_wstrb != 0x0F) {
+        cerr << "Write request of PLIC address with unsupported strobe value (" << std::hex << (int)(top->m_axi_wstrb) << ")" << endl;
+        Verilated::gotFinish(true);
+        return;
+    }
+    plic_write_reg(System::sys->w_addr - self->start, top->m_axi_wdata);
+    plic_update(top);
+}
+
+// ==== UART Lite
+// TX bytes are collected in a buffer and written out a line at a time, rather
+// than with one write(2) per character.  From the guest's point of view the
+// TX FIFO drains instantly.  The buffer is written out on a newline, when it
+// fills, when the core goes idle (a prompt waiting for input), and at exit,
+// and also when the guest polls for input without going idle: on an RXFIFO
+// read, or a STATUS read with no TX byte since the last one (a TX loop reads
+// STATUS before every byte, which shouldn't cost a write(2) each).
+// RX bytes come from stdin (or the file named by UART_INPUT), without ever
+// blocking the simulation.  For the same reason a STATUS read only checks for
+// input every UART_POLL_CYCLES; reading an empty RXFIFO always checks.
 enum { UART_LITE_REG_RXFIFO = 0, UART_LITE_REG_TXFIFO = 1, UART_LITE_STAT_REG = 2, UART_LITE_CTRL_REG = 3 };
-enum { UART_LITE_TX_FULL = 3, UART_LITE_RX_FULL = 1, UART_LITE_RX_VALID = 0 };
+enum { UART_LITE_TX_FULL = 3, UART_LITE_TX_EMPTY = 2, UART_LITE_RX_FULL = 1, UART_LITE_RX_VALID = 0 };
+enum { UART_LITE_RST_TX = 0, UART_LITE_RST_RX = 1 };
+
+#define UART_TX_BUFFER (4*KILO)
+#define UART_RX_CHUNK  (256)
+#define UART_POLL_CYCLES 10000
+
+static char uart_tx_buf[UART_TX_BUFFER];
+static size_t uart_tx_count = 0;
+static int uart_rx_fd = -2; // -2: not opened yet, -1: at EOF or unavailable
+static uint64_t uart_next_poll_cycle = 0; // for STATUS reads
+static bool uart_status_polled = false;    // STATUS was read, and no TX byte since
+
+void uart_flush() {
+    if (!uart_tx_count) return;
+    cout.write(uart_tx_buf, uart_tx_count).flush();
+    uart_tx_count = 0;
+}
+
+static void uart_tx(const char c) {
+    uart_tx_buf[uart_tx_count++] = c;
+    if (c == '\n' || uart_tx_count == UART_TX_BUFFER) uart_flush();
+}
+
+static void uart_poll_rx() {
+    uart_next_poll_cycle = System::sys->cycle + UART_POLL_CYCLES;
+    if (uart_rx_fd == -2) {
+        const char* UART_INPUT = getenv("UART_INPUT");
+        uart_rx_fd = UART_INPUT ? open(UART_INPUT, O_RDONLY) : STDIN_FILENO;
+        if (uart_rx_fd == -1) cerr << "Could not open UART_INPUT " << UART_INPUT << ", UART will not receive anything" << endl;
+    }
+    if (uart_rx_fd < 0) return;
+
+    struct pollfd pfd = { uart_rx_fd, POLLIN, 0 };
+    if (poll(&pfd, 1, 0) <= 0) return; // nothing there yet
+    char buf[UART_RX_CHUNK];
+    ssize_t n = read(uart_rx_fd, buf, sizeof(buf));
+    if (n <= 0) {
+        uart_rx_fd = -1;
+        return;
+    }
+    for(ssize_t i = 0; i < n; ++i) System::sys->keys.push(buf[i]);
+}
 
 void uart_lite_read(const Device* self, Vtop* top) {
     int offset = (top->m_axi_araddr - self->start)/4;
+    uint64_t val = 0;
     switch(offset) {
+        case UART_LITE_REG_RXFIFO:
+            uart_flush();
+            if (System::sys->keys.empty()) uart_poll_rx();
+            if (!System::sys->keys.empty()) {
+                val = (unsigned char)System::sys->keys.front();
+                System::sys->keys.pop();
+            }
+            break;
         case UART_LITE_STAT_REG:
-            System::sys->read_response(0, top->m_axi_arid, true);
+            if (uart_status_polled) uart_flush();
+            uart_status_polled = true;
+            if (System::sys->keys.empty() && System::sys->cycle >= uart_next_poll_cycle) uart_poll_rx();
+            val = (1 << UART_LITE_TX_EMPTY) | ((!System::sys->keys.empty()) << UART_LITE_RX_VALID);
             break;
         default:
             cerr << "Read request of uart_lite address (" << std::hex << top->m_axi_araddr << "/" << offset << ") unsupported" << endl;
             Verilated::gotFinish(true);
             break;
     }
+    System::sys->read_response(val << ((top->m_axi_araddr & 7)*8), top->m_axi_arid, true);
 }
 
 void uart_lite_write_data(const Device* self, Vtop* top) {
@@ -55,10 +315,12 @@ void uart_lite_write_data(const Device* self, Vtop* top) {
     }
     switch(offset) {
         case UART_LITE_REG_TXFIFO:
-            cout << (char)(top->m_axi_wdata) << std::flush;
+            uart_status_polled = false;
+            uart_tx((char)(top->m_axi_wdata));
             break;
         case UART_LITE_CTRL_REG:
-            // do nothing
+            if (top->m_axi_wdata & (1 << UART_LITE_RST_RX))
+                while(!System::sys->keys.empty()) System::sys->keys.pop();
             break;
         default:
             cerr << "Write request of uart_lite address (" << std::hex << System::sys->w_addr << "/" << offset << ") unsupported" << endl;
@@ -67,9 +329,40 @@ void uart_lite_write_data(const Device* self, Vtop* top) {
     }
 }
 
+// ==== Test finisher
+// SiFive's "sifive,test0", at the same address as on QEMU's virt machine: the
+// guest ends the simulation by writing FINISHER_PASS, or FINISHER_FAIL with
+// an exit code for Vtop in the upper 16 bits.  mktest/bench programs stop
+// through it, and Linux powers off through it (syscon-poweroff in hardware.dtsi).
+enum { FINISHER_FAIL = 0x3333, FINISHER_PASS = 0x5555 };
+
+void finisher_read(const Device* self, Vtop* top) {
+    System::sys->read_response(0, top->m_axi_arid, true);
+}
+
+void finisher_write_data(const Device* self, Vtop* top) {
+    const uint32_t value = top->m_axi_wdata;
+    switch (value & 0xffff) {
+        case FINISHER_PASS:
+            System::sys->exit_code = 0;
+            break;
+        case FINISHER_FAIL:
+            System::sys->exit_code = (value >> 16) ? (value >> 16) : 1;
+            break;
+        default:
+            cerr << "Write of " << std::hex << value << " to the test finisher unsupported, ignoring it" << endl;
+            return;
+    }
+    uart_flush();
+    Verilated::gotFinish(true);
+}
+
 const struct Device devices[] = {
+    { 0x00100000ULL, 0x00001000, finisher_read, write_one, finisher_write_data },
     { 0x70aeef00ULL, 0x000c0000, clint_read, write_one, clint_write_data },
-    { 0x70beef00ULL, 0x00010000, uart_lite_read, write_one, uart_lite_write_data }
+    { 0x70beef00ULL, 0x00010000, uart_lite_read, write_one, uart_lite_write_data },
+    { 0x0c000000ULL, 0x04000000, plic_read, write_one, plic_write_data },
+    { VIRTIO_BLK_BASE, 0x00001000, virtio_blk_read, write_one, virtio_blk_write_data }
 };
 
 const Device* full_system_hardware_match(const uint64_t addr) {
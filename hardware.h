@@ -4,6 +4,12 @@
 #include "Vtop.h"
 
 void rtc_tick(Vtop* top);
+uint64_t clint_next_event_cycle();
+void uart_flush();
+void plic_set_level(const int src, const bool level);
+void plic_update(Vtop* top);
+void virtio_tick(Vtop* top);
+bool virtio_busy();
 
 struct Device {
   uint64_t start, size;
@@ -12,5 +18,11 @@ struct Device {
   void (*write_data)(const Device* self, Vtop* top);
 };
 const Device* full_system_hardware_match(const uint64_t addr);
+void write_one(const Device* self, Vtop* top);
+
+#define VIRTIO_BLK_BASE 0x10001000ULL
+#define VIRTIO_BLK_IRQ  1 // PLIC source
+void virtio_blk_read(const Device* self, Vtop* top);
+void virtio_blk_write_data(const Device* self, Vtop* top);
 
 #endif
@@ -0,0 +1,286 @@
+`ifndef HART_INTERCONNECT
+`define HART_INTERCONNECT
+
+// Puts HARTS harts (each with its own MemorySystem, so its own I$ and D$) on
+// the one AXI port, and keeps their D$s coherent over the snoop channel.
+//
+// Coherence is by ownership: a line of RAM is in at most one D$.  Before a D$
+// line fill goes out, every other hart gets a ReadUnique snoop for the line,
+// which the D$ treats like a CleanInvalid: a dirty copy is written back, then
+// dropped.  Only one such snoop round is open at a time, and it stays open
+// until the fill it was for has gone out, so no other hart can get the line
+// in between.  I$ fills and IO don't take part (the I$ is no more coherent
+// with the D$s than it was with one hart, see FENCE.I in decoder.sv).
+//
+// Snoops from the harness go to every hart, and are accepted once they all
+// have.  A snoop round goes first: the harness's snoop can be waiting on a
+// store buffer drain, which can be waiting on a line fill.
+//
+// Reads and writes go out one hart at a time, round-robin.  A write holds the
+// W channel until its last beat.  The hart number rides in the AXI ids, in
+// bits HART_LSB+1:HART_LSB (neither cache uses them), to send R and B back.
+module Hart_interconnect
+#(
+    HARTS = 2,
+    ID_WIDTH = 13,
+    ADDR_WIDTH = 64,
+    DATA_WIDTH = 64,
+    STRB_WIDTH = DATA_WIDTH/8
+)
+(
+    input clk,
+    input reset,
+
+    // bus interface
+    output  wire [ID_WIDTH-1:0]     m_axi_awid,
+    output  wire [ADDR_WIDTH-1:0]   m_axi_awaddr,
+    output  wire [7:0]              m_axi_awlen,
+    output  wire [2:0]              m_axi_awsize,
+    output  wire [1:0]              m_axi_awburst,
+    output  wire                    m_axi_awlock,
+    output  wire [3:0]              m_axi_awcache,
+    output  wire [2:0]              m_axi_awprot,
+    output  wire                    m_axi_awvalid,
+    input   wire                    m_axi_awready,
+    output  wire [DATA_WIDTH-1:0]   m_axi_wdata,
+    output  wire [STRB_WIDTH-1:0]   m_axi_wstrb,
+    output  wire                    m_axi_wlast,
+    output  wire                    m_axi_wvalid,
+    input   wire                    m_axi_wready,
+    input   wire [ID_WIDTH-1:0]     m_axi_bid,
+    input   wire [1:0]              m_axi_bresp,
+    input   wire                    m_axi_bvalid,
+    output  wire                    m_axi_bready,
+    output  wire [ID_WIDTH-1:0]     m_axi_arid,
+    output  wire [ADDR_WIDTH-1:0]   m_axi_araddr,
+    output  wire [7:0]              m_axi_arlen,
+    output  wire [2:0]              m_axi_arsize,
+    output  wire [1:0]              m_axi_arburst,
+    output  wire                    m_axi_arlock,
+    output  wire [3:0]              m_axi_arcache,
+    output  wire [2:0]              m_axi_arprot,
+    output  wire                    m_axi_arvalid,
+    input   wire                    m_axi_arready,
+    input   wire [ID_WIDTH-1:0]     m_axi_rid,
+    input   wire [DATA_WIDTH-1:0]   m_axi_rdata,
+    input   wire [1:0]              m_axi_rresp,
+    input   wire                    m_axi_rlast,
+    input   wire                    m_axi_rvalid,
+    output  wire                    m_axi_rready,
+    input   wire                    m_axi_acvalid,
+    output  wire                    m_axi_acready,
+    input   wire [ADDR_WIDTH-1:0]   m_axi_acaddr,
+    input   wire [3:0]              m_axi_acsnoop,
+
+    // one port per hart
+    input   wire [ID_WIDTH-1:0]     hart_m_axi_awid     [HARTS],
+    input   wire [ADDR_WIDTH-1:0]   hart_m_axi_awaddr   [HARTS],
+    input   wire [7:0]              hart_m_axi_awlen    [HARTS],
+    input   wire [2:0]              hart_m_axi_awsize   [HARTS],
+    input   wire [1:0]              hart_m_axi_awburst  [HARTS],
+    input   wire                    hart_m_axi_awlock   [HARTS],
+    input   wire [3:0]              hart_m_axi_awcache  [HARTS],
+    input   wire [2:0]              hart_m_axi_awprot   [HARTS],
+    input   wire                    hart_m_axi_awvalid  [HARTS],
+    output  logic                   hart_m_axi_awready  [HARTS],
+    input   wire [DATA_WIDTH-1:0]   hart_m_axi_wdata    [HARTS],
+    input   wire [STRB_WIDTH-1:0]   hart_m_axi_wstrb    [HARTS],
+    input   wire                    hart_m_axi_wlast    [HARTS],
+    input   wire                    hart_m_axi_wvalid   [HARTS],
+    output  logic                   hart_m_axi_wready   [HARTS],
+    output  logic [ID_WIDTH-1:0]    hart_m_axi_bid      [HARTS],
+    output  logic [1:0]             hart_m_axi_bresp    [HARTS],
+    output  logic                   hart_m_axi_bvalid   [HARTS],
+    input   wire                    hart_m_axi_bready   [HARTS],
+    input   wire [ID_WIDTH-1:0]     hart_m_axi_arid     [HARTS],
+    input   wire [ADDR_WIDTH-1:0]   hart_m_axi_araddr   [HARTS],
+    input   wire [7:0]              hart_m_axi_arlen    [HARTS],
+    input   wire [2:0]              hart_m_axi_arsize   [HARTS],
+    input   wire [1:0]              hart_m_axi_arburst  [HARTS],
+    input   wire                    hart_m_axi_arlock   [HARTS],
+    input   wire [3:0]              hart_m_axi_arcache  [HARTS],
+    input   wire [2:0]              hart_m_axi_arprot   [HARTS],
+    input   wire                    hart_m_axi_arvalid  [HARTS],
+    output  logic                   hart_m_axi_arready  [HARTS],
+    output  logic [ID_WIDTH-1:0]    hart_m_axi_rid      [HARTS],
+    output  logic [DATA_WIDTH-1:0]  hart_m_axi_rdata    [HARTS],
+    output  logic [1:0]             hart_m_axi_rresp    [HARTS],
+    output  logic                   hart_m_axi_rlast    [HARTS],
+    output  logic                   hart_m_axi_rvalid   [HARTS],
+    input   wire                    hart_m_axi_rready   [HARTS],
+    output  logic                   hart_m_axi_acvalid  [HARTS],
+    input   wire                    hart_m_axi_acready  [HARTS],
+    output  logic [ADDR_WIDTH-1:0]  hart_m_axi_acaddr   [HARTS],
+    output  logic [3:0]             hart_m_axi_acsnoop  [HARTS]
+);
+
+    parameter RAM_START = 64'h0000000080000000;
+    parameter HART_LSB = ID_WIDTH-3; // D$ ids use the top bit and bit 0, I$ ids bits 1:0
+
+    function automatic [ID_WIDTH-1:0] with_hart(input [ID_WIDTH-1:0] id, input [1:0] hart);
+        with_hart = id;
+        with_hart[HART_LSB+:2] = hart;
+    endfunction
+
+    // First hart after last that wants to go
+    function automatic [1:0] round_robin(input [HARTS-1:0] want, input [1:0] last);
+        round_robin = 0;
+        for (int i = HARTS; i >= 1; i--)
+            if (want[(last + i) % HARTS]) round_robin = 2'((last + i) % HARTS);
+    endfunction
+
+
+    // ==== Snoop rounds: a D$ line fill waits until every other hart has let go of its line
+    logic             snp_active;  // a round is open (until snp_hart's fill goes out)
+    logic [1:0]       snp_hart;
+    logic [ADDR_WIDTH-1:6] snp_line;
+    logic [HARTS-1:0] snp_pending; // harts that haven't taken the round's snoop yet
+    logic [1:0]       snp_last;    // hart that opened the last round, for round-robin
+
+    logic [HARTS-1:0] ar_fill;     // hart is asking for a D$ line fill
+    logic [HARTS-1:0] ar_ok;       // hart's read can go out now
+    always_comb begin
+        for (int h = 0; h < HARTS; h++) begin
+            ar_fill[h] = hart_m_axi_arvalid[h] && hart_m_axi_arid[h][ID_WIDTH-1] && hart_m_axi_araddr[h] >= RAM_START;
+            ar_ok[h] = hart_m_axi_arvalid[h] && (!ar_fill[h] ||
+                       (snp_active && snp_hart == h && snp_pending == 0 && hart_m_axi_araddr[h][ADDR_WIDTH-1:6] == snp_line));
+        end
+    end
+
+    wire       snp_start = !snp_active && ar_fill != 0;
+    wire [1:0] snp_start_hart = round_robin(ar_fill, snp_last);
+
+
+    // ==== AR channel
+    logic [1:0] ar_last;
+    wire        ar_grant_valid = ar_ok != 0;
+    wire  [1:0] ar_grant = round_robin(ar_ok, ar_last);
+    always_comb
+        for (int h = 0; h < HARTS; h++)
+            hart_m_axi_arready[h] = ar_grant_valid && ar_grant == h && m_axi_arready;
+
+    assign m_axi_arid = with_hart(hart_m_axi_arid[ar_grant], ar_grant);
+    assign m_axi_araddr = hart_m_axi_araddr[ar_grant];
+    assign m_axi_arlen = hart_m_axi_arlen[ar_grant];
+    assign m_axi_arsize = hart_m_axi_arsize[ar_grant];
+    assign m_axi_arburst = hart_m_axi_arburst[ar_grant];
+    assign m_axi_arlock = hart_m_axi_arlock[ar_grant];
+    assign m_axi_arcache = hart_m_axi_arcache[ar_grant];
+    assign m_axi_arprot = hart_m_axi_arprot[ar_grant];
+    assign m_axi_arvalid = ar_grant_valid;
+
+
+    // ==== AW and W channels: the hart whose AW went out owns W until wlast
+    logic             w_active;
+    logic [1:0]       w_hart;
+    logic [1:0]       aw_last;
+    logic [HARTS-1:0] aw_want;
+    always_comb
+        for (int h = 0; h < HARTS; h++)
+            aw_want[h] = hart_m_axi_awvalid[h];
+    wire        aw_grant_valid = !w_active && aw_want != 0;
+    wire  [1:0] aw_grant = round_robin(aw_want, aw_last);
+    always_comb begin
+        for (int h = 0; h < HARTS; h++) begin
+            hart_m_axi_awready[h] = aw_grant_valid && aw_grant == h && m_axi_awready;
+            hart_m_axi_wready[h] = w_active && w_hart == h && m_axi_wready;
+        end
+    end
+
+    assign m_axi_awid = with_hart(hart_m_axi_awid[aw_grant], aw_grant);
+    assign m_axi_awaddr = hart_m_axi_awaddr[aw_grant];
+    assign m_axi_awlen = hart_m_axi_awlen[aw_grant];
+    assign m_axi_awsize = hart_m_axi_awsize[aw_grant];
+    assign m_axi_awburst = hart_m_axi_awburst[aw_grant];
+    assign m_axi_awlock = hart_m_axi_awlock[aw_grant];
+    assign m_axi_awcache = hart_m_axi_awcache[aw_grant];
+    assign m_axi_awprot = hart_m_axi_awprot[aw_grant];
+    assign m_axi_awvalid = aw_grant_valid;
+
+    assign m_axi_wdata = hart_m_axi_wdata[w_hart];
+    assign m_axi_wstrb = hart_m_axi_wstrb[w_hart];
+    assign m_axi_wlast = hart_m_axi_wlast[w_hart];
+    assign m_axi_wvalid = w_active && hart_m_axi_wvalid[w_hart];
+
+
+    // ==== R and B channels, back to the hart in the id
+    wire [1:0] r_hart = m_axi_rid[HART_LSB+:2];
+    wire [1:0] b_hart = m_axi_bid[HART_LSB+:2];
+    always_comb begin
+        for (int h = 0; h < HARTS; h++) begin
+            hart_m_axi_rid[h] = with_hart(m_axi_rid, 2'b0);
+            hart_m_axi_rdata[h] = m_axi_rdata;
+            hart_m_axi_rresp[h] = m_axi_rresp;
+            hart_m_axi_rlast[h] = m_axi_rlast;
+            hart_m_axi_rvalid[h] = m_axi_rvalid && r_hart == h;
+            hart_m_axi_bid[h] = with_hart(m_axi_bid, 2'b0);
+            hart_m_axi_bresp[h] = m_axi_bresp;
+            hart_m_axi_bvalid[h] = m_axi_bvalid && b_hart == h;
+        end
+    end
+
+    assign m_axi_rready = hart_m_axi_rready[r_hart];
+    assign m_axi_bready = hart_m_axi_bready[b_hart];
+
+
+    // ==== AC channel: the open round's ReadUnique, or else the harness's snoop
+    logic [HARTS-1:0] ac_done;  // harts that have taken the harness's current snoop
+    logic [HARTS-1:0] ac_taken; // ... or take a snoop this cycle
+    always_comb begin
+        for (int h = 0; h < HARTS; h++) begin
+            if (snp_active) begin
+                hart_m_axi_acvalid[h] = snp_pending[h];
+                hart_m_axi_acaddr[h] = {snp_line, 6'b0};
+                hart_m_axi_acsnoop[h] = SNOOP_READ_UNIQUE;
+            end else begin
+                hart_m_axi_acvalid[h] = m_axi_acvalid && !ac_done[h];
+                hart_m_axi_acaddr[h] = m_axi_acaddr;
+                hart_m_axi_acsnoop[h] = m_axi_acsnoop;
+            end
+            ac_taken[h] = hart_m_axi_acvalid[h] && hart_m_axi_acready[h];
+        end
+    end
+
+    assign m_axi_acready = !snp_active && (ac_done | ac_taken) == {HARTS{1'b1}};
+
+
+    always_ff @ (posedge clk) begin
+        if (reset) begin
+            snp_active <= 0;
+            snp_last <= 0;
+            ar_last <= 0;
+            aw_last <= 0;
+            w_active <= 0;
+            ac_done <= 0;
+        end else begin
+            if (snp_active) begin
+                snp_pending <= snp_pending & ~ac_taken;
+                if (m_axi_arvalid && m_axi_arready && ar_grant == snp_hart && ar_fill[snp_hart])
+                    snp_active <= 0;
+            end else begin
+                if (snp_start) begin
+                    snp_active <= 1;
+                    snp_hart <= snp_start_hart;
+                    snp_last <= snp_start_hart;
+                    snp_line <= hart_m_axi_araddr[snp_start_hart][ADDR_WIDTH-1:6];
+                    snp_pending <= {HARTS{1'b1}} & ~(1 << snp_start_hart);
+                end
+                if (m_axi_acvalid)
+                    ac_done <= m_axi_acready ? 0 : (ac_done | ac_taken);
+            end
+
+            if (m_axi_arvalid && m_axi_arready)
+                ar_last <= ar_grant;
+
+            if (!w_active && m_axi_awvalid && m_axi_awready) begin
+                w_active <= 1;
+                w_hart <= aw_grant;
+                aw_last <= aw_grant;
+            end else if (w_active && m_axi_wvalid && m_axi_wready && m_axi_wlast)
+                w_active <= 0;
+        end
+    end
+
+endmodule
+
+`endif
@@ -3,6 +3,7 @@
 // Looks at nonlocal interactions between pipeline stages
 // (i.e. data dependencies spanning several stages)
 // Notifies of data hazards detected
+// Also decides which ops can be dual-issued together (see top.sv IF_pair)
 //
 // TODO: add forwarding signals (i.e. also output which reg vals
 //                               to forward through which stages)
@@ -20,8 +21,24 @@ module hazard_unit(
     input mem_valid,
     input wb_valid,
 
+    // Second (ALU-only) slot of each stage, for dual issue
+    input decoded_inst_t ID_deco1,
+    input decoded_inst_t EX_deco1,
+    input decoded_inst_t MEM_deco1,
+    input decoded_inst_t WB_deco1,
+
+    input id_valid1,
+    input ex_valid1,
+    input mem_valid1,
+    input wb_valid1,
+
+    // Head of the fetch queue and the op after it (raw bits)
+    input [31:0] IF_inst0,
+    input [31:0] IF_inst1,
+
     // Outputs
-    output data_hazard_ID
+    output data_hazard_ID,
+    output can_pair // IF_inst1 may go into ID alongside IF_inst0
 );
 
     // ID signals
@@ -59,19 +76,36 @@ module hazard_unit(
     assign wb_en_rd = WB_deco.en_rd;
 
 
+    // Does either op in ID read register r?
+    // (the two ops in ID never depend on each other, pairing rules out that case)
+    function automatic logic id_reads(input logic [4:0] r);
+        id_reads = (r == id_rs1 && id_en_rs1) || (r == id_rs2 && id_en_rs2) ||
+                   (id_valid1 && ((r == ID_deco1.rs1 && ID_deco1.en_rs1) || (r == ID_deco1.rs2 && ID_deco1.en_rs2)));
+    endfunction
+
+
     // === Detect data hazards in ID stage
     always_comb begin
         if (!id_valid) begin
             data_hazard_ID = 0;
         end
         else begin
-            if ( wb_valid && wb_en_rd && ((wb_rd == id_rs1 && id_en_rs1) || (wb_rd == id_rs2 && id_en_rs2)) ) begin 
+            if ( wb_valid && wb_en_rd && id_reads(wb_rd) ) begin 
+                data_hazard_ID = 1;
+            end
+            else if ( wb_valid1 && WB_deco1.en_rd && id_reads(WB_deco1.rd) ) begin
                 data_hazard_ID = 1;
             end
-            else if ( mem_valid && mem_en_rd && ((mem_rd == id_rs1 && id_en_rs1) || (mem_rd == id_rs2 && id_en_rs2)) ) begin
+            else if ( mem_valid && mem_en_rd && id_reads(mem_rd) ) begin
                 data_hazard_ID = 1;
             end
-            else if ( ex_valid && ex_en_rd && ((ex_rd == id_rs1 && id_en_rs1) || (ex_rd == id_rs2 && id_en_rs2)) ) begin
+            else if ( mem_valid1 && MEM_deco1.en_rd && id_reads(MEM_deco1.rd) ) begin
+                data_hazard_ID = 1;
+            end
+            else if ( ex_valid && ex_en_rd && id_reads(ex_rd) ) begin
+                data_hazard_ID = 1;
+            end
+            else if ( ex_valid1 && EX_deco1.en_rd && id_reads(EX_deco1.rd) ) begin
                 data_hazard_ID = 1;
             end
             else begin
@@ -80,5 +114,15 @@ module hazard_unit(
         end
     end
 
+
+    // === Dual-issue pairing rules
+    // - the younger op runs in the second ALU, so it must be a plain ALU op
+    // - it can't read what the older op writes (there's no forwarding between the two).
+    //   If both write the same rd, the younger one's write wins in the RegFile.
+    // - the older op can't be one that flushes behind itself and restarts after itself
+    // A taken jump/branch as the older op is fine: EX drops the younger op when it jumps.
+    assign can_pair = predecode_simple_alu(IF_inst1) && !predecode_serializing(IF_inst0) &&
+                      !(predecode_writes_rd(IF_inst0) && predecode_alu_reads(IF_inst1, IF_inst0[11:7]));
+
 endmodule
 
@@ -87,9 +87,11 @@ module Icache
     wire [ADDR_WIDTH-1:LOG_SETS+LOG_LINE_LEN+LOG_WORD_LEN] prefetch_tag = prefetch_line[ADDR_WIDTH-1:LOG_SETS+LOG_LINE_LEN+LOG_WORD_LEN];
     wire [LOG_SETS+LOG_LINE_LEN+LOG_WORD_LEN-1:LOG_LINE_LEN+LOG_WORD_LEN] prefetch_index = prefetch_line[LOG_SETS+LOG_LINE_LEN+LOG_WORD_LEN-1:LOG_LINE_LEN+LOG_WORD_LEN];
 
-    wire [LOG_SETS+LOG_LINE_LEN+LOG_WORD_LEN-1:LOG_LINE_LEN+LOG_WORD_LEN] snoop_index = icache_m_axi_acaddr[LOG_SETS+LOG_LINE_LEN+LOG_WORD_LEN-1:LOG_LINE_LEN+LOG_WORD_LEN];
-    wire [ADDR_WIDTH-1:LOG_SETS+LOG_LINE_LEN+LOG_WORD_LEN] snoop_tag = icache_m_axi_acaddr[ADDR_WIDTH-1:LOG_SETS+LOG_LINE_LEN+LOG_WORD_LEN];
-    integer snoop_way;
+    // Lines acaddr[11:6] to snoop_last of acaddr's 4K page (see the D$)
+    wire snoop_range = icache_m_axi_acsnoop == 4'ha || icache_m_axi_acsnoop == 4'hc;
+    wire [5:0] snoop_last = snoop_range ? icache_m_axi_acaddr[5:0] : icache_m_axi_acaddr[11:6];
+    reg [63:0] snoop_line;
+    integer snoop_i, snoop_way;
 
     wire [ADDR_WIDTH-1:0] fetch_addr = virtual_mode ? {trns_tag, in_fetch_addr[LOG_SETS+LOG_LINE_LEN+LOG_WORD_LEN-1:0]} : in_fetch_addr;
     wire [LOG_LINE_LEN+LOG_WORD_LEN-1:LOG_WORD_LEN] offset = fetch_addr[LOG_LINE_LEN+LOG_WORD_LEN-1:LOG_WORD_LEN];
@@ -192,10 +194,14 @@ module Icache
             rplc_offset <= 0;
             rplc_way <= 2'h0;
         end else if (receive_state == 1'b0) begin
-            if(icache_m_axi_acvalid && (icache_m_axi_acsnoop == 4'hd)) begin // snoop invalidation
-                for (snoop_way = 0; snoop_way < WAYS; snoop_way = snoop_way + 1)
-                    if(line_tag[snoop_index][snoop_way] == snoop_tag)
-                        line_valid[snoop_index][snoop_way] <= 1'b0;
+            if(icache_m_axi_acvalid && (icache_m_axi_acsnoop == 4'hd || icache_m_axi_acsnoop == 4'h9 || snoop_range)) begin // snoop invalidation
+                for (snoop_i = 0; snoop_i < 64; snoop_i = snoop_i + 1)
+                    if(snoop_i[5:0] >= icache_m_axi_acaddr[11:6] && snoop_i[5:0] <= snoop_last) begin
+                        snoop_line = {icache_m_axi_acaddr[ADDR_WIDTH-1:12], snoop_i[5:0], 6'h0};
+                        for (snoop_way = 0; snoop_way < WAYS; snoop_way = snoop_way + 1)
+                            if(line_tag[snoop_line[LOG_SETS+LOG_LINE_LEN+LOG_WORD_LEN-1:LOG_LINE_LEN+LOG_WORD_LEN]][snoop_way] == snoop_line[ADDR_WIDTH-1:LOG_SETS+LOG_LINE_LEN+LOG_WORD_LEN])
+                                line_valid[snoop_line[LOG_SETS+LOG_LINE_LEN+LOG_WORD_LEN-1:LOG_LINE_LEN+LOG_WORD_LEN]][snoop_way] <= 1'b0;
+                    end
             end else if(icache_m_axi_rvalid) begin
                 rplc_offset <= 0;
                 rplc_way <= !line_valid[rplc_index][0] ? 2'h0 : !line_valid[rplc_index][1] ? 2'h1 : !line_valid[rplc_index][2] ? 2'h2 : !line_valid[rplc_index][3] ? 2'h3 : line_lru[rplc_index][1:0];
@@ -215,6 +221,35 @@ module Icache
         end
     end
 
+    // ==== Statistics, printed at the end of the run
+    // Misses are counted once, when the fill request goes out; hits count every
+    // cycle a fetch is answered (the aligner may read one word more than once).
+    logic [63:0] perf_hits;
+    logic [63:0] perf_misses;
+    logic [63:0] perf_prefetches;
+    logic        perf_lookup;
+    assign perf_lookup = state == 3'h0 && !icache_m_axi_acvalid && icache_enable && (!virtual_mode || translated_addr_valid);
+    always_ff @ (posedge clk) begin
+        if (reset) begin
+            perf_hits <= 0;
+            perf_misses <= 0;
+            perf_prefetches <= 0;
+        end else begin
+            if (perf_lookup && icache_valid) perf_hits <= perf_hits + 1;
+            if (perf_lookup && !icache_valid && !queue_cam_exists) perf_misses <= perf_misses + 1;
+            if (state == 3'h2 && !line_exists && !queue_cam_exists && prefetch_index != 0)
+                perf_prefetches <= perf_prefetches + 1;
+        end
+    end
+
+    final begin
+        if (perf_hits + perf_misses != 0)
+            $display("I$: %0d misses, %0d hit cycles, miss rate %0d.%02d%%, %0d lines prefetched",
+                     perf_misses, perf_hits,
+                     perf_misses * 100 / (perf_hits + perf_misses), (perf_misses * 10000 / (perf_hits + perf_misses)) % 100,
+                     perf_prefetches);
+    end
+
     CAM
     #(
         .WIDTH(ADDR_WIDTH-LOG_LINE_LEN-LOG_WORD_LEN+1),
@@ -0,0 +1,165 @@
+#include <string.h>
+#include <algorithm>
+#include <iomanip>
+#include <sstream>
+#include "locality.h"
+#include "system.h"
+
+using namespace std;
+
+static int log2_floor(uint64_t x) {
+    return 63 - __builtin_clzll(x);
+}
+
+StackDistance::StackDistance() : tree((1 << 20) + 1, 0), now(0), cold(0) {
+    memset(histogram, 0, sizeof(histogram));
+}
+
+void StackDistance::add(uint64_t time, int delta) {
+    for (uint64_t i = time + 1; i < tree.size(); i += i & -i) tree[i] += delta;
+}
+
+uint64_t StackDistance::prefix(uint64_t time) const {
+    uint64_t sum = 0;
+    for (uint64_t i = time + 1; i > 0; i -= i & -i) sum += tree[i];
+    return sum;
+}
+
+// Renumber every block's latest access to 0..n-1, keeping their order
+void StackDistance::compact() {
+    vector<pair<uint64_t, uint64_t> > order; // (time, block)
+    order.reserve(last_access.size());
+    for (unordered_map<uint64_t, uint64_t>::iterator it = last_access.begin(); it != last_access.end(); ++it)
+        order.push_back(make_pair(it->second, it->first));
+    sort(order.begin(), order.end());
+
+    tree.assign(max<size_t>(1 << 20, 2 * order.size()) + 1, 0);
+    for (size_t i = 0; i < order.size(); ++i) {
+        last_access[order[i].second] = i;
+        add(i, 1);
+    }
+    now = order.size();
+}
+
+void StackDistance::access(uint64_t block) {
+    if (now + 1 >= tree.size()) compact();
+
+    unordered_map<uint64_t, uint64_t>::iterator it = last_access.find(block);
+    if (it == last_access.end()) {
+        ++cold;
+        last_access[block] = now;
+    } else {
+        // every marked time is before now, so the ones after this block's last
+        // access are all of them minus those up to it
+        const uint64_t distance = last_access.size() - prefix(it->second);
+        ++histogram[min<int>(BINS-1, distance ? log2_floor(distance) + 1 : 0)];
+        add(it->second, -1);
+        it->second = now;
+    }
+    add(now, 1);
+    ++now;
+}
+
+uint64_t StackDistance::misses(uint64_t capacity) const {
+    uint64_t misses = cold;
+    for (int bin = log2_floor(capacity) + 1; bin < BINS; ++bin) misses += histogram[bin];
+    return misses;
+}
+
+Locality::Locality(uint64_t ramsize, uint64_t base)
+    : ramsize(ramsize), base(base), page_reads(ramsize / PAGE_SIZE), page_writes(ramsize / PAGE_SIZE), reads(0), writes(0) {
+}
+
+void Locality::access(uint64_t dram_addr, bool is_write) {
+    const uint64_t page = dram_addr / PAGE_SIZE;
+    if (is_write) {
+        ++writes;
+        ++page_writes[page];
+    } else {
+        ++reads;
+        ++page_reads[page];
+    }
+    lines.access(dram_addr / 64);
+    pages.access(page);
+}
+
+static string percent(uint64_t part, uint64_t whole) {
+    stringstream ss;
+    ss << fixed << setprecision(2) << (whole ? 100.0 * part / whole : 0.0) << "%";
+    return ss.str();
+}
+
+static string size_name(uint64_t bytes) {
+    stringstream ss;
+    if (bytes >= MEGA) ss << bytes / MEGA << " MB";
+    else ss << bytes / KILO << " KB";
+    return ss.str();
+}
+
+void Locality::report(ostream& out) {
+    const uint64_t total = reads + writes;
+    out << "Locality of the DRAM requests from the core (line fills and writebacks out of its caches)" << endl;
+    out << dec << total << " requests: " << reads << " reads, " << writes << " writes (" << percent(writes, total)
+        << " writes), " << lines.blocks() << " distinct lines in " << pages.blocks() << " distinct pages" << endl;
+
+    // ==== Heatmap: all of DRAM in 64 rows of 64 cells, log scale
+    const int ROWS = 64, COLS = 64;
+    static const char shades[] = " .:-=+*#%@";
+    const int hottest_shade = sizeof(shades) - 2; // '@', past the trailing NUL
+    const uint64_t pages_per_cell = max<uint64_t>(1, (ramsize / PAGE_SIZE + ROWS*COLS - 1) / (ROWS*COLS));
+    vector<uint64_t> cells(ROWS*COLS);
+    uint64_t hottest_cell = 0;
+    for (uint64_t page = 0; page < page_reads.size(); ++page) {
+        uint64_t& cell = cells[page / pages_per_cell];
+        cell += page_reads[page] + page_writes[page];
+        hottest_cell = max(hottest_cell, cell);
+    }
+    const int hottest_log = hottest_cell ? log2_floor(hottest_cell) : 0;
+    out << endl << "== Heatmap: " << size_name(pages_per_cell * PAGE_SIZE) << " per cell, '" << shades
+        << "' from none to " << hottest_cell << " requests (log scale)" << endl;
+    for (int row = 0; row < ROWS && row * COLS * pages_per_cell * PAGE_SIZE < ramsize; ++row) {
+        out << "  0x" << hex << setw(10) << setfill('0') << base + row * COLS * pages_per_cell * PAGE_SIZE << dec << setfill(' ') << " |";
+        for (int col = 0; col < COLS; ++col) {
+            const uint64_t count = cells[row * COLS + col];
+            out << shades[!count ? 0 : hottest_log ? 1 + (hottest_shade - 1) * log2_floor(count) / hottest_log : hottest_shade];
+        }
+        out << "|" << endl;
+    }
+
+    // ==== Hottest pages
+    vector<pair<uint64_t, uint64_t> > hot; // (requests, page)
+    for (uint64_t page = 0; page < page_reads.size(); ++page)
+        if (page_reads[page] + page_writes[page])
+            hot.push_back(make_pair((uint64_t)page_reads[page] + page_writes[page], page));
+    sort(hot.rbegin(), hot.rend());
+    out << endl << "== Hottest pages" << endl;
+    out << "  page            reads      writes" << endl;
+    for (size_t i = 0; i < hot.size() && i < 16; ++i)
+        out << "  0x" << hex << setw(10) << setfill('0') << base + hot[i].second * PAGE_SIZE << dec << setfill(' ')
+            << setw(11) << page_reads[hot[i].second] << setw(12) << page_writes[hot[i].second] << endl;
+
+    // ==== Line reuse distance histogram
+    uint64_t most = lines.cold;
+    for (int bin = 0; bin < StackDistance::BINS; ++bin) most = max(most, lines.histogram[bin]);
+    out << endl << "== Line reuse distance (distinct lines touched in between)" << endl;
+    for (int bin = -1; bin < StackDistance::BINS; ++bin) {
+        const uint64_t count = bin < 0 ? lines.cold : lines.histogram[bin];
+        if (bin > 0 && !count) continue;
+        stringstream range;
+        if (bin < 0) range << "first use";
+        else if (bin == 0) range << "0";
+        else if (bin == 1) range << "1";
+        else range << "[" << (1ULL << (bin-1)) << ", " << (1ULL << bin) << ")";
+        out << "  " << left << setw(22) << range.str() << right << setw(12) << count << " "
+            << string(most ? 50 * count / most : 0, '#') << endl;
+    }
+
+    // ==== What those distances mean for cache and TLB sizes
+    out << endl << "== Predicted miss rate of a fully associative LRU cache seeing these requests" << endl;
+    for (uint64_t size = 8*KILO; size <= 64*MEGA; size *= 2)
+        out << "  " << left << setw(8) << size_name(size) << right << setw(10) << percent(lines.misses(size / 64), total) << endl;
+
+    out << endl << "== Predicted miss rate of a fully associative LRU TLB (4K pages, same requests)" << endl;
+    for (uint64_t entries = 8; entries <= 4096; entries *= 2)
+        out << "  " << left << setw(8) << entries << right << setw(10) << percent(pages.misses(entries), total) << endl;
+}
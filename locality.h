@@ -0,0 +1,50 @@
+#ifndef __LOCALITY_H
+#define __LOCALITY_H
+
+#include <stdint.h>
+#include <ostream>
+#include <unordered_map>
+#include <vector>
+
+// LRU stack distance of a stream of block numbers: for each access, how many
+// distinct other blocks were touched since the last access to this one.  A
+// fully associative LRU cache of N blocks hits exactly when that's below N.
+// Bennett-Kruskal style: a Fenwick tree over access times marks the times that
+// are still some block's latest access, so a distance is one prefix sum.  The
+// tree is renumbered when it fills, so it stays about twice the number of
+// distinct blocks however long the run is.
+class StackDistance {
+    std::unordered_map<uint64_t, uint64_t> last_access; // block -> time of its latest access
+    std::vector<uint32_t> tree;
+    uint64_t now;
+
+    void add(uint64_t time, int delta);
+    uint64_t prefix(uint64_t time) const; // marked times <= time
+    void compact();
+
+public:
+    enum { BINS = 40 };
+    uint64_t cold;            // first touches
+    uint64_t histogram[BINS]; // bin 0 is distance 0, bin i is [2^(i-1), 2^i)
+
+    StackDistance();
+    void access(uint64_t block);
+    uint64_t blocks() const { return last_access.size(); }
+    uint64_t misses(uint64_t capacity) const; // capacity must be a power of two
+};
+
+// LOCALITY=<file>: per-page access counts, read/write mix, and line and page
+// reuse distances of the DRAM requests the core makes, written out at exit
+class Locality {
+    uint64_t ramsize, base;
+    std::vector<uint32_t> page_reads, page_writes;
+    uint64_t reads, writes;
+    StackDistance lines, pages;
+
+public:
+    Locality(uint64_t ramsize, uint64_t base);
+    void access(uint64_t dram_addr, bool is_write);
+    void report(std::ostream& out);
+};
+
+#endif
@@ -7,9 +7,7 @@
 # include <verilated_vcd_c.h>	// Trace file format header
 #endif
 
-#define RAM_SIZE                  (1*GIGA)
-#define INIT_STACK_OFFSET         (4*MEGA)
-#define INIT_STACK_POINTER        (RAM_SIZE - INIT_STACK_OFFSET)
+#define DEFAULT_RAM_SIZE          (1*GIGA)
 //#define TRACE_WAIT                4 * GIGA // in cycles 
 #define TRACE_WAIT                0x05a20000L // in cycles 
 //#define TRACE_WAIT                0x590000L // in cycles 
@@ -25,6 +23,24 @@ double sc_time_stamp() {
     return System::sys->ticks;
 }
 
+// RAM_SIZE=<n>[K|M|G], e.g. RAM_SIZE=4G
+static uint64_t ram_size() {
+    const char* RAM_SIZE = getenv("RAM_SIZE");
+    if (!RAM_SIZE || !*RAM_SIZE) return DEFAULT_RAM_SIZE;
+    char* unit;
+    uint64_t size = strtoull(RAM_SIZE, &unit, 0);
+    switch(toupper(*unit)) {
+        case 'G': size *= GIGA; break;
+        case 'M': size *= MEGA; break;
+        case 'K': size *= KILO; break;
+    }
+    if (!size || size % PAGE_SIZE) {
+        cerr << "RAM_SIZE " << RAM_SIZE << " is not a positive multiple of the page size" << endl;
+        exit(-1);
+    }
+    return size;
+}
+
 int main(int argc, char* argv[]) {
 	Verilated::commandArgs(argc, argv);
 
@@ -32,7 +48,7 @@ int main(int argc, char* argv[]) {
 	if (argc > 0) binaryfn = argv[1];
 
 	Vtop top;
-	System sys(&top, RAM_SIZE, binaryfn, argc-1, argv+1, 500/*ps_per_clock*/);
+	System sys(&top, ram_size(), binaryfn, argc-1, argv+1, 500/*ps_per_clock*/);
 
   if (!sys.full_system) {
     // (argc, argv) sanity check
@@ -73,33 +89,75 @@ int main(int argc, char* argv[]) {
 #define TFP_DUMP
 #endif
 
+// One clock cycle.  Nothing in top.sv is clocked on the negedge, so two evals
+// do: the posedge, and the negedge one, which also settles the combinational
+// readys/valids after System::posedge() has driven the AXI inputs.  By the
+// time System::negedge() looks at the handshakes they are final, and all it
+// does is pop queues, which no input depends on until the next posedge.
+#define CYCLE() do {                   \
+		top.clk = 1;                       \
+		top.eval();                        \
+		TFP_DUMP                           \
+		sys.posedge();                     \
+		sys.ticks += sys.ps_per_clock/2;   \
+		top.clk = 0;                       \
+		top.eval();                        \
+		TFP_DUMP                           \
+		sys.negedge();                     \
+		sys.ticks += sys.ps_per_clock/2;   \
+		++sys.cycle;                       \
+	} while(0)
+
+// The old half-cycle step, with an eval before and after each System call:
+// REFERENCE_LOOP=y runs with it to check CYCLE() against (make loopcheck)
 #define TICK() do {                    \
 		top.clk = !top.clk;                \
 		top.eval();                        \
 		TFP_DUMP                           \
-		sys.tick(top.clk);                 \
+		if (top.clk) sys.posedge();        \
+		else sys.negedge();                \
 		top.eval();                        \
 		TFP_DUMP                           \
 		sys.ticks += sys.ps_per_clock/2;   \
+		if (!top.clk) ++sys.cycle;         \
 	} while(0)
 
+	const char* REFERENCE_LOOP = getenv("REFERENCE_LOOP");
+	const bool reference_loop = REFERENCE_LOOP && toupper(*REFERENCE_LOOP) == 'Y';
+
 	top.reset = 1;
 	top.clk = 0;
-	TICK(); // 1
-	TICK(); // 0
-	TICK(); // 1
-	TICK(); // 0
-	TICK(); // 1
+	if (reference_loop) {
+		for (int i = 0; i < 6; ++i) TICK();
+	} else {
+		for (int i = 0; i < 3; ++i) CYCLE();
+	}
 	top.reset = 0;
     top.mtime = 0;
 
 	const char* SHOWCONSOLE = getenv("SHOWCONSOLE");
 	if (SHOWCONSOLE?(atoi(SHOWCONSOLE)!=0):0) sys.console();
 
-	while (sys.ticks/sys.ps_per_clock < 2000*GIGA && !Verilated::gotFinish()) {
-		TICK();
+	// gotFinish() is a plain flag, and is checked every cycle so a run stops on
+	// the same cycle it always has; the cycle limit only needs checking now and then
+	const uint64_t MAX_CYCLES = 2000*GIGA, BATCH = 4096;
+	if (reference_loop) {
+		while (sys.cycle < MAX_CYCLES && !Verilated::gotFinish()) {
+			TICK();
+			TICK();
+		}
+	} else {
+		while (sys.cycle < MAX_CYCLES && !Verilated::gotFinish()) {
+			for (uint64_t i = 0; i < BATCH && !Verilated::gotFinish(); ++i) CYCLE();
+		}
 	}
 
+	// The guest's last stores to a MAP_SHARED file can still be dirty in the
+	// D$: keep clocking until the clean snoops are through and the file synced
+	if (sys.sync_file(0, ~0ULL, false))
+		for (uint64_t i = 0; i < 1000000 && sys.files_syncing(); ++i) CYCLE();
+	if (sys.files_syncing()) cerr << "Gave up waiting for MAP_SHARED file pages to be written back" << endl;
+
 	top.final();
 
 #if VM_TRACE
@@ -107,5 +165,5 @@ int main(int argc, char* argv[]) {
 	delete tfp;
 #endif
 
-	return 0;
+	return sys.exit_code;
 }
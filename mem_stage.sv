@@ -15,6 +15,7 @@ module MEM_Stage
     input [63:0] ex_data2,
     input is_bubble,
     input advance, // if instruction is actually moving onward this cycle
+    input wfi_wakeup, // WFI sits in MEM until this goes high
 
     output stall, // if MEM instruction needs more time
 
@@ -26,6 +27,12 @@ module MEM_Stage
     output tlb_invalidate, // requests TLB entries to be flushed
     //TODO: make this more granular
 
+    //=== Snoops (see the LR/SC reservation below)
+    input         snoop_taken, // the D$ accepted a snoop for snoop_addr this cycle
+    input  [63:0] snoop_addr,  // its first line
+    input  [ 5:0] snoop_last,  // and its last, in the same 4K page (range snoops, see enums.sv)
+    output        snoop_lock,  // hold snoops off, an atomic is using its line
+
 
     //=== Trap inputs/outputs
     input op_trapped,
@@ -40,11 +47,14 @@ module MEM_Stage
         output logic        dc_write_en, // write=1, read=0
         output logic [63:0] dc_in_wdata,
         output logic [ 1:0] dc_in_wlen,  // wlen is log(#bytes), 3 = 64bit write
+        output logic        dc_in_sync,  // skip the store buffer (after it drains), for atomics
 
         input  logic [63:0] dc_out_rdata,
         input  logic        dc_out_rvalid,     //TODO: we should maybe merge rvalid and write_done
         input  logic        dc_out_write_done,
-        input  logic        dc_out_page_fault // if (rvalid||write_done) && page_fault, ignore the data
+        input  logic        dc_out_page_fault, // if (rvalid||write_done) && page_fault, ignore the data
+        input  logic [63:0] dc_out_paddr,      // dc_in_addr after translation, valid with rvalid/write_done
+        input  logic        dc_sb_empty        // no stores waiting in the store buffer
 
 );
     logic [63:0] mem_rdata;
@@ -61,13 +71,47 @@ module MEM_Stage
 
     assign dc_in_addr = ex_data;
     assign dc_in_wlen = inst.funct3[1:0]; //is log of number of bytes written (3=>8-byte write)
+    assign dc_in_sync = inst.is_atomic;
 
 
     logic atomic_stall; //this gets set by the atomic state machine, if we're in an atomic op
+    logic atomic_fault; // the D$ answered an atomic's read or write with a page fault
+    assign atomic_fault = inst.is_atomic && (dc_out_rvalid || dc_out_write_done) && dc_out_page_fault;
+
+    // ==== LR/SC reservation
+    // LR reserves the 64-byte line it read, by physical address, since that
+    // is what snoops carry.  Accepting a snoop for that line (another hart is
+    // taking it, or the harness is about to write it) loses the reservation,
+    // and every SC gives it up.  SC reads its line first, like an AMO, so the
+    // line is in our D$ and its physical address is known when it looks at
+    // the reservation: it only writes (and returns 0) if that is still held,
+    // otherwise it fails without writing and returns 1.
+    //
+    // Snoops are held off between an AMO's or SC's read and its write, so
+    // nothing can take the line in between, and for a few cycles after an LR,
+    // so that harts fighting over a line with LR/SC loops can't keep failing
+    // each other's SCs.
+    parameter LR_HOLD_CYCLES = 32;
+
+    logic        reservation_valid;
+    logic [63:6] reservation_line;
+    logic        sc_success;
+    logic        is_lr, is_sc;
+    logic        snoop_hits_reservation;
+    logic [5:0]  lr_hold; // cycles left of holding snoops off after an LR
+    assign is_lr = inst.is_atomic && inst.is_load;
+    assign is_sc = inst.is_atomic && inst.is_store;
+    assign snoop_hits_reservation = snoop_taken && snoop_addr[63:12] == reservation_line[63:12]
+                                 && reservation_line[11:6] >= snoop_addr[11:6] && reservation_line[11:6] <= snoop_last;
+    assign snoop_lock = atomic_state == 1 || lr_hold != 0;
     assign stall = !is_bubble && !op_trapped &&  (
-                            (inst.is_load   && !dc_out_rvalid) || 
-                            (inst.is_store  && !dc_out_write_done && atomic_state != 2'b10) ||
-                            (inst.is_atomic && atomic_stall)
+                            (inst.is_load   && !inst.is_atomic && !dc_out_rvalid) ||
+                            (inst.is_store  && !inst.is_atomic && !dc_out_write_done) ||
+                            (inst.is_atomic && atomic_stall) ||
+                            (inst.is_wfi    && !wfi_wakeup) ||
+                            // buffered stores must reach the D$ before FENCE, and before
+                            // SFENCE.VMA lets the MMU walk page tables that may be in them
+                            ((inst.is_fence || inst.is_sfence_vma) && !dc_sb_empty)
                         );
 
     logic dbg_inst_is_load;
@@ -88,9 +132,11 @@ module MEM_Stage
             gen_trap_val = dc_in_addr; //val is whichever virtual address faulted
         end
            
-        //TODO: actually handle page faults on atomics properly
-        if (dc_out_page_fault && inst.is_atomic)
-            $error("We never actually implemented atomics to properly handle page faults: TODO");
+        // LR faults as a load (above), SC and AMOs as stores
+        if (dc_out_page_fault && inst.is_atomic && !inst.is_load) begin
+            gen_trap_cause = MCAUSE_PAGEFAULT_S;
+            gen_trap_val = dc_in_addr;
+        end
     end
 
 
@@ -128,17 +174,15 @@ module MEM_Stage
         endcase
 
         if (inst.is_atomic && !is_bubble && !op_trapped) begin
-            if (atomic_state != 2)
+            if (atomic_state != 2 && !atomic_fault)
                 atomic_stall = 1;
             else
                 atomic_stall = 0;
 
-            if ((atomic_state == 0 && inst.is_store) || atomic_state == 1)
-                dc_write_en = 1;
-            else
-                dc_write_en = 0;
-            
-            if ((atomic_state == 0 && inst.is_store) || (atomic_state == 1 && inst.is_swap))
+            // read in state 0, write in state 1 (except LR)
+            dc_write_en = atomic_state == 1;
+
+            if (atomic_state == 1 && (inst.is_store || inst.is_swap))
                 dc_in_wdata = mem_wr_data;
             else if (atomic_state == 1)
                 dc_in_wdata = alu_result;
@@ -146,13 +190,13 @@ module MEM_Stage
                 dc_in_wdata = 'bx;
             
             if (inst.is_store)
-                atomic_result = 0;  // Assuming success on every store for now.
+                atomic_result = sc_success ? 0 : 1;
             else if (inst.is_load)
                 atomic_result = load_result;
             else
                 atomic_result = load_result;
 
-            dc_en = !is_bubble;
+            dc_en = !is_bubble && atomic_state != 2;
         end
         else begin
             atomic_stall = 0;
@@ -166,25 +210,39 @@ module MEM_Stage
     always_ff @(posedge clk) begin
         if (reset) begin
             atomic_state <= 0;
+            reservation_valid <= 0;
+            sc_success <= 0;
+        end
+        else if (atomic_fault) begin
+            atomic_state <= 0; // the trap takes the instruction out of MEM
         end
         else if (atomic_state == 0) begin
             if (!is_bubble && !op_trapped && inst.is_atomic) begin
                 if (dc_out_rvalid) begin
-                    // load or binary op
+                    // LR, AMO or SC read
                     load_result <= mem_ex_rdata;
+                    if (is_lr) begin
+                        reservation_valid <= 1;
+                        reservation_line <= dc_out_paddr[63:6];
+                    end
                     if (inst.is_load)
                         atomic_state <= 2;
+                    else if (is_sc && !(reservation_valid && reservation_line == dc_out_paddr[63:6] && !snoop_hits_reservation)) begin
+                        sc_success <= 0; // lost the reservation, or never had one for this line
+                        reservation_valid <= 0;
+                        atomic_state <= 2;
+                    end
                     else
                         atomic_state <= 1;
                 end
-                else if (dc_out_write_done) begin
-                    // store
-                    atomic_state <= 2;
-                end
             end
         end
         else if (atomic_state == 1) begin
             if (dc_out_write_done) begin
+                if (is_sc) begin
+                    sc_success <= 1;
+                    reservation_valid <= 0;
+                end
                 atomic_state <= 2;
             end
         end
@@ -196,6 +254,18 @@ module MEM_Stage
         else if (atomic_state == 3) begin
             atomic_state <= 0;
         end
+
+        if (!reset && snoop_hits_reservation)
+            reservation_valid <= 0;
+    end
+
+    always_ff @(posedge clk) begin
+        if (reset || (is_sc && atomic_state == 2))
+            lr_hold <= 0;
+        else if (atomic_state == 0 && !is_bubble && !op_trapped && is_lr && dc_out_rvalid && !atomic_fault)
+            lr_hold <= LR_HOLD_CYCLES;
+        else if (lr_hold != 0)
+            lr_hold <= lr_hold - 1;
     end
 
     Atomic_alu atomic_alu(
@@ -3,6 +3,7 @@
 `include "axi_interconnect.sv"
 `include "MMU.sv"
 `include "tlb.sv"
+`include "store_buffer.sv"
 
 // Wrapper module for all memory-interacting components
 // (caches, TLBs, MMU)
@@ -27,13 +28,15 @@ module MemorySystem
     input  logic        tlb_invalidate, //Used by SFENCE.VMA: flushes all TLB entries
     //TODO: allow more fine-grained invalidation
 
+    input  logic        snoop_lock,     // an atomic is between its read and write: no snoops
+
     //=== External I$ interface
     input  logic        ic_en,
     input  logic [63:0] ic_req_addr,
 
     output logic        ic_resp_valid,     // when resp_valid, it's either a page fault or a valid inst
-    output logic        ic_resp_page_fault, // if page_fault == 1, ignore resp_inst
-    output logic [31:0] ic_resp_inst,
+    output logic        ic_resp_page_fault, // if page_fault == 1, ignore resp_word
+    output logic [63:0] ic_resp_word,       // the whole aligned 8-byte word holding ic_req_addr
 
     //=== External D$ interface
     input  logic        dc_en,
@@ -42,12 +45,15 @@ module MemorySystem
     input  logic        dc_write_en, // write=1, read=0
     input  logic [63:0] dc_in_wdata,
     input  logic [ 1:0] dc_in_wlen,  // wlen is log(#bytes), 3 = 64bit write
+    input  logic        dc_in_sync,  // wait for the store buffer to drain, then go straight to D$ (atomics)
 
     output logic        dc_out_rvalid,     //TODO: we should maybe merge rvalid and write_done
     output logic        dc_out_page_fault, // (only valid when rvalid==1) means data is garbage, there's
                                            // a page fault happening
     output logic        dc_out_write_done,
     output logic [63:0] dc_out_rdata,
+    output logic [63:0] dc_out_paddr,      // physical address of dc_in_addr, valid with rvalid/write_done
+    output logic        dc_sb_empty,       // store buffer has drained (FENCE waits on this)
 
 
     //==== Main AXI interface
@@ -158,8 +164,15 @@ module MemorySystem
      *
      *   if virtual:
      *      D$_in -> DTLB, DTLB->D$.translated
+     *
+     *   Translated RAM stores go into the store buffer instead of the D$,
+     *   and the store buffer drains into D$ (in physical mode) when neither
+     *   the pipeline nor the MMU is using it:
+     *      D$_in -> SB -> D_MUX
      */
 
+    parameter RAM_START = 64'h0000000080000000; // below this is IO, which is never buffered
+
 
     // Extra, muxed signals for D$
     logic dcmux_virtual_en;
@@ -169,6 +182,106 @@ module MemorySystem
     logic        dcmux_write_en; // write=1, read=0
     logic [63:0] dcmux_in_wdata;
     logic [ 1:0] dcmux_in_wlen;  // wlen is log(#bytes), 3 = 64bit write
+    logic [ 7:0] dcmux_in_wmask; // bytes to write, for cached writes
+
+
+    // =========== Store buffer
+    logic [63:0] dc_phys_addr;  // only meaningful once dc_translated
+    logic        dc_translated;
+    logic        dc_is_io;
+    logic        dc_buffered;   // this is a store that goes into the store buffer
+    logic        dc_direct;     // this request goes to the D$ itself
+    logic        sb_push;
+    logic        sb_forward;    // load is answered from the store buffer
+    logic        sb_drain_sel;  // store buffer owns the D$ this cycle
+    logic        sb_drain_busy; // drain has started a D$ miss, keep the D$ until it's done
+    logic        sb_snoop_hold; // snoop to a buffered line: hold it off until that line drains
+    logic        dcache_acready;
+
+    assign dc_phys_addr  = virtual_en ? {dtlb.pa[63:12], dc_in_addr[11:0]} : dc_in_addr;
+    assign dc_translated = !virtual_en || dtlb.pa_valid;
+    assign dc_is_io      = dc_phys_addr < RAM_START;
+
+    assign dc_buffered = dc_en && dc_write_en && !dc_in_sync && dc_translated && !dc_is_io && !dc_out_page_fault;
+
+    // IO and atomics are ordered behind everything in the buffer.
+    // Loads that partly overlap a buffered store wait for it to drain.
+    assign dc_direct = dc_en && !dc_out_page_fault && !dc_buffered
+                    && !((dc_in_sync || (dc_translated && dc_is_io)) && !sb.empty)
+                    && !(!dc_write_en && dc_translated && (sb.ld_fwd || sb.ld_conflict));
+
+    assign sb_push    = dc_buffered && sb.push_ready && !mmu.use_dcache;
+    assign sb_forward = dc_en && !dc_write_en && !dc_in_sync && dc_translated && !dc_out_page_fault
+                     && sb.ld_fwd && !mmu.use_dcache;
+
+    // Only for the harness's snoops: it is about to read or write ram behind
+    // our back.  Another hart's ReadUnique doesn't need to see stores that are
+    // still buffered (nobody has seen them yet), and it mustn't wait for them:
+    // draining could take a line fill that waits on that same hart.
+    assign sb_snoop_hold = m_axi_acvalid && m_axi_acsnoop != SNOOP_READ_UNIQUE && sb.snoop_hit;
+    assign sb_drain_sel  = sb.drain_valid && !mmu.use_dcache
+                        && (sb_drain_busy || sb_snoop_hold || !dc_direct || !dc_translated);
+
+    always_ff @ (posedge clk) begin
+        if (reset)
+            sb_drain_busy <= 0;
+        else if (sb_drain_sel)
+            sb_drain_busy <= !dcache.write_done;
+    end
+
+    assign dc_sb_empty = sb.empty;
+    assign dc_out_paddr = dc_phys_addr;
+
+    Store_Buffer sb (
+        .clk,
+        .reset,
+
+        .push_en   (sb_push),
+        .push_addr (dc_phys_addr),
+        .push_data (dc_in_wdata),
+        .push_wlen (dc_in_wlen),
+        .push_ready(),
+
+        .ld_addr    (dc_phys_addr),
+        .ld_wlen    (dc_in_wlen),
+        .ld_fwd     (),
+        .ld_fwd_data(),
+        .ld_conflict(),
+
+        .snoop_addr(m_axi_acaddr),
+        .snoop_last(m_axi_acsnoop == SNOOP_CLEAN_INVALID_RANGE || m_axi_acsnoop == SNOOP_MAKE_INVALID_RANGE ? m_axi_acaddr[5:0] : m_axi_acaddr[11:6]),
+        .snoop_hit (),
+
+        .drain_valid(),
+        .drain_addr (),
+        .drain_data (),
+        .drain_mask (),
+        .drain_done (sb_drain_sel && dcache.write_done),
+
+        .empty()
+    );
+
+    // ==== Store buffer statistics, printed at the end of the run
+    logic [63:0] perf_sb_stores;
+    logic [63:0] perf_sb_forwards;
+    logic [63:0] perf_sb_full;  // a store waited because the buffer was full
+    always_ff @ (posedge clk) begin
+        if (reset) begin
+            perf_sb_stores <= 0;
+            perf_sb_forwards <= 0;
+            perf_sb_full <= 0;
+        end else begin
+            if (sb_push) perf_sb_stores <= perf_sb_stores + 1;
+            if (sb_forward) perf_sb_forwards <= perf_sb_forwards + 1;
+            if (dc_buffered && !sb.push_ready) perf_sb_full <= perf_sb_full + 1;
+        end
+    end
+
+    final begin
+        if (perf_sb_stores != 0)
+            $display("Store buffer: %0d stores buffered, %0d loads forwarded, full for %0d cycles",
+                     perf_sb_stores, perf_sb_forwards, perf_sb_full);
+    end
 
 
     // === D$ input/output mux: switches D$ between serving outside request or serving MMU
@@ -177,6 +290,12 @@ module MemorySystem
         //Normally, it just goes directly to/from pipeline interface
         dcmux_in_wdata     = dc_in_wdata;
         dcmux_in_wlen      = dc_in_wlen;
+        case (dc_in_wlen)
+            2'h0: dcmux_in_wmask = 8'h01 << dc_in_addr[2:0];
+            2'h1: dcmux_in_wmask = 8'h03 << dc_in_addr[2:0];
+            2'h2: dcmux_in_wmask = 8'h0f << dc_in_addr[2:0];
+            2'h3: dcmux_in_wmask = 8'hff;
+        endcase
 
         dc_out_rvalid      = dcache.dcache_valid;
         dc_out_rdata       = dcache.rdata;
@@ -194,15 +313,38 @@ module MemorySystem
             dc_out_rvalid = 1; // We have a response for the pipeline rn: it's a page fault
             dc_out_write_done = dc_write_en; // If it was a write, set write_done (TODO: this is redundant)
             dc_out_rdata = 0;
+
+        end else begin
+            // Store buffer draining: D$ isn't answering the pipeline
+            if (sb_drain_sel) begin
+                dc_out_rvalid = 0;
+                dc_out_write_done = 0;
+                dc_out_rdata = 0;
+            end
+
+            // Stores are done as soon as they're in the buffer
+            if (sb_push)
+                dc_out_write_done = 1;
+            else if (sb_forward) begin
+                dc_out_rvalid = 1;
+                dc_out_rdata = sb.ld_fwd_data; // whole doubleword, like D$ rdata
+            end
+        end
+
+        if (sb_drain_sel) begin
+            dcmux_in_wdata = sb.drain_data; // already in position, drain_addr is aligned
+            dcmux_in_wlen  = 3;
+            dcmux_in_wmask = sb.drain_mask;
         end
     end
 
     //NOTE: input signals do d$ can cause circular logic warnings, so do them out here
     // MMU forces dcache to do reads, in physical mode, of its req addr
-    assign dcmux_en         = mmu.use_dcache ? 1                   : (dc_en &&       !dc_out_page_fault);
-    assign dcmux_write_en   = mmu.use_dcache ? 0                   : (dc_write_en && !dc_out_page_fault);
-    assign dcmux_virtual_en = mmu.use_dcache ? 0                   : virtual_en; 
-    assign dcmux_in_addr    = mmu.use_dcache ? mmu.dcache_req_addr : ( dc_in_addr );
+    // Store buffer drains in physical mode too
+    assign dcmux_en         = mmu.use_dcache ? 1                   : sb_drain_sel ? 1             : dc_direct;
+    assign dcmux_write_en   = mmu.use_dcache ? 0                   : sb_drain_sel ? 1             : (dc_write_en && dc_direct);
+    assign dcmux_virtual_en = mmu.use_dcache ? 0                   : sb_drain_sel ? 0             : virtual_en; 
+    assign dcmux_in_addr    = mmu.use_dcache ? mmu.dcache_req_addr : sb_drain_sel ? sb.drain_addr : ( dc_in_addr );
 
 
 
@@ -257,6 +399,7 @@ module MemorySystem
         .wrn  (dcmux_write_en),
         .wdata(dcmux_in_wdata),
         .wlen (dcmux_in_wlen),
+        .wmask(dcmux_in_wmask),
 
         .rdata       (),
         .dcache_valid(),
@@ -265,6 +408,10 @@ module MemorySystem
         .translated_addr      (dtlb.pa),      // translation from D-TLB
         .translated_addr_valid(dtlb.pa_valid),
 
+        // D$ doesn't see a snoop until the store buffer has drained that line
+        .dcache_m_axi_acvalid(m_axi_acvalid && !sb_snoop_hold && !snoop_lock),
+        .dcache_m_axi_acready(dcache_acready),
+
         .* //this links all the dcache_m_axi ports
     );
 
@@ -300,7 +447,7 @@ module MemorySystem
     // Give output to user if we get a response from I$ or if TLB identifies a page fault
     // on page fault, zero out resulting instruction for ease of debugging
     assign ic_resp_valid = icache.icache_valid || ic_resp_page_fault;
-    assign ic_resp_inst = ic_resp_page_fault ? 0 : icache.out_inst; 
+    assign ic_resp_word = ic_resp_page_fault ? 0 : icache.inst_word;
     
     // If we encounter a page fault, I$ will sit and wait
     Icache icache (
@@ -471,4 +618,6 @@ module MemorySystem
     wire [ADDR_WIDTH-1:0]   dcache_m_axi_acaddr;
     wire [3:0]              dcache_m_axi_acsnoop;
 
+    assign dcache_m_axi_acready = dcache_acready && !sb_snoop_hold && !snoop_lock;
+
 endmodule
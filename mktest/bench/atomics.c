@@ -0,0 +1,90 @@
+// LR/SC, AMOs and an amoswap spinlock, hammered by every hart at once: with
+// Vtop built for HARTS=2..4 the counters' line bounces between the D$s on
+// every access.  A lost update (an SC that succeeded without really holding
+// its reservation, an AMO split by a snoop, a store let through the lock)
+// leaves a counter short and fails the checksum.  With one hart it still
+// runs, just without anyone to fight with.
+
+#include "bench.h"
+
+#define ITERS        2000
+#define ARRIVE_SPINS 20000 // how long hart 0 waits for the others to turn up
+#define MAX_HARTS    4
+
+const char bench_name[] = "atomics";
+const uint64_t bench_expected = 3 * ITERS;
+
+static volatile uint64_t lrsc_count, amo_count, locked_count, lock;
+static volatile uint64_t arrived, go, done; // other harts in, let them start, other harts finished
+static volatile uint64_t sc_failures[MAX_HARTS];
+
+static inline uint64_t amoadd(volatile uint64_t* p, uint64_t v) {
+    uint64_t old;
+    asm volatile ("amoadd.d %0, %2, (%1)" : "=r"(old) : "r"(p), "r"(v) : "memory");
+    return old;
+}
+
+// Returns how many times the SC failed before one went through
+static uint64_t lrsc_increment(volatile uint64_t* p) {
+    uint64_t failures = 0, value, fail;
+    for (;;) {
+        asm volatile ("lr.d %0, (%1)" : "=r"(value) : "r"(p) : "memory");
+        asm volatile ("sc.d %0, %2, (%1)" : "=r"(fail) : "r"(p), "r"(value + 1) : "memory");
+        if (!fail) return failures;
+        ++failures;
+    }
+}
+
+static void lock_acquire(void) {
+    uint64_t held;
+    for (;;) {
+        asm volatile ("amoswap.d.aq %0, %2, (%1)" : "=r"(held) : "r"(&lock), "r"(1ULL) : "memory");
+        if (!held) return;
+        while (lock);
+    }
+}
+
+static void lock_release(void) {
+    asm volatile ("amoswap.d.rl x0, x0, (%0)" : : "r"(&lock) : "memory");
+}
+
+static void work(uint64_t hart) {
+    uint64_t failures = 0;
+    for (int i = 0; i < ITERS; ++i) {
+        failures += lrsc_increment(&lrsc_count);
+        amoadd(&amo_count, 1);
+        lock_acquire();
+        locked_count = locked_count + 1;
+        lock_release();
+    }
+    sc_failures[hart] = failures;
+}
+
+void secondary_main(uint64_t hart) {
+    if (hart >= MAX_HARTS) return;
+    amoadd(&arrived, 1);
+    while (!go);
+    work(hart);
+    amoadd(&done, 1);
+}
+
+void bench_setup(void) {
+    for (int i = 0; i < ARRIVE_SPINS && arrived < MAX_HARTS-1; ++i);
+}
+
+uint64_t bench_run(void) {
+    go = 1;
+    work(0);
+    while (done != arrived);
+
+    const uint64_t harts = arrived + 1, total = harts * ITERS;
+    print("atomics: ");
+    print_dec(harts);
+    print(" harts, SC failures");
+    for (uint64_t h = 0; h < harts; ++h) {
+        print(" ");
+        print_dec(sc_failures[h]);
+    }
+    print("\n");
+    return (lrsc_count == total ? ITERS : 0) + (amo_count == total ? ITERS : 0) + (locked_count == total ? ITERS : 0);
+}
@@ -0,0 +1,62 @@
+#ifndef __BENCH_H
+#define __BENCH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Each benchmark defines these.  bench_setup() runs first and isn't counted;
+// bench_run() is timed with mcycle/minstret and returns a checksum, which has
+// to equal bench_expected for the run to pass.  Nothing depends on the
+// target, so the expected values are what a native build prints.
+extern const char bench_name[];
+extern const uint64_t bench_expected;
+void bench_setup(void);
+uint64_t bench_run(void);
+
+// Harts other than 0 (HARTS > 1) call this once hart 0 has cleared .bss.
+// runtime.c's sleeps; a benchmark that wants them defines its own.
+void secondary_main(uint64_t hart);
+
+// ==== runtime.c
+void* memcpy(void* dst, const void* src, size_t n);
+void* memset(void* dst, int c, size_t n);
+void print(const char* s);
+void print_dec(uint64_t n);
+void print_hex(uint64_t n);
+
+// System calls, taken by runtime.c's trap handler in M mode
+#define SYS_WRITE         64
+#define SYS_EXIT          93
+#define SYS_CLOCK_GETTIME 113
+
+struct bench_timespec {
+    int64_t tv_sec, tv_nsec;
+};
+
+static inline long syscall3(long n, long a0, long a1, long a2) {
+    register long r0 asm("a0") = a0;
+    register long r1 asm("a1") = a1;
+    register long r2 asm("a2") = a2;
+    register long r7 asm("a7") = n;
+    asm volatile ("ecall" : "+r"(r0) : "r"(r1), "r"(r2), "r"(r7) : "memory");
+    return r0;
+}
+
+static inline long sys_write(int fd, const void* buf, size_t n) {
+    return syscall3(SYS_WRITE, fd, (long)buf, n);
+}
+
+static inline long sys_clock_gettime(int clock, struct bench_timespec* ts) {
+    return syscall3(SYS_CLOCK_GETTIME, clock, (long)ts, 0);
+}
+
+// Deterministic pseudo-random numbers for the inputs (xorshift64)
+static inline uint64_t xorshift(uint64_t* state) {
+    uint64_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    return *state = x;
+}
+
+#endif
@@ -0,0 +1,31 @@
+#!/bin/sh
+# Runs each benchmark under Vtop and prints a line for it: the cycles and
+# instructions retired (mcycle/minstret, read by the guest around the timed
+# part), the CPI, the I$ miss rate and the host time and simulation speed
+# of the whole run.
+# Each run's output is kept in bench-<name>.out.  Fails if any benchmark
+# got the wrong checksum or didn't finish.
+#
+# usage: bench.sh <Vtop> <benchmark.bin>...
+
+VTOP=$1
+shift
+
+status=0
+printf "%-10s %12s %12s %7s %8s %10s %8s  %s\n" benchmark cycles minstret CPI 'I$ miss' "host (s)" KHz result
+for bin in "$@"; do
+    name=`basename $bin .bin`
+    env FULLSYSTEM=y HAVETLB=n $VTOP $bin > bench-$name.out 2>&1
+    awk -v name=$name '
+        $1 == "bench" && $2 == name { cycles = $4; instret = $6; result = $NF }
+        /^I\$: / { for (i = 1; i < NF; ++i) if ($i == "rate") imiss = $(i+1); sub(/,$/, "", imiss) }
+        /^Simulated .* of host time/ { host = $5; sub(/s$/, "", host); khz = $9; sub(/^\(/, "", khz) }
+        END {
+            if (result == "") result = "no result"
+            cpi = instret ? sprintf("%.3f", cycles / instret) : "-"
+            if (imiss == "") imiss = "-"
+            printf "%-10s %12s %12s %7s %8s %10s %8s  %s\n", name, cycles, instret, cpi, imiss, host, khz, result
+            exit result != "ok"
+        }' bench-$name.out || status=1
+done
+exit $status
@@ -0,0 +1,96 @@
+// Data-dependent branches: a quicksort of random keys, binary searches over
+// the sorted keys, and the dispatch loop of a small bytecode interpreter
+
+#include "bench.h"
+
+#define KEYS     8192
+#define SEARCHES 4096
+#define COLLATZ  1000
+
+const char bench_name[] = "branchy";
+const uint64_t bench_expected = 0xa1364925fddfc34bULL;
+
+static uint32_t keys[KEYS];
+static uint64_t seed = 4;
+
+void bench_setup(void) {
+    for (int i = 0; i < KEYS; ++i) keys[i] = xorshift(&seed) % (4 * KEYS);
+}
+
+static void quicksort(uint32_t* k, int n) {
+    while (n > 16) {
+        const uint32_t pivot = k[n / 2];
+        int i = 0, j = n - 1;
+        for (;;) {
+            while (k[i] < pivot) ++i;
+            while (k[j] > pivot) --j;
+            if (i >= j) break;
+            const uint32_t t = k[i];
+            k[i++] = k[j];
+            k[j--] = t;
+        }
+        // Recurse on the smaller side, loop on the bigger one
+        if (j + 1 < n - j - 1) {
+            quicksort(k, j + 1);
+            k += j + 1;
+            n -= j + 1;
+        } else {
+            quicksort(k + j + 1, n - j - 1);
+            n = j + 1;
+        }
+    }
+    for (int i = 1; i < n; ++i) {
+        const uint32_t key = k[i];
+        int j = i;
+        for (; j > 0 && k[j-1] > key; --j) k[j] = k[j-1];
+        k[j] = key;
+    }
+}
+
+static int search(uint32_t key) {
+    int lo = 0, hi = KEYS;
+    while (lo < hi) {
+        const int mid = (lo + hi) / 2;
+        if (keys[mid] < key) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo < KEYS && keys[lo] == key;
+}
+
+// Counts the Collatz steps from n down to 1
+enum { OP_JUMP_IF_ONE, OP_JUMP_IF_ODD, OP_HALVE, OP_TRIPLE_PLUS_ONE, OP_COUNT, OP_JUMP, OP_HALT };
+static const uint8_t program[][2] = {
+    { OP_JUMP_IF_ONE, 7 },
+    { OP_JUMP_IF_ODD, 4 },
+    { OP_HALVE, 0 },
+    { OP_JUMP, 5 },
+    { OP_TRIPLE_PLUS_ONE, 0 },
+    { OP_COUNT, 0 },
+    { OP_JUMP, 0 },
+    { OP_HALT, 0 },
+};
+
+static uint64_t interpret(uint64_t n) {
+    uint64_t count = 0;
+    int pc = 0;
+    for (;;) {
+        switch (program[pc][0]) {
+            case OP_JUMP_IF_ONE:     pc = n == 1 ? program[pc][1] : pc + 1; break;
+            case OP_JUMP_IF_ODD:     pc = n & 1 ? program[pc][1] : pc + 1; break;
+            case OP_HALVE:           n >>= 1; ++pc; break;
+            case OP_TRIPLE_PLUS_ONE: n = 3 * n + 1; ++pc; break;
+            case OP_COUNT:           ++count; ++pc; break;
+            case OP_JUMP:            pc = program[pc][1]; break;
+            case OP_HALT:            return count;
+        }
+    }
+}
+
+uint64_t bench_run(void) {
+    quicksort(keys, KEYS);
+    uint64_t sum = 0;
+    for (int i = 0; i < KEYS; i += 97) sum = sum * 31 + keys[i];
+    for (int i = 0; i < SEARCHES; ++i) sum += search(xorshift(&seed) % (4 * KEYS));
+    for (uint64_t n = 1; n <= COLLATZ; ++n) sum = sum * 7 + interpret(n);
+    return sum;
+}
@@ -0,0 +1,124 @@
+// A small mix in the spirit of CoreMark: linked-list search and reversal, a
+// matrix kernel, a state machine scanning numbers out of text, and a CRC-16
+// over all their results, each iteration seeded by the last
+
+#include "bench.h"
+
+#define ITERATIONS 20
+#define LIST       64
+#define M          16
+#define TEXT       512
+
+const char bench_name[] = "coremix";
+const uint64_t bench_expected = 0x87adULL;
+
+struct item {
+    struct item* next;
+    int16_t key, value;
+};
+
+static struct item items[LIST];
+static struct item* head;
+static int16_t ma[M][M], mb[M][M];
+static int32_t mc[M][M];
+static char text[TEXT];
+
+static uint16_t crc16(uint16_t crc, uint32_t data) {
+    for (int k = 0; k < 32; ++k, data >>= 1)
+        crc = (crc >> 1) ^ (0xa001 & -((crc ^ data) & 1));
+    return crc;
+}
+
+void bench_setup(void) {
+    uint64_t seed = 5;
+    for (int i = 0; i < LIST; ++i) {
+        items[i].next = i + 1 < LIST ? &items[i + 1] : 0;
+        items[i].key = xorshift(&seed) % 128;
+        items[i].value = i;
+    }
+    head = &items[0];
+    for (int i = 0; i < M; ++i)
+        for (int j = 0; j < M; ++j) {
+            ma[i][j] = xorshift(&seed) % 256 - 128;
+            mb[i][j] = xorshift(&seed) % 256 - 128;
+        }
+    // Numbers like "12", "-7", "3.5", "1e4" and junk, separated by commas
+    static const char* tokens[] = { "12", "-7", "3.5", "1e4", "+0", "x9", "..", "-2.25e-3", "400" };
+    int n = 0;
+    while (n < TEXT - 16) {
+        const char* t = tokens[xorshift(&seed) % (sizeof(tokens) / sizeof(tokens[0]))];
+        while (*t) text[n++] = *t++;
+        text[n++] = ',';
+    }
+    text[n] = 0;
+}
+
+static uint32_t list_work(int16_t find) {
+    uint32_t found = 0;
+    for (const struct item* p = head; p; p = p->next)
+        if (p->key == find) found += p->value;
+
+    struct item* reversed = 0;
+    while (head) {
+        struct item* next = head->next;
+        head->next = reversed;
+        reversed = head;
+        head = next;
+    }
+    head = reversed;
+    return found + head->value;
+}
+
+static uint32_t matrix_work(int16_t add) {
+    uint32_t sum = 0;
+    for (int i = 0; i < M; ++i)
+        for (int j = 0; j < M; ++j) ma[i][j] += add;
+    for (int i = 0; i < M; ++i)
+        for (int j = 0; j < M; ++j) {
+            int32_t dot = 0;
+            for (int k = 0; k < M; ++k) dot += ma[i][k] * mb[k][j];
+            mc[i][j] = dot;
+            sum += dot > 0 ? dot & 0xff : 1;
+        }
+    for (int i = 0; i < M; ++i)
+        for (int j = 0; j < M; ++j) ma[i][j] = (int16_t)(mc[i][j] >> 8);
+    return sum;
+}
+
+// Counts ints, decimals, exponents and invalid tokens
+enum { START, SIGN, INT, POINT, FRACTION, EXPONENT, EXPONENT_SIGN, EXPONENT_DIGITS, INVALID };
+
+static uint32_t state_work(void) {
+    uint32_t counts[INVALID + 1] = { 0 };
+    int state = START;
+    for (const char* p = text; *p; ++p) {
+        const char c = *p;
+        if (c == ',') {
+            ++counts[state];
+            state = START;
+            continue;
+        }
+        const int digit = c >= '0' && c <= '9';
+        switch (state) {
+            case START:           state = digit ? INT : (c == '+' || c == '-') ? SIGN : c == '.' ? POINT : INVALID; break;
+            case SIGN:            state = digit ? INT : c == '.' ? POINT : INVALID; break;
+            case INT:             state = digit ? INT : c == '.' ? POINT : (c == 'e' || c == 'E') ? EXPONENT : INVALID; break;
+            case POINT:           state = digit ? FRACTION : INVALID; break;
+            case FRACTION:        state = digit ? FRACTION : (c == 'e' || c == 'E') ? EXPONENT : INVALID; break;
+            case EXPONENT:        state = digit ? EXPONENT_DIGITS : (c == '+' || c == '-') ? EXPONENT_SIGN : INVALID; break;
+            case EXPONENT_SIGN:
+            case EXPONENT_DIGITS: state = digit ? EXPONENT_DIGITS : INVALID; break;
+        }
+    }
+    return counts[INT] | counts[FRACTION] << 8 | counts[EXPONENT_DIGITS] << 16 | counts[INVALID] << 24;
+}
+
+uint64_t bench_run(void) {
+    uint16_t crc = 0;
+    for (int i = 0; i < ITERATIONS; ++i) {
+        crc = crc16(crc, list_work(crc % 128));
+        crc = crc16(crc, matrix_work(crc % 8));
+        crc = crc16(crc, state_work());
+    }
+    return crc;
+}
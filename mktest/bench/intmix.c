@@ -0,0 +1,52 @@
+// Integer compute: an integer matrix multiply and a bit-at-a-time CRC-32,
+// loops that only exercise the ALU, the multiplier/divider and the L1
+
+#include "bench.h"
+
+#define N         32
+#define ROUNDS    4
+#define CRC_BYTES (16*1024)
+
+const char bench_name[] = "intmix";
+const uint64_t bench_expected = 0x2fabcdacadc94cfcULL;
+
+static int32_t a[N][N], b[N][N], c[N][N];
+static uint8_t data[CRC_BYTES];
+
+void bench_setup(void) {
+    uint64_t seed = 1;
+    for (int i = 0; i < N; ++i)
+        for (int j = 0; j < N; ++j) {
+            a[i][j] = (int32_t)(xorshift(&seed) % 2001) - 1000;
+            b[i][j] = (int32_t)(xorshift(&seed) % 2001) - 1000;
+        }
+    for (int i = 0; i < CRC_BYTES; ++i) data[i] = xorshift(&seed);
+}
+
+static uint32_t crc32(const uint8_t* p, size_t n) {
+    uint32_t crc = ~0U;
+    while (n--) {
+        crc ^= *p++;
+        for (int k = 0; k < 8; ++k) crc = (crc >> 1) ^ (0xedb88320U & -(crc & 1));
+    }
+    return ~crc;
+}
+
+uint64_t bench_run(void) {
+    uint64_t sum = 0;
+    for (int round = 0; round < ROUNDS; ++round) {
+        for (int i = 0; i < N; ++i)
+            for (int j = 0; j < N; ++j) {
+                int64_t dot = 0;
+                for (int k = 0; k < N; ++k) dot += (int64_t)a[i][k] * b[k][j];
+                c[i][j] = dot % 1009;
+            }
+        // Feed the product back in, so every round depends on the last
+        for (int i = 0; i < N; ++i)
+            for (int j = 0; j < N; ++j) {
+                sum = sum * 31 + (uint32_t)c[i][j];
+                a[i][j] = c[i][j] - (c[i][j] / 3);
+            }
+    }
+    return sum ^ (uint64_t)crc32(data, CRC_BYTES) << 32;
+}
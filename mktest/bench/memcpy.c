@@ -0,0 +1,39 @@
+// memcpy and memset, through runtime.c's word-at-a-time versions, over
+// buffers a few times the size of the L1 and at sizes and alignments from a
+// handful of bytes up
+
+#include "bench.h"
+
+#define BUF    (128*1024)
+#define ROUNDS 4
+
+const char bench_name[] = "memcpy";
+const uint64_t bench_expected = 0x4782fb633e3af7a4ULL;
+
+static uint8_t src[BUF + 64], dst[BUF + 64];
+
+static const struct {
+    size_t size, src_offset, dst_offset;
+} copies[] = {
+    { BUF, 0, 0 }, { BUF / 2 + 13, 8, 0 }, { BUF / 4, 3, 5 }, { 4096, 0, 16 },
+    { 1000, 1, 1 }, { 100, 7, 0 }, { 17, 2, 9 },
+};
+
+void bench_setup(void) {
+    uint64_t seed = 3;
+    for (int i = 0; i < BUF + 64; ++i) src[i] = xorshift(&seed);
+}
+
+uint64_t bench_run(void) {
+    uint64_t sum = 0;
+    for (int round = 0; round < ROUNDS; ++round)
+        for (size_t i = 0; i < sizeof(copies) / sizeof(copies[0]); ++i) {
+            uint8_t* d = dst + copies[i].dst_offset;
+            const size_t size = copies[i].size;
+            memset(d, round + i, size + 8);
+            memcpy(d, src + copies[i].src_offset + round, size);
+            sum = sum * 31 + d[0] + d[size / 2] + d[size - 1] + d[size];
+        }
+    for (int i = 0; i < BUF + 64; i += 64) sum = sum * 31 + dst[i];
+    return sum;
+}
@@ -0,0 +1,46 @@
+// Pointer chasing: one random cycle through 64-byte nodes, 4MB of them, so
+// most steps are a load that misses all the way to DRAM and that the next
+// step depends on
+
+#include "bench.h"
+
+#define NODES (64*1024)
+#define STEPS (48*1024)
+
+const char bench_name[] = "ptrchase";
+const uint64_t bench_expected = 0x935200603b0d68ULL;
+
+struct node {
+    struct node* next;
+    uint64_t value;
+    uint64_t pad[6];
+};
+
+static struct node nodes[NODES];
+static uint32_t order[NODES];
+
+void bench_setup(void) {
+    // Sattolo's shuffle, which only makes permutations that are one cycle
+    uint64_t seed = 2;
+    for (uint32_t i = 0; i < NODES; ++i) order[i] = i;
+    for (uint32_t i = NODES - 1; i > 0; --i) {
+        const uint32_t j = xorshift(&seed) % i;
+        const uint32_t t = order[i];
+        order[i] = order[j];
+        order[j] = t;
+    }
+    for (uint32_t i = 0; i < NODES; ++i) {
+        nodes[i].next = &nodes[order[i]];
+        nodes[i].value = i;
+    }
+}
+
+uint64_t bench_run(void) {
+    const struct node* p = &nodes[0];
+    uint64_t sum = 0;
+    for (int i = 0; i < STEPS; ++i) {
+        sum += p->value;
+        p = p->next;
+    }
+    return sum ^ (uint64_t)p->value << 40;
+}
@@ -0,0 +1,31 @@
+// Syscall-heavy I/O: lots of small write()s and clock_gettime()s, each one a
+// trap into runtime.c's handler and back, with the writes going out a byte
+// at a time through uncached stores to the UART
+
+#include "bench.h"
+
+#define CALLS 1000
+
+const char bench_name[] = "syscall";
+const uint64_t bench_expected = 0x32c8ULL;
+
+void bench_setup(void) {
+}
+
+uint64_t bench_run(void) {
+    uint64_t written = 0, backwards = 0;
+    int64_t last = 0;
+    char line[] = "syscall 0000\n";
+    for (int i = 0; i < CALLS; ++i) {
+        for (int d = 11, n = i; d >= 8; --d, n /= 10) line[d] = '0' + n % 10;
+        written += sys_write(1, line, sizeof(line) - 1);
+
+        struct bench_timespec ts;
+        sys_clock_gettime(0, &ts);
+        const int64_t now = ts.tv_sec * 1000000000 + ts.tv_nsec;
+        backwards += now < last;
+        last = now;
+    }
+    // Time only ever goes forward
+    return written + (backwards << 32);
+}
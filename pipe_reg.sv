@@ -19,6 +19,11 @@
  * The op it takes in can be a valid op, in which our reg gets (wr_en,  !gen_bubble)
  * Or the op it takes in can be a bubble, and we get           (<dontcare>, gen_bubble)
  *
+ * DUAL ISSUE: each reg also has a second slot (xxx1 signals), holding the op
+ * after the main one when the two were issued as a pair.  It's only an ALU op,
+ * so it only carries what the ALU path needs.  It travels with the main op:
+ * valid1 implies valid, and a bubble clears both.
+ *
  */
 
 // Instruction Fetch / Instruction Decode (+ Register fetch) register
@@ -35,6 +40,10 @@ module ID_reg(
     // Data signals coming in from IF
     input [63:0] next_pc,
     input [63:0] next_inst,
+    input        next_rvc,  // inst was expanded from a compressed op
+    input        next_valid1,
+    input [31:0] next_inst1,
+    input        next_rvc1,
 
     input                next_trapped,
     input [63:0]         next_trap_cause,
@@ -43,6 +52,10 @@ module ID_reg(
     // Data signals for current ID step
     output [63:0] curr_pc, //instruction not yet decoded, so pass this in separately
     output [63:0] curr_inst,
+    output        curr_rvc,
+    output        valid1,
+    output [31:0] curr_inst1,
+    output        curr_rvc1,
 
     output                curr_trapped,
     output [63:0]         curr_trap_cause,
@@ -53,6 +66,10 @@ module ID_reg(
             valid <= 0;
             curr_pc    <= 0;
             curr_inst  <= 0;
+            curr_rvc   <= 0;
+            valid1     <= 0;
+            curr_inst1 <= 0;
+            curr_rvc1  <= 0;
             curr_trapped    <= 0;
             curr_trap_cause <= 0;
             curr_trap_val   <= 0;
@@ -62,6 +79,10 @@ module ID_reg(
                 valid <= 0;
                 curr_pc <= 0;
                 curr_inst <= 0;
+                curr_rvc <= 0;
+                valid1 <= 0;
+                curr_inst1 <= 0;
+                curr_rvc1 <= 0;
                 curr_trapped    <= 0;
                 curr_trap_cause <= 0;
                 curr_trap_val   <= 0;
@@ -70,6 +91,10 @@ module ID_reg(
                 valid <= 1;
                 curr_pc <= next_pc;
                 curr_inst <= next_inst;
+                curr_rvc <= next_rvc;
+                valid1 <= next_valid1;
+                curr_inst1 <= next_inst1;
+                curr_rvc1 <= next_rvc1;
                 curr_trapped    <= next_trapped;
                 curr_trap_cause <= next_trap_cause;
                 curr_trap_val   <= next_trap_val;
@@ -95,6 +120,10 @@ module EX_reg(
     input decoded_inst_t next_deco, // includes pc & immed
     input [63:0]         next_val_rs1,
     input [63:0]         next_val_rs2,
+    input                next_valid1,
+    input decoded_inst_t next_deco1,
+    input [63:0]         next_val1_rs1,
+    input [63:0]         next_val1_rs2,
 
     input                next_trapped,
     input [63:0]         next_trap_cause,
@@ -105,6 +134,10 @@ module EX_reg(
     output decoded_inst_t curr_deco,
     output [63:0]         curr_val_rs1,
     output [63:0]         curr_val_rs2,
+    output                valid1,
+    output decoded_inst_t curr_deco1,
+    output [63:0]         curr_val1_rs1,
+    output [63:0]         curr_val1_rs2,
 
     output                curr_trapped,
     output [63:0]         curr_trap_cause,
@@ -117,6 +150,10 @@ module EX_reg(
             curr_deco    <= 0;
             curr_val_rs1 <= 0;
             curr_val_rs2 <= 0;
+            valid1        <= 0;
+            curr_deco1    <= 0;
+            curr_val1_rs1 <= 0;
+            curr_val1_rs2 <= 0;
             curr_trapped    <= 0;
             curr_trap_cause <= 0;
             curr_trap_val   <= 0;
@@ -128,6 +165,10 @@ module EX_reg(
                 curr_deco <= 0;
                 curr_val_rs1 <= 0;
                 curr_val_rs2 <= 0;
+                valid1 <= 0;
+                curr_deco1 <= 0;
+                curr_val1_rs1 <= 0;
+                curr_val1_rs2 <= 0;
                 curr_trapped    <= 0;
                 curr_trap_cause <= 0;
                 curr_trap_val   <= 0;
@@ -138,6 +179,10 @@ module EX_reg(
                 curr_deco    <= next_deco;
                 curr_val_rs1 <= next_val_rs1;
                 curr_val_rs2 <= next_val_rs2;
+                valid1        <= next_valid1;
+                curr_deco1    <= next_deco1;
+                curr_val1_rs1 <= next_val1_rs1;
+                curr_val1_rs2 <= next_val1_rs2;
 
                 curr_trapped    <= next_trapped;
                 curr_trap_cause <= next_trap_cause;
@@ -164,6 +209,9 @@ module MEM_reg(
     input decoded_inst_t next_deco, // includes pc & immed
     input [63:0]         next_data,  // result from ALU or other primary value
     input [63:0]         next_data2, // extra value if needed (e.g. for stores, etc)
+    input                next_valid1,
+    input decoded_inst_t next_deco1,
+    input [63:0]         next_data1, // second slot's ALU result
 
     input                next_trapped,
     input [63:0]         next_trap_cause,
@@ -174,6 +222,9 @@ module MEM_reg(
     output decoded_inst_t curr_deco,
     output [63:0]         curr_data,
     output [63:0]         curr_data2,
+    output                valid1,
+    output decoded_inst_t curr_deco1,
+    output [63:0]         curr_data1,
 
     output                curr_trapped,
     output [63:0]         curr_trap_cause,
@@ -191,6 +242,9 @@ module MEM_reg(
             curr_deco    <= 0;
             curr_data    <= 0;
             curr_data2   <= 0;
+            valid1       <= 0;
+            curr_deco1   <= 0;
+            curr_data1   <= 0;
 
             curr_do_jump <= 0;
             curr_jump_target <= 0;
@@ -206,6 +260,9 @@ module MEM_reg(
                 curr_deco <= 0;
                 curr_data <= 0;
                 curr_data2 <= 0;
+                valid1 <= 0;
+                curr_deco1 <= 0;
+                curr_data1 <= 0;
             
                 curr_do_jump <= 0;
                 curr_jump_target <= 0;
@@ -220,6 +277,9 @@ module MEM_reg(
                 curr_deco    <= next_deco;
                 curr_data    <= next_data;
                 curr_data2   <= next_data2;
+                valid1       <= next_valid1;
+                curr_deco1   <= next_deco1;
+                curr_data1   <= next_data1;
 
                 curr_do_jump <= next_do_jump;
                 curr_jump_target <= next_jump_target;
@@ -249,6 +309,9 @@ module WB_reg(
     input decoded_inst_t next_deco, // includes pc & immed
     input [63:0]         next_alu_result,
     input [63:0]         next_mem_result,
+    input                next_valid1,
+    input decoded_inst_t next_deco1,
+    input [63:0]         next_result1,
 
     input                next_trapped,
     input [63:0]         next_trap_cause,
@@ -259,6 +322,9 @@ module WB_reg(
     output decoded_inst_t curr_deco, // includes pc & immed
     output [63:0]         curr_alu_result,
     output [63:0]         curr_mem_result,
+    output                valid1,
+    output decoded_inst_t curr_deco1,
+    output [63:0]         curr_result1,
 
     output                curr_trapped,
     output [63:0]         curr_trap_cause,
@@ -276,6 +342,9 @@ module WB_reg(
             curr_deco       <= 0;
             curr_alu_result <= 0;
             curr_mem_result <= 0;
+            valid1          <= 0;
+            curr_deco1      <= 0;
+            curr_result1    <= 0;
             
             curr_do_jump <= 0;
             curr_jump_target <= 0;
@@ -291,6 +360,9 @@ module WB_reg(
                 curr_deco <= 0;
                 curr_alu_result <= 0;
                 curr_mem_result <= 0;
+                valid1 <= 0;
+                curr_deco1 <= 0;
+                curr_result1 <= 0;
             
                 curr_do_jump <= 0;
                 curr_jump_target <= 0;
@@ -305,6 +377,9 @@ module WB_reg(
                 curr_deco       <= next_deco;
                 curr_alu_result <= next_alu_result;
                 curr_mem_result <= next_mem_result;
+                valid1          <= next_valid1;
+                curr_deco1      <= next_deco1;
+                curr_result1    <= next_result1;
             
                 curr_do_jump <= next_do_jump;
                 curr_jump_target <= next_jump_target;
@@ -0,0 +1,171 @@
+#include <iostream>
+#include <assert.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+#include "pipeview.h"
+#include "system.h"
+
+using namespace std;
+
+static const char* stage_names[] = { "IF", "ID", "EX", "MEM", "WB" };
+
+// Lane 1 spans over the cycles an op spends in a stage beyond the first,
+// named for why it didn't move on: its own stage's stall, or a stage ahead
+static const char* stall_names[] = { "", "hazard", "", "memory", "wb" };
+static const char* STALL_BLOCKED = "blocked";
+
+static const char* flush_names[] = { "", "a trap", "a pipeline flush in MEM", "a taken jump", "a trap ahead" };
+
+PipeView::PipeView(const char* filename, uint64_t first, uint64_t last)
+    : first(first), last(last), cycle(0), logged_cycle(0), started(false), next_kid(0), next_retire(0),
+      flush(PV_FLUSH_NONE), flush_pc(0), flush_have_pc(false)
+{
+    out = fopen(filename, "w");
+    if (!out) {
+        cerr << "Couldn't open pipeline trace " << filename << ": " << strerror(errno) << endl;
+        exit(-1);
+    }
+    setvbuf(out, NULL, _IOFBF, 1*MEGA);
+    fprintf(out, "Kanata\t0004\n");
+}
+
+PipeView::~PipeView() {
+    assert(fclose(out) == 0);
+}
+
+bool PipeView::enabled(uint64_t cycle) {
+    if (cycle < first || cycle > last) return false;
+
+    // Konata only moves forward, a cycle at a time
+    if (!started) fprintf(out, "C=\t%lu\n", cycle);
+    else fprintf(out, "C\t%lu\n", cycle - logged_cycle);
+    started = true;
+    logged_cycle = cycle;
+    this->cycle = cycle;
+    return true;
+}
+
+PipeView::Op& PipeView::add(uint64_t id, int stage, const char* label) {
+    Op& op = ops[id];
+    op.kid = next_kid++;
+    op.pc = 0;
+    op.have_pc = false;
+    op.stage = stage;
+    op.seen = cycle;
+    op.stall = NULL;
+    op.waiting = NULL;
+    op.trapped = false;
+    fprintf(out, "I\t%lu\t%lu\t0\n", op.kid, id);
+    if (label) fprintf(out, "L\t%lu\t0\t%s\n", op.kid, label);
+    fprintf(out, "S\t%lu\t0\t%s\n", op.kid, stage_names[stage]);
+    return op;
+}
+
+void PipeView::stop_stall(Op& op) {
+    if (!op.stall) return;
+    fprintf(out, "E\t%lu\t1\t%s\n", op.kid, op.stall);
+    op.stall = NULL;
+}
+
+void PipeView::start_stage(Op& op, int stage) {
+    stop_stall(op);
+    fprintf(out, "E\t%lu\t0\t%s\n", op.kid, stage_names[op.stage]);
+    fprintf(out, "S\t%lu\t0\t%s\n", op.kid, stage_names[stage]);
+    op.stage = stage;
+}
+
+void PipeView::finish(Op& op, bool flushed) {
+    stop_stall(op);
+    fprintf(out, "E\t%lu\t0\t%s\n", op.kid, stage_names[op.stage]);
+    fprintf(out, "R\t%lu\t%lu\t%d\n", op.kid, flushed ? 0 : next_retire++, flushed ? 1 : 0);
+}
+
+void PipeView::fetch(uint64_t id, uint64_t pc, uint32_t inst, bool rvc, bool fault) {
+    char label[64];
+    if (fault) snprintf(label, sizeof(label), "%lx: (fetch page fault)", pc);
+    else snprintf(label, sizeof(label), "%lx: %08x%s", pc, inst, rvc ? " (c)" : "");
+    Op& op = add(id, PV_IF, label);
+    op.pc = pc;
+    op.have_pc = true;
+}
+
+void PipeView::stage(int stage, uint64_t id, bool stall) {
+    unordered_map<uint64_t, Op>::iterator it = ops.find(id);
+    if (it == ops.end()) {
+        // Fetched before the window opened, or an interrupt sent down with nothing fetched
+        add(id, stage, "(fetched outside the trace)");
+        it = ops.find(id);
+    } else if (it->second.stage != stage) {
+        start_stage(it->second, stage);
+    } else if (it->second.stall != it->second.waiting) {
+        stop_stall(it->second);
+        it->second.stall = it->second.waiting;
+        fprintf(out, "S\t%lu\t1\t%s\n", it->second.kid, it->second.stall);
+    }
+
+    Op& op = it->second;
+    op.seen = cycle;
+    op.waiting = stall ? stall_names[stage] : STALL_BLOCKED;
+}
+
+void PipeView::end_cycle(int flush, uint64_t flush_id, bool trap, uint64_t trap_id, bool xret, uint64_t cause, uint64_t tval) {
+    // Ops that were somewhere last cycle but weren't reported this cycle have
+    // left WB, or were flushed at the end of last cycle.  Ops still in the
+    // fetch queue are only ever dropped by a flush.
+    for (unordered_map<uint64_t, Op>::iterator it = ops.begin(); it != ops.end(); ) {
+        Op& op = it->second;
+        if (op.seen == cycle || (op.stage == PV_IF && this->flush == PV_FLUSH_NONE)) {
+            ++it;
+            continue;
+        }
+        if (op.stage != PV_WB) {
+            char label[96];
+            if (flush_have_pc) snprintf(label, sizeof(label), "flushed by %s at %lx", flush_names[this->flush], flush_pc);
+            else snprintf(label, sizeof(label), "flushed by %s", flush_names[this->flush]);
+            fprintf(out, "L\t%lu\t1\t%s\n", op.kid, label);
+        }
+        finish(op, op.stage != PV_WB || op.trapped);
+        it = ops.erase(it);
+    }
+
+    // A trap in WB (not an xret, which completes normally) is flushed rather
+    // than retired, and takes the op paired with it along
+    if (trap && !xret) {
+        for (unordered_map<uint64_t, Op>::iterator it = ops.begin(); it != ops.end(); ++it) {
+            Op& op = it->second;
+            if (op.stage != PV_WB || op.trapped) continue;
+            op.trapped = true;
+            if (it->first == trap_id)
+                fprintf(out, "L\t%lu\t1\ttrap: cause %lx, tval %lx\n", op.kid, cause, tval);
+            else
+                fprintf(out, "L\t%lu\t1\tdropped with the trap ahead of it\n", op.kid);
+        }
+    }
+
+    unordered_map<uint64_t, Op>::iterator culprit = ops.find(flush_id);
+    this->flush = flush;
+    flush_have_pc = flush != PV_FLUSH_NONE && culprit != ops.end() && culprit->second.have_pc;
+    flush_pc = flush_have_pc ? culprit->second.pc : 0;
+}
+
+extern "C" {
+
+    int pipeview_enabled(long long cycle) {
+        PipeView* pipeview = System::sys->pipeview;
+        return pipeview && pipeview->enabled(cycle);
+    }
+
+    void pipeview_fetch(long long id, long long pc, int inst, int rvc, int fault) {
+        System::sys->pipeview->fetch(id, pc, inst, rvc, fault);
+    }
+
+    void pipeview_stage(int stage, long long id, int stall) {
+        System::sys->pipeview->stage(stage, id, stall);
+    }
+
+    void pipeview_cycle(int flush, long long flush_id, int trap, long long trap_id, int xret, long long cause, long long tval) {
+        System::sys->pipeview->end_cycle(flush, flush_id, trap, trap_id, xret, cause, tval);
+    }
+
+}
@@ -0,0 +1,60 @@
+#ifndef __PIPEVIEW_H
+#define __PIPEVIEW_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <unordered_map>
+
+// PIPEVIEW=<file>: per-op pipeline trace in Konata's log format (Kanata 0004),
+// for looking at where cycles go op by op instead of signal by signal in
+// gtkwave.  top.sv numbers every fetched op and, for cycles inside
+// PIPEVIEW_WINDOW, reports through DPI what it fetched and which op sits in
+// each stage.  This works out the rest: stage changes, stalls (lane 1, named
+// after the cause), flushes and what caused them, traps and retirement.
+//
+// Stage numbers as reported by top.sv
+enum { PV_IF, PV_ID, PV_EX, PV_MEM, PV_WB };
+
+// Why ops behind some stage were dropped at the end of a cycle
+enum { PV_FLUSH_NONE, PV_FLUSH_TRAP, PV_FLUSH_MEM, PV_FLUSH_JUMP, PV_FLUSH_TRAP_AHEAD };
+
+class PipeView {
+    struct Op {
+        uint64_t kid;        // id in the log (Konata wants them dense, in order of first appearance)
+        uint64_t pc;
+        bool     have_pc;    // fetched inside the window
+        int      stage;
+        uint64_t seen;       // last cycle it was reported in a stage
+        const char* stall;   // lane 1 stall span that's open, if any
+        const char* waiting; // what held it up last cycle, if it doesn't move
+        bool     trapped;
+    };
+
+    FILE* out;
+    uint64_t first, last; // cycles to trace, inclusive
+    uint64_t cycle;       // cycle being reported
+    uint64_t logged_cycle;
+    bool     started;
+    uint64_t next_kid, next_retire;
+    std::unordered_map<uint64_t, Op> ops; // by top.sv's op number
+
+    int      flush;       // last cycle's flush, applied to ops missing this cycle
+    uint64_t flush_pc;
+    bool     flush_have_pc;
+
+    Op& add(uint64_t id, int stage, const char* label);
+    void start_stage(Op& op, int stage);
+    void stop_stall(Op& op);
+    void finish(Op& op, bool flushed);
+
+public:
+    PipeView(const char* filename, uint64_t first, uint64_t last);
+    ~PipeView();
+
+    bool enabled(uint64_t cycle);
+    void fetch(uint64_t id, uint64_t pc, uint32_t inst, bool rvc, bool fault);
+    void stage(int stage, uint64_t id, bool stall);
+    void end_cycle(int flush, uint64_t flush_id, bool trap, uint64_t trap_id, bool xret, uint64_t cause, uint64_t tval);
+};
+
+#endif
@@ -4,16 +4,19 @@
 module Privilege_System
 #(
     REG_WIDTH = 64,
-    CSR_COUNT = 4096,
     CSR = 12  // Num CSR bits
 )
 (
     input clk,
-    input hz32768timer,
     input reset,
 
-    input inst_retire,
+    input [1:0] inst_retire, // number of ops retiring this cycle (2 with dual issue)
+    input [63:0] mhartid,
     input [63:0] mtime,
+    input mtip,         // machine timer interrupt line (from CLINT)
+    input msip,         // machine software interrupt line (from CLINT)
+    input meip,         // machine external interrupt line (from PLIC)
+    input seip,         // supervisor external interrupt line (from PLIC)
 
     // target address of instruction
     input [CSR-1:0] addr,
@@ -44,11 +47,38 @@ module Privilege_System
     output [REG_WIDTH-1:0] satp_csr,
 
     output modifying_satp,
+    output wfi_wakeup,          // an event that should end a WFI stall
+    output interrupt_pending,   // an enabled interrupt should be taken now
+    output [63:0] interrupt_cause,
     output [1:0] curr_priv_mode
 );
     logic [1:0] current_mode;   // Current privilege mode
-    //logic [REG_WIDTH-1:0] csrs [0:CSR_COUNT-1]; // The CSR registers
-    logic [0:CSR_COUNT-1][REG_WIDTH-1:0] csrs;
+
+    // ==== CSR storage
+    // Only CSRs that hold state get a register (see csr_implemented in
+    // decoder.sv for every address we accept; the rest are illegal
+    // instructions in ID).  Views like sie/sip and the user counters are
+    // computed from these, mhartid comes in from top.sv, and the hpm counters
+    // and the other ID registers read as 0.
+    logic [REG_WIDTH-1:0] mstatus, sstatus;
+    logic [REG_WIDTH-1:0] medeleg, mideleg;
+    logic [REG_WIDTH-1:0] mie;
+    logic [REG_WIDTH-1:0] mip_sw;   // software-writable bits of mip
+    logic [REG_WIDTH-1:0] mtvec, stvec;
+    logic [REG_WIDTH-1:0] mcounteren;
+    logic [REG_WIDTH-1:0] mscratch, sscratch;
+    logic [REG_WIDTH-1:0] mepc, sepc;
+    logic [REG_WIDTH-1:0] mcause, scause;
+    logic [REG_WIDTH-1:0] mtval, stval;
+    logic [REG_WIDTH-1:0] satp;
+    logic [REG_WIDTH-1:0] mcycle, minstret;
+
+    localparam [REG_WIDTH-1:0] MISA = (64'b10 << (REG_WIDTH-2)) | // Our ISA is 64-bit
+                                      (1 << 18) | // Supervisor mode implemented
+                                      (1 << 12) | // Integer mult/div extension
+                                      (1 << 8)  | // RV64I base ISA
+                                      (1 << 2)  | // Compressed extension
+                                      (1 << 0);   // Atomic extension
 
     logic [1:0] trap_privilege_mode;
 
@@ -58,7 +88,7 @@ module Privilege_System
     assign csr_rw_perm = addr[CSR-1:CSR-2];
     assign lowest_priv = addr[CSR-3:CSR-4];
 
-    assign satp_csr = csrs[CSR_SATP];
+    assign satp_csr = satp;
 
     logic is_interrupt;
     assign is_interrupt = trap_cause[63];
@@ -66,87 +96,155 @@ module Privilege_System
     assign curr_priv_mode = current_mode;
     assign modifying_satp = valid && is_csr && (addr == CSR_SATP);
 
+    // ==== Interrupts
+    // MTIP/MSIP are driven by the CLINT and MEIP by the PLIC, the rest of mip
+    // is software-writable.  SEIP is the OR of the PLIC line and the written bit.
+    localparam MIP_HW_MASK = 64'h888;
+    logic [REG_WIDTH-1:0] mip;
+    assign mip = (mip_sw & ~MIP_HW_MASK) | (meip << 11) | (seip << 9) | (mtip << 7) | (msip << 3);
+
+    logic [REG_WIDTH-1:0] m_irqs; // pending, enabled, and handled in M
+    logic [REG_WIDTH-1:0] s_irqs; // pending, enabled, and delegated to S
+    logic [REG_WIDTH-1:0] take_irqs;
+    assign m_irqs = mip & mie & ~mideleg;
+    assign s_irqs = mip & mie &  mideleg;
+
+    // Interrupts for a higher privilege mode are always enabled,
+    // for the current mode only if its xIE bit is set
     always_comb begin
-        if (addr == CSR_CYCLE) begin
-            csr_result = csrs[CSR_MCYCLE];
-        end
-        else if (addr == CSR_INSTRET) begin
-            csr_result = csrs[CSR_MINSTRET];
-        end
-        else if (addr == CSR_TIME) begin
-            csr_result = mtime;
-        end
+        take_irqs = 0;
+        if (current_mode != PRIV_M || mstatus[3])
+            take_irqs = take_irqs | m_irqs;
+        if (current_mode == PRIV_U || (current_mode == PRIV_S && sstatus[1]))
+            take_irqs = take_irqs | s_irqs;
+    end
+
+    // Pick by priority: MEI, MSI, MTI, SEI, SSI, STI
+    always_comb begin
+        interrupt_pending = 1;
+        if      (take_irqs[11]) interrupt_cause = {1'b1, 63'd11};
+        else if (take_irqs[3])  interrupt_cause = {1'b1, 63'd3};
+        else if (take_irqs[7])  interrupt_cause = {1'b1, 63'd7};
+        else if (take_irqs[9])  interrupt_cause = {1'b1, 63'd9};
+        else if (take_irqs[1])  interrupt_cause = {1'b1, 63'd1};
+        else if (take_irqs[5])  interrupt_cause = {1'b1, 63'd5};
         else begin
-            csr_result = csrs[addr]; // Combinationally read CSRs
+            interrupt_pending = 0;
+            interrupt_cause = 0;
         end
     end
 
-    always_ff @(posedge clk) begin
-        csrs[CSR_MCYCLE] <= csrs[CSR_MCYCLE] + 1;
+    // WFI resumes as soon as an interrupt is pending, even if it is globally
+    // disabled (the trap itself is only taken if enabled)
+    assign wfi_wakeup = (mip & mie) != 0;
 
-        // Not sure if this is necessary since 'time' is a read-only shadow of MTIME which we get from top
-        if (hz32768timer == 1) begin
-            csrs[CSR_TIME] <= csrs[CSR_TIME] + 1;
-        end
-        /////////////////////////////////////////////////
+    always_comb begin
+        case (addr) inside
+            CSR_CYCLE,   CSR_MCYCLE:   csr_result = mcycle;
+            CSR_INSTRET, CSR_MINSTRET: csr_result = minstret;
+            CSR_TIME:                  csr_result = mtime;
+
+            CSR_SSTATUS:    csr_result = sstatus;
+            CSR_SIE:        csr_result = mie & mideleg;
+            CSR_STVEC:      csr_result = stvec;
+            CSR_SSCRATCH:   csr_result = sscratch;
+            CSR_SEPC:       csr_result = sepc;
+            CSR_SCAUSE:     csr_result = scause;
+            CSR_STVAL:      csr_result = stval;
+            CSR_SIP:        csr_result = mip & mideleg;
+            CSR_SATP:       csr_result = satp;
+
+            CSR_MSTATUS:    csr_result = mstatus;
+            CSR_MISA:       csr_result = MISA;
+            CSR_MEDELEG:    csr_result = medeleg;
+            CSR_MIDELEG:    csr_result = mideleg;
+            CSR_MIE:        csr_result = mie;
+            CSR_MTVEC:      csr_result = mtvec;
+            CSR_MCOUNTEREN: csr_result = mcounteren;
+            CSR_MSCRATCH:   csr_result = mscratch;
+            CSR_MEPC:       csr_result = mepc;
+            CSR_MCAUSE:     csr_result = mcause;
+            CSR_MTVAL:      csr_result = mtval;
+            CSR_MIP:        csr_result = mip;
+            CSR_MHARTID:    csr_result = mhartid;
+
+            default:        csr_result = 0; // read-only zero (or illegal, trapped in ID)
+        endcase
+    end
 
-        if (inst_retire == 1) begin
-            csrs[CSR_MINSTRET] <= csrs[CSR_MINSTRET] + 1;
-        end
-        
-        if (reset) begin
-            integer i;
-            for (i = 0; i < 4096; i++)
-                csrs[i] <= 0;
-            // csrs <= '{default:0};
+    // Value a CSR op writes back.  Set/clear work on the stored bits, so reading
+    // mip doesn't latch the interrupt lines into mip_sw.
+    logic [REG_WIDTH-1:0] csr_stored;
+    logic [REG_WIDTH-1:0] csr_new;
+    assign csr_stored = (addr == CSR_MIP) ? mip_sw : csr_result;
+    assign csr_new = csr_rw ? val : csr_rs ? (csr_stored | val) : (csr_stored & ~val);
 
-            csrs[CSR_MISA][REG_WIDTH-1:REG_WIDTH-2] <= 2'b10; // Our ISA is 64-bit
-            csrs[CSR_MISA][18] <= 1; // Supervisor mode implemented
-            csrs[CSR_MISA][12] <= 1; // Integer mult/div extension
-            csrs[CSR_MISA][8] <= 1; // RV64I base ISA
-            csrs[CSR_MISA][0] <= 1; // Atomic extension
+    always_ff @(posedge clk) begin
+        mcycle <= mcycle + 1;
 
+        minstret <= minstret + inst_retire;
+        
+        if (reset) begin
+            { mstatus, sstatus, medeleg, mideleg, mie, mip_sw, mtvec, stvec, mcounteren } <= 0;
+            { mscratch, sscratch, mepc, sepc, mcause, scause, mtval, stval, satp } <= 0;
+            { mcycle, minstret } <= 0;
 
             current_mode <= PRIV_M;
         end
         else if (valid && is_csr) begin
-            
-            if (addr == CSR_MISA || addr == CSR_MCOUNTINHIBIT || addr == CSR_SCOUNTEREN ||
-                (addr >= CSR_MHPMCOUNTER3 && addr <= CSR_MHPMCOUNTER31) || (addr >= CSR_MHPMEVENT3 && addr <= CSR_MHPMEVENT31)) begin
-                // do nothing
-            end
-            else if (csr_rw) begin
-                csrs[addr] <= val;
-            end
-            else if (csr_rs) begin
-                csrs[addr] <= csrs[addr] | val;
-            end
-            else begin // This is the condition for csr_rc.
-                csrs[addr] <= csrs[addr] & (~val);
-            end
+            case (addr) inside
+                // sie/sip are views of mie/mip restricted to delegated interrupts
+                // (of sip, only SSIP is writable)
+                CSR_SIE:        mie    <= (mie    & ~s_view_mask) | (s_view_new & s_view_mask);
+                CSR_SIP:        mip_sw <= (mip_sw & ~s_view_mask) | (s_view_new & s_view_mask);
+
+                CSR_SSTATUS:    sstatus  <= csr_new;
+                CSR_STVEC:      stvec    <= csr_new;
+                CSR_SSCRATCH:   sscratch <= csr_new;
+                CSR_SEPC:       sepc     <= csr_new;
+                CSR_SCAUSE:     scause   <= csr_new;
+                CSR_STVAL:      stval    <= csr_new;
+                CSR_SATP:       satp     <= csr_new;
+
+                CSR_MSTATUS:    mstatus    <= csr_new;
+                CSR_MEDELEG:    medeleg    <= csr_new;
+                CSR_MIDELEG:    mideleg    <= csr_new;
+                CSR_MIE:        mie        <= csr_new;
+                CSR_MTVEC:      mtvec      <= csr_new;
+                CSR_MCOUNTEREN: mcounteren <= csr_new;
+                CSR_MSCRATCH:   mscratch   <= csr_new;
+                CSR_MEPC:       mepc       <= csr_new;
+                CSR_MCAUSE:     mcause     <= csr_new;
+                CSR_MTVAL:      mtval      <= csr_new;
+                CSR_MIP:        mip_sw     <= csr_new;
+                CSR_MCYCLE:     mcycle     <= csr_new;
+                CSR_MINSTRET:   minstret   <= csr_new;
+
+                default: ; // MISA, scounteren, the hpm counters/events, and read-only CSRs ignore writes
+            endcase
         
-            csrs[CSR_MSTATUS][4] <= 0; // UPIE hardwired to 0
-            csrs[CSR_MSTATUS][0] <= 0; // UIE hardwired to 0
+            mstatus[4] <= 0; // UPIE hardwired to 0
+            mstatus[0] <= 0; // UIE hardwired to 0
         end
 
         if (trap_en) begin
             if (trap_privilege_mode == PRIV_S) begin
-                csrs[CSR_SEPC] <= trap_pc;
-                csrs[CSR_SSTATUS][8] <= 1; // set sstatus.(spp=8) to 0 if trap originated from user mode, 1 otherwise.
-                csrs[CSR_SSTATUS][5] <= csrs[CSR_SSTATUS][1]; // set sstatus.(spie=5) to sstatus.(sie=1)
-                csrs[CSR_SSTATUS][1] <= 0; // set sstatus.(sie=1) = 0
+                sepc <= trap_pc;
+                sstatus[8] <= 1; // set sstatus.(spp=8) to 0 if trap originated from user mode, 1 otherwise.
+                sstatus[5] <= sstatus[1]; // set sstatus.(spie=5) to sstatus.(sie=1)
+                sstatus[1] <= 0; // set sstatus.(sie=1) = 0
                 
-                csrs[CSR_SCAUSE] <= trap_cause;
-                csrs[CSR_STVAL] <= trap_mtval;
+                scause <= trap_cause;
+                stval <= trap_mtval;
             end
             else if (trap_privilege_mode == PRIV_M) begin
-                csrs[CSR_MEPC] <= trap_pc;
-                csrs[CSR_MSTATUS][12:11] <= current_mode; // set mstatus.(mpp=12:11) to privilege mode before interrupt
-                csrs[CSR_MSTATUS][7] <= csrs[CSR_MSTATUS][3]; // set mstatus.(mpie=7) to mstatus.(mie=3)
-                csrs[CSR_MSTATUS][3] <= 0; // set mstatus.(mie=3) = 0
+                mepc <= trap_pc;
+                mstatus[12:11] <= current_mode; // set mstatus.(mpp=12:11) to privilege mode before interrupt
+                mstatus[7] <= mstatus[3]; // set mstatus.(mpie=7) to mstatus.(mie=3)
+                mstatus[3] <= 0; // set mstatus.(mie=3) = 0
                 
-                csrs[CSR_MCAUSE] <= trap_cause;
-                csrs[CSR_MTVAL] <= trap_mtval;
+                mcause <= trap_cause;
+                mtval <= trap_mtval;
             end
 
             // New privilege mode is M by default on trap (check medeleg and mideleg to delegate)
@@ -157,22 +255,22 @@ module Privilege_System
         if (trap_is_ret) begin
             if (trap_ret_from_priv == PRIV_M) begin
                 // must write mepc to pc register. We already do this but maybe refactor the code to do it here
-                csrs[CSR_MSTATUS][3] <= csrs[CSR_MSTATUS][7]; // set mstatus.(mie=3) to mstatus.(mpie=7)
-                csrs[CSR_MSTATUS][7] <= 1; // set mstatus.(mpie=7) to 1
-                current_mode <= csrs[CSR_MSTATUS][12:11]; // output previous privilege (mstatus.(mpp=12:11))
-                csrs[CSR_MSTATUS][12:11] <= PRIV_M; // Set mstatus.(mpp=12:11) to U (or M if user-mode not supported)
+                mstatus[3] <= mstatus[7]; // set mstatus.(mie=3) to mstatus.(mpie=7)
+                mstatus[7] <= 1; // set mstatus.(mpie=7) to 1
+                current_mode <= mstatus[12:11]; // output previous privilege (mstatus.(mpp=12:11))
+                mstatus[12:11] <= PRIV_M; // Set mstatus.(mpp=12:11) to U (or M if user-mode not supported)
             end
             else if (trap_ret_from_priv == PRIV_S) begin
                 // must write sepc to pc register.
-                csrs[CSR_SSTATUS][1] <= csrs[CSR_SSTATUS][5]; // set sstatus.(sie=1) to sstatus.(spie=5)
-                csrs[CSR_SSTATUS][5] <= 1; // set sstatus.(spie=5) to 1
+                sstatus[1] <= sstatus[5]; // set sstatus.(sie=1) to sstatus.(spie=5)
+                sstatus[5] <= 1; // set sstatus.(spie=5) to 1
                 
-                if (csrs[CSR_SSTATUS][8] == 1) // output previous privilege (sstatus.(spp=8))
+                if (sstatus[8] == 1) // output previous privilege (sstatus.(spp=8))
                     current_mode <= PRIV_S;
                 else
                     current_mode <= PRIV_U;
                 
-                csrs[CSR_SSTATUS][8] <= 0; // Set sstatus.(spp=8) 0
+                sstatus[8] <= 0; // Set sstatus.(spp=8) 0
             end
             else if (trap_ret_from_priv == PRIV_U) begin
                 $display("Error, we do not support user mode so we shouldn't have uret.");
@@ -180,7 +278,13 @@ module Privilege_System
         end
     end
 
-    logic trap_code;
+    // Value an sie/sip write would produce, and which bits of mie/mip it may touch
+    logic [REG_WIDTH-1:0] s_view_mask;
+    logic [REG_WIDTH-1:0] s_view_new;
+    assign s_view_mask = mideleg & ((addr == CSR_SIP) ? 64'h2 : ~64'h0);
+    assign s_view_new  = csr_rw ? val : csr_rs ? (csr_result | val) : (csr_result & ~val);
+
+    logic [5:0] trap_code;
     assign trap_code = trap_cause[5:0];
 
     always_comb begin
@@ -189,7 +293,8 @@ module Privilege_System
         if (trap_en) begin
             jump_trap_handler = 1;
             
-            if (csrs[CSR_MEDELEG][trap_code] == 1 || csrs[CSR_MIDELEG][trap_code] == 1)
+            // Traps are never delegated away from M mode
+            if (current_mode != PRIV_M && (is_interrupt ? mideleg[trap_code] : medeleg[trap_code]))
                 trap_privilege_mode = PRIV_S;
             else
                 trap_privilege_mode = PRIV_M;
@@ -198,31 +303,31 @@ module Privilege_System
             jump_trap_handler = 0;
 
         if (trap_privilege_mode == PRIV_M) begin
-            if (csrs[CSR_MTVEC][1:0] == 0) begin        // Direct
-                handler_addr = { csrs[CSR_MTVEC][63:2], 2'b00 };
+            if (mtvec[1:0] == 0) begin        // Direct
+                handler_addr = { mtvec[63:2], 2'b00 };
             end
-            else if (csrs[CSR_MTVEC][1:0] == 1) begin   // Vectored
+            else if (mtvec[1:0] == 1) begin   // Vectored
                 if (is_interrupt == 0)
-                    handler_addr = { csrs[CSR_MTVEC][63:2], 2'b00 };
+                    handler_addr = { mtvec[63:2], 2'b00 };
                 else
-                    handler_addr = { csrs[CSR_MTVEC][63:2], 2'b00 } + ( { 1'b0, csrs[CSR_MCAUSE][62:0] } << 2);
+                    handler_addr = { mtvec[63:2], 2'b00 } + ( { 1'b0, trap_cause[62:0] } << 2);
             end
             else begin
-                $display("CSR MTVEC mode is an invalid value: 0x%x", csrs[CSR_MTVEC][1:0]);
+                $display("CSR MTVEC mode is an invalid value: 0x%x", mtvec[1:0]);
             end
         end
         else if (trap_privilege_mode == PRIV_S) begin
-            if (csrs[CSR_STVEC][1:0] == 0) begin        // Direct
-                handler_addr = { csrs[CSR_STVEC][63:2], 2'b00 };
+            if (stvec[1:0] == 0) begin        // Direct
+                handler_addr = { stvec[63:2], 2'b00 };
             end
-            else if (csrs[CSR_STVEC][1:0] == 1) begin   // Vectored
+            else if (stvec[1:0] == 1) begin   // Vectored
                 if (is_interrupt == 0)
-                    handler_addr = { csrs[CSR_STVEC][63:2], 2'b00 };
+                    handler_addr = { stvec[63:2], 2'b00 };
                 else
-                    handler_addr = { csrs[CSR_STVEC][63:2], 2'b00 } + ( { 1'b0, csrs[CSR_SCAUSE][62:0] } << 2);
+                    handler_addr = { stvec[63:2], 2'b00 } + ( { 1'b0, trap_cause[62:0] } << 2);
             end
             else begin
-                $display("CSR STVEC mode is an invalid value: 0x%x", csrs[CSR_STVEC][1:0]);
+                $display("CSR STVEC mode is an invalid value: 0x%x", stvec[1:0]);
             end
         end
         else $display("Trying to execute trap handler in an invalid privilege mode: %x", trap_privilege_mode);
@@ -232,13 +337,10 @@ module Privilege_System
         is_xret = trap_is_ret;
         if (trap_is_ret) begin
             if (trap_ret_from_priv == PRIV_M) begin
-                epc_addr = csrs[CSR_MEPC];
+                epc_addr = mepc;
             end
             else if (trap_ret_from_priv == PRIV_S) begin
-                epc_addr = csrs[CSR_SEPC];
-            end
-            else if (trap_ret_from_priv == PRIV_U) begin
-                epc_addr = csrs[CSR_UEPC];
+                epc_addr = sepc;
             end
             else begin
                 epc_addr = 0;
@@ -11,8 +11,18 @@ module RegFile
     input [63:0] wb_data,
     input wb_en,
 
+    // Second read/write ports, for the second op of a dual-issue pair.
+    // wb2 is the younger op, so it wins if both write the same reg
+    input [4:0] read_addr3,
+    input [4:0] read_addr4,
+    input [4:0] wb_addr2,
+    input [63:0] wb_data2,
+    input wb_en2,
+
     output [63:0] out1,
     output [63:0] out2,
+    output [63:0] out3,
+    output [63:0] out4,
 
     // For ecall
     output [63:0] a0,
@@ -30,6 +40,8 @@ module RegFile
 
     assign out1 = read_addr1 != 5'h00 ? regs[read_addr1] : 64'h0000_0000_0000_0000;
     assign out2 = read_addr2 != 5'h00 ? regs[read_addr2] : 64'h0000_0000_0000_0000;
+    assign out3 = read_addr3 != 5'h00 ? regs[read_addr3] : 64'h0000_0000_0000_0000;
+    assign out4 = read_addr4 != 5'h00 ? regs[read_addr4] : 64'h0000_0000_0000_0000;
 
     // For ecall
     assign a0 = regs[A0];
@@ -49,11 +61,16 @@ module RegFile
             regs[SP] <= stackptr;
             regs[A1] <= stackptr + 64'h0_8000_0000;
         end
-        else if (wb_en)
-            if (wb_addr == 0)
-                regs[wb_addr] <= 0; // not actually needed, but it makes debugging a little cleaner
-            else
-                regs[wb_addr] <= wb_data;
+        else begin
+            if (wb_en)
+                if (wb_addr == 0)
+                    regs[wb_addr] <= 0; // not actually needed, but it makes debugging a little cleaner
+                else
+                    regs[wb_addr] <= wb_data;
+
+            if (wb_en2 && wb_addr2 != 0)
+                regs[wb_addr2] <= wb_data2;
+        end
     end
 
 endmodule
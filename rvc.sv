@@ -0,0 +1,147 @@
+`ifndef RVC
+`define RVC
+
+// =============================================================
+//        RVC: expands a 16-bit compressed op into its 32-bit equivalent
+//
+// Done in IF as ops are cut out of the fetched word, so the decoder and
+// everything after it only ever sees 32-bit ops (plus a flag saying the op
+// was 2 bytes long, for pc+2 / link addresses).
+//
+// RV64C without the floating point loads/stores (we have no F/D).  Reserved
+// and unsupported encodings expand to 0, which is illegal as a 32-bit op too.
+
+function automatic logic [31:0] rvc_expand(input logic [15:0] c);
+    logic [4:0]  rd;   // full-size register fields (also rs1 where rd is both)
+    logic [4:0]  rs2;
+    logic [4:0]  rdp;  // 3-bit register fields, x8-x15
+    logic [4:0]  rs1p;
+    logic [4:0]  rs2p;
+    logic [11:0] imm6;   // c[12|6:2], sign-extended (ADDI, LI, ANDI, ...)
+    logic [11:0] imm_ls; // scaled load/store offsets, zero-extended
+    logic [20:0] imm_j;
+    logic [12:0] imm_b;
+
+    rd   = c[11:7];
+    rs2  = c[6:2];
+    rdp  = {2'b01, c[4:2]};
+    rs1p = {2'b01, c[9:7]};
+    rs2p = {2'b01, c[4:2]};
+    imm6 = {{7{c[12]}}, c[6:2]};
+    imm_j = {{10{c[12]}}, c[8], c[10:9], c[6], c[7], c[2], c[11], c[5:3], 1'b0};
+    imm_b = {{5{c[12]}}, c[6:5], c[2], c[11:10], c[4:3], 1'b0};
+
+    rvc_expand = 0;
+    case (c[1:0])
+        2'b00: case (c[15:13])
+            3'b000: begin // C.ADDI4SPN
+                imm_ls = {2'b0, c[10:7], c[12:11], c[5], c[6], 2'b00};
+                if (imm_ls != 0)
+                    rvc_expand = {imm_ls, 5'd2, F3OP_ADD_SUB, rdp, OP_OP_IMM};
+            end
+            3'b010: begin // C.LW
+                imm_ls = {5'b0, c[5], c[12:10], c[6], 2'b00};
+                rvc_expand = {imm_ls, rs1p, F3LS_W, rdp, OP_LOAD};
+            end
+            3'b011: begin // C.LD
+                imm_ls = {4'b0, c[6:5], c[12:10], 3'b000};
+                rvc_expand = {imm_ls, rs1p, F3LS_D, rdp, OP_LOAD};
+            end
+            3'b110: begin // C.SW
+                imm_ls = {5'b0, c[5], c[12:10], c[6], 2'b00};
+                rvc_expand = {imm_ls[11:5], rs2p, rs1p, F3LS_W, imm_ls[4:0], OP_STORE};
+            end
+            3'b111: begin // C.SD
+                imm_ls = {4'b0, c[6:5], c[12:10], 3'b000};
+                rvc_expand = {imm_ls[11:5], rs2p, rs1p, F3LS_D, imm_ls[4:0], OP_STORE};
+            end
+            default: ; // C.FLD, C.FSD, reserved
+        endcase
+
+        2'b01: case (c[15:13])
+            3'b000: // C.ADDI (C.NOP)
+                rvc_expand = {imm6, rd, F3OP_ADD_SUB, rd, OP_OP_IMM};
+            3'b001: // C.ADDIW
+                if (rd != 0)
+                    rvc_expand = {imm6, rd, F3OP_ADD_SUB, rd, OP_IMM_32};
+            3'b010: // C.LI
+                rvc_expand = {imm6, 5'd0, F3OP_ADD_SUB, rd, OP_OP_IMM};
+            3'b011:
+                if (rd == 2) begin // C.ADDI16SP
+                    if (imm6 != 0)
+                        rvc_expand = {{2{c[12]}}, c[12], c[4:3], c[5], c[2], c[6], 4'b0000,
+                                      5'd2, F3OP_ADD_SUB, 5'd2, OP_OP_IMM};
+                end else if (imm6 != 0) // C.LUI
+                    rvc_expand = {{14{c[12]}}, c[12], c[6:2], rd, OP_LUI};
+            3'b100: case (c[11:10])
+                2'b00: // C.SRLI
+                    rvc_expand = {6'b000000, c[12], c[6:2], rs1p, F3OP_SRX, rs1p, OP_OP_IMM};
+                2'b01: // C.SRAI
+                    rvc_expand = {6'b010000, c[12], c[6:2], rs1p, F3OP_SRX, rs1p, OP_OP_IMM};
+                2'b10: // C.ANDI
+                    rvc_expand = {imm6, rs1p, F3OP_AND, rs1p, OP_OP_IMM};
+                2'b11:
+                    if (!c[12]) case (c[6:5])
+                        2'b00: rvc_expand = {7'b0100000, rs2p, rs1p, F3OP_ADD_SUB, rs1p, OP_OP}; // C.SUB
+                        2'b01: rvc_expand = {7'b0000000, rs2p, rs1p, F3OP_XOR,     rs1p, OP_OP}; // C.XOR
+                        2'b10: rvc_expand = {7'b0000000, rs2p, rs1p, F3OP_OR,      rs1p, OP_OP}; // C.OR
+                        2'b11: rvc_expand = {7'b0000000, rs2p, rs1p, F3OP_AND,     rs1p, OP_OP}; // C.AND
+                    endcase
+                    else case (c[6:5])
+                        2'b00: rvc_expand = {7'b0100000, rs2p, rs1p, F3OP_ADD_SUB, rs1p, OP_OP_32}; // C.SUBW
+                        2'b01: rvc_expand = {7'b0000000, rs2p, rs1p, F3OP_ADD_SUB, rs1p, OP_OP_32}; // C.ADDW
+                        default: ;
+                    endcase
+            endcase
+            3'b101: // C.J
+                rvc_expand = {imm_j[20], imm_j[10:1], imm_j[11], imm_j[19:12], 5'd0, OP_JAL};
+            3'b110: // C.BEQZ
+                rvc_expand = {imm_b[12], imm_b[10:5], 5'd0, rs1p, F3B_BEQ, imm_b[4:1], imm_b[11], OP_BRANCH};
+            3'b111: // C.BNEZ
+                rvc_expand = {imm_b[12], imm_b[10:5], 5'd0, rs1p, F3B_BNE, imm_b[4:1], imm_b[11], OP_BRANCH};
+        endcase
+
+        2'b10: case (c[15:13])
+            3'b000: // C.SLLI
+                rvc_expand = {6'b000000, c[12], c[6:2], rd, F3OP_SLL, rd, OP_OP_IMM};
+            3'b010: // C.LWSP
+                if (rd != 0) begin
+                    imm_ls = {4'b0, c[3:2], c[12], c[6:4], 2'b00};
+                    rvc_expand = {imm_ls, 5'd2, F3LS_W, rd, OP_LOAD};
+                end
+            3'b011: // C.LDSP
+                if (rd != 0) begin
+                    imm_ls = {3'b0, c[4:2], c[12], c[6:5], 3'b000};
+                    rvc_expand = {imm_ls, 5'd2, F3LS_D, rd, OP_LOAD};
+                end
+            3'b100:
+                if (!c[12]) begin
+                    if (rs2 == 0) begin // C.JR
+                        if (rd != 0)
+                            rvc_expand = {12'b0, rd, 3'b000, 5'd0, OP_JALR};
+                    end else // C.MV
+                        rvc_expand = {7'b0000000, rs2, 5'd0, F3OP_ADD_SUB, rd, OP_OP};
+                end else begin
+                    if (rd == 0 && rs2 == 0) // C.EBREAK
+                        rvc_expand = 32'h0010_0073;
+                    else if (rs2 == 0) // C.JALR
+                        rvc_expand = {12'b0, rd, 3'b000, 5'd1, OP_JALR};
+                    else // C.ADD
+                        rvc_expand = {7'b0000000, rs2, rd, F3OP_ADD_SUB, rd, OP_OP};
+                end
+            3'b110: begin // C.SWSP
+                imm_ls = {4'b0, c[8:7], c[12:9], 2'b00};
+                rvc_expand = {imm_ls[11:5], rs2, 5'd2, F3LS_W, imm_ls[4:0], OP_STORE};
+            end
+            3'b111: begin // C.SDSP
+                imm_ls = {3'b0, c[9:7], c[12:10], 3'b000};
+                rvc_expand = {imm_ls[11:5], rs2, 5'd2, F3LS_D, imm_ls[4:0], OP_STORE};
+            end
+            default: ; // C.FLDSP, C.FSDSP
+        endcase
+
+        default: ; // 2'b11 is a 32-bit op, not ours to expand
+    endcase
+endfunction
+
+`endif
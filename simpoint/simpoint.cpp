@@ -0,0 +1,287 @@
+// Picks simulation points from the basic-block vectors of a run with
+// BBV=<file> (see ../bbv.h), the way SimPoint does: project the vectors down
+// to a few dimensions, k-means them for k = 1..maxk, take the smallest k whose
+// BIC score is within 90% of the best, and pick the interval closest to each
+// cluster's centre to stand in for the whole cluster.
+//
+// usage: simpoint [-k maxk] [-d dims] [-s seed] [-o prefix] bbvfile
+//
+// Prints each simulation point: its interval, the op count it starts at, and
+// its weight (the fraction of all ops its cluster covers).  With -o, also
+// writes <prefix>.simpoints and <prefix>.weights in SimPoint's own format.
+//
+// If <bbvfile>.intervals is there (it is, next to a BBV run), the CPI of
+// each chosen interval is known, and their weighted sum is compared against
+// the CPI of the whole run: how far off simulating just those intervals in
+// detail would be, give or take warmup.
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <iomanip>
+#include <map>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+typedef vector<double> Point;
+
+struct Interval {
+    map<uint64_t, uint64_t> blocks; // block id -> ops
+    uint64_t ops;
+};
+
+struct Clustering {
+    int k;
+    vector<int> assignment; // interval -> cluster
+    vector<Point> centres;
+    double distortion;      // sum of squared distances to the centres
+    double bic;
+};
+
+static double distance2(const Point& a, const Point& b) {
+    double sum = 0;
+    for (size_t i = 0; i < a.size(); ++i) sum += (a[i] - b[i]) * (a[i] - b[i]);
+    return sum;
+}
+
+static vector<Interval> read_bbv(const char* filename) {
+    ifstream in(filename);
+    if (!in) {
+        cerr << "Couldn't open " << filename << endl;
+        exit(-1);
+    }
+    vector<Interval> intervals;
+    string line;
+    while (getline(in, line)) {
+        if (line.empty() || line[0] != 'T') continue;
+        Interval interval;
+        interval.ops = 0;
+        // T:id:count :id:count ...
+        const char* p = line.c_str() + 1;
+        while ((p = strchr(p, ':'))) {
+            char* end;
+            uint64_t id = strtoull(p + 1, &end, 10);
+            if (*end != ':') break;
+            uint64_t ops = strtoull(end + 1, &end, 10);
+            interval.blocks[id] += ops;
+            interval.ops += ops;
+            p = end;
+        }
+        intervals.push_back(interval);
+    }
+    return intervals;
+}
+
+// Random linear projection of each interval's block frequencies (ops in the
+// block / ops in the interval) down to dims dimensions
+static vector<Point> project(const vector<Interval>& intervals, int dims, unsigned seed) {
+    map<uint64_t, Point> directions;
+    mt19937 rng(seed);
+    uniform_real_distribution<double> uniform(-1, 1);
+    vector<Point> points;
+    for (size_t i = 0; i < intervals.size(); ++i) {
+        Point point(dims, 0);
+        for (map<uint64_t, uint64_t>::const_iterator it = intervals[i].blocks.begin(); it != intervals[i].blocks.end(); ++it) {
+            Point& direction = directions[it->first];
+            if (direction.empty())
+                for (int d = 0; d < dims; ++d) direction.push_back(uniform(rng));
+            const double frequency = (double)it->second / intervals[i].ops;
+            for (int d = 0; d < dims; ++d) point[d] += frequency * direction[d];
+        }
+        points.push_back(point);
+    }
+    return points;
+}
+
+// Lloyd's algorithm from k-means++ seeds, best of a few tries
+static Clustering kmeans(const vector<Point>& points, int k, mt19937& rng) {
+    const int TRIES = 5, ITERATIONS = 100;
+    const size_t n = points.size();
+    Clustering best;
+    best.distortion = INFINITY;
+
+    for (int attempt = 0; attempt < TRIES; ++attempt) {
+        Clustering c;
+        c.k = k;
+        c.assignment.assign(n, -1);
+        c.centres.push_back(points[uniform_int_distribution<size_t>(0, n-1)(rng)]);
+        vector<double> nearest(n);
+        while ((int)c.centres.size() < k) {
+            double total = 0;
+            for (size_t i = 0; i < n; ++i) {
+                nearest[i] = INFINITY;
+                for (size_t j = 0; j < c.centres.size(); ++j) nearest[i] = min(nearest[i], distance2(points[i], c.centres[j]));
+                total += nearest[i];
+            }
+            double pick = uniform_real_distribution<double>(0, total)(rng);
+            size_t i = 0;
+            while (i < n-1 && (pick -= nearest[i]) > 0) ++i;
+            c.centres.push_back(points[i]);
+        }
+
+        for (int iteration = 0; iteration < ITERATIONS; ++iteration) {
+            bool changed = false;
+            for (size_t i = 0; i < n; ++i) {
+                int closest = 0;
+                for (int j = 1; j < k; ++j)
+                    if (distance2(points[i], c.centres[j]) < distance2(points[i], c.centres[closest])) closest = j;
+                changed |= c.assignment[i] != closest;
+                c.assignment[i] = closest;
+            }
+            if (!changed) break;
+
+            vector<int> members(k, 0);
+            for (int j = 0; j < k; ++j) c.centres[j].assign(points[0].size(), 0);
+            for (size_t i = 0; i < n; ++i) {
+                ++members[c.assignment[i]];
+                for (size_t d = 0; d < points[i].size(); ++d) c.centres[c.assignment[i]][d] += points[i][d];
+            }
+            for (int j = 0; j < k; ++j)
+                for (size_t d = 0; d < c.centres[j].size() && members[j]; ++d) c.centres[j][d] /= members[j];
+        }
+
+        c.distortion = 0;
+        for (size_t i = 0; i < n; ++i) c.distortion += distance2(points[i], c.centres[c.assignment[i]]);
+        if (c.distortion < best.distortion) best = c;
+    }
+    return best;
+}
+
+// Bayesian information criterion of a clustering under a spherical Gaussian
+// model (Pelleg and Moore's X-means, as SimPoint scores it)
+static double bic(const vector<Point>& points, const Clustering& c) {
+    const double R = points.size(), M = points[0].size(), K = c.k;
+    if (R <= K) return -INFINITY;
+    const double variance = max(c.distortion / (R - K), 1e-300);
+    vector<int> members(c.k, 0);
+    for (size_t i = 0; i < points.size(); ++i) ++members[c.assignment[i]];
+
+    double likelihood = 0;
+    for (int j = 0; j < c.k; ++j) {
+        const double n = members[j];
+        if (!n) continue;
+        likelihood += n * log(n) - n * log(R) - n * M / 2 * log(2 * M_PI * variance) - (n - K) / 2;
+    }
+    const double parameters = (K - 1) + M * K + 1;
+    return likelihood - parameters / 2 * log(R);
+}
+
+int main(int argc, char* argv[]) {
+    int maxk = 10, dims = 15;
+    unsigned seed = 493575226; // any fixed seed, so reruns pick the same points
+    string prefix;
+    int opt;
+    while ((opt = getopt(argc, argv, "k:d:s:o:")) != -1) {
+        switch (opt) {
+            case 'k': maxk = atoi(optarg); break;
+            case 'd': dims = atoi(optarg); break;
+            case 's': seed = strtoul(optarg, NULL, 0); break;
+            case 'o': prefix = optarg; break;
+            default:
+                cerr << "usage: simpoint [-k maxk] [-d dims] [-s seed] [-o prefix] bbvfile" << endl;
+                exit(-1);
+        }
+    }
+    if (optind != argc - 1 || maxk < 1 || dims < 1) {
+        cerr << "usage: simpoint [-k maxk] [-d dims] [-s seed] [-o prefix] bbvfile" << endl;
+        exit(-1);
+    }
+    const char* bbvfile = argv[optind];
+
+    vector<Interval> intervals = read_bbv(bbvfile);
+    if (intervals.empty()) {
+        cerr << "No basic-block vectors in " << bbvfile << endl;
+        exit(-1);
+    }
+    uint64_t total_ops = 0;
+    for (size_t i = 0; i < intervals.size(); ++i) total_ops += intervals[i].ops;
+
+    // ==== Cluster for each k, then take the smallest k that scores well enough
+    vector<Point> points = project(intervals, dims, seed);
+    mt19937 rng(seed);
+    vector<Clustering> clusterings;
+    for (int k = 1; k <= maxk && k <= (int)intervals.size(); ++k) {
+        clusterings.push_back(kmeans(points, k, rng));
+        clusterings.back().bic = bic(points, clusterings.back());
+    }
+    double lowest = INFINITY, highest = -INFINITY;
+    for (size_t i = 0; i < clusterings.size(); ++i) {
+        if (!isfinite(clusterings[i].bic)) continue;
+        lowest = min(lowest, clusterings[i].bic);
+        highest = max(highest, clusterings[i].bic);
+    }
+    size_t chosen = 0;
+    while (chosen + 1 < clusterings.size() &&
+           !(isfinite(clusterings[chosen].bic) && clusterings[chosen].bic >= lowest + 0.9 * (highest - lowest)))
+        ++chosen;
+    const Clustering& c = clusterings[chosen];
+
+    // ==== One simulation point per cluster: the interval nearest its centre
+    vector<int> point_of(c.k, -1);
+    vector<uint64_t> cluster_ops(c.k, 0);
+    for (size_t i = 0; i < intervals.size(); ++i) {
+        const int j = c.assignment[i];
+        cluster_ops[j] += intervals[i].ops;
+        if (point_of[j] < 0 || distance2(points[i], c.centres[j]) < distance2(points[point_of[j]], c.centres[j]))
+            point_of[j] = i;
+    }
+    vector<uint64_t> start_op(intervals.size(), 0);
+    for (size_t i = 1; i < intervals.size(); ++i) start_op[i] = start_op[i-1] + intervals[i-1].ops;
+
+    // Measured ops and cycles per interval, from the run that wrote the vectors
+    vector<pair<uint64_t, uint64_t> > measured;
+    ifstream cycles((string(bbvfile) + ".intervals").c_str());
+    uint64_t ops, cycle_count;
+    while (cycles >> ops >> cycle_count) measured.push_back(make_pair(ops, cycle_count));
+    const bool have_cpi = measured.size() == intervals.size();
+
+    cout << intervals.size() << " intervals, " << total_ops << " ops; picked k=" << c.k << " of 1.." << clusterings.size()
+         << " by BIC" << endl;
+    cout << "cluster  interval        start op    weight" << (have_cpi ? "     CPI" : "") << endl;
+    double estimated_cpi = 0;
+    for (int j = 0; j < c.k; ++j) {
+        if (point_of[j] < 0) continue;
+        const double weight = (double)cluster_ops[j] / total_ops;
+        cout << setw(7) << j << setw(10) << point_of[j] << setw(16) << start_op[point_of[j]]
+             << setw(10) << fixed << setprecision(4) << weight;
+        if (have_cpi) {
+            const double cpi = (double)measured[point_of[j]].second / measured[point_of[j]].first;
+            estimated_cpi += weight * cpi;
+            cout << setw(8) << setprecision(3) << cpi;
+        }
+        cout << endl;
+    }
+
+    if (have_cpi) {
+        uint64_t all_ops = 0, all_cycles = 0;
+        for (size_t i = 0; i < measured.size(); ++i) {
+            all_ops += measured[i].first;
+            all_cycles += measured[i].second;
+        }
+        const double actual_cpi = (double)all_cycles / all_ops;
+        cout << "Estimated CPI " << setprecision(3) << estimated_cpi << ", whole run " << actual_cpi << " ("
+             << showpos << setprecision(2) << 100 * (estimated_cpi - actual_cpi) / actual_cpi << noshowpos << "%)" << endl;
+    }
+
+    if (!prefix.empty()) {
+        ofstream simpoints((prefix + ".simpoints").c_str()), weights((prefix + ".weights").c_str());
+        for (int j = 0; j < c.k; ++j) {
+            if (point_of[j] < 0) continue;
+            simpoints << point_of[j] << " " << j << endl;
+            weights << setprecision(6) << (double)cluster_ops[j] / total_ops << " " << j << endl;
+        }
+        if (!simpoints || !weights) {
+            cerr << "Couldn't write " << prefix << ".simpoints / .weights" << endl;
+            exit(-1);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,182 @@
+`ifndef STORE_BUFFER
+`define STORE_BUFFER
+
+// FIFO of retired stores, sitting between the pipeline's D$ port and the D$.
+// MemorySystem pushes a store as soon as it is translated, so MEM doesn't wait
+// for write_done, and drains the oldest entry into the D$ whenever the pipeline
+// isn't using it.
+//
+// Each entry is one 64-byte line with a byte mask. A store to the same line as
+// the youngest entry merges into it instead of taking a new slot, so a memset
+// fills one entry per line. Merging only into the youngest entry keeps stores
+// to different lines reaching the D$ in program order.
+module Store_Buffer
+#(
+    DEPTH = 8,
+    LOG_DEPTH = 3
+)
+(
+    input clk,
+    input reset,
+
+    // === New stores (physical address)
+    input               push_en,
+    input        [63:0] push_addr,
+    input        [63:0] push_data,  // unshifted, in the low bytes (like D$ wdata)
+    input        [ 1:0] push_wlen,
+    output logic        push_ready, // room for the store (or it merges into the youngest entry)
+
+    // === Load lookup (physical address)
+    input        [63:0] ld_addr,
+    input        [ 1:0] ld_wlen,
+    output logic        ld_fwd,      // youngest buffered store to these bytes covers the whole load
+    output logic [63:0] ld_fwd_data, // whole doubleword, like D$ rdata
+    output logic        ld_conflict, // load partially overlaps buffered stores, must wait for drain
+
+    // === Snoops to a buffered line must wait until it has drained
+    input        [63:0] snoop_addr, // first line
+    input        [ 5:0] snoop_last, // last line, in snoop_addr's 4K page
+    output logic        snoop_hit,
+
+    // === Drain port (D$ in physical mode)
+    output logic        drain_valid,
+    output logic [63:0] drain_addr, // doubleword aligned
+    output logic [63:0] drain_data, // bytes already in position
+    output logic [ 7:0] drain_mask,
+    input               drain_done, // D$ has written the doubleword at drain_addr
+
+    output logic        empty
+);
+
+    logic [63:6]          sb_line [DEPTH];
+    logic [63:0]          sb_data [DEPTH][8];
+    logic [ 7:0]          sb_mask [DEPTH][8];
+    logic [LOG_DEPTH-1:0] head, tail;
+    logic [LOG_DEPTH:0]   count;
+
+    function automatic logic [7:0] byte_mask(input logic [2:0] offset, input logic [1:0] wlen);
+        case (wlen)
+            2'h0: byte_mask = 8'h01 << offset;
+            2'h1: byte_mask = 8'h03 << offset;
+            2'h2: byte_mask = 8'h0f << offset;
+            2'h3: byte_mask = 8'hff;
+        endcase
+    endfunction
+
+    assign empty = count == 0;
+
+
+    // ==== Push: merge into the youngest entry, or take a new one
+    logic [LOG_DEPTH-1:0] youngest;
+    logic                 push_merge;
+    logic [ 7:0]          push_bytes;
+    logic [63:0]          push_data_shifted;
+
+    assign youngest = tail - 1;
+    assign push_merge = !empty && sb_line[youngest] == push_addr[63:6];
+    assign push_ready = push_merge || count != DEPTH;
+    assign push_bytes = byte_mask(push_addr[2:0], push_wlen);
+    assign push_data_shifted = push_data << {push_addr[2:0], 3'b000};
+
+
+    // ==== Drain: lowest dirty doubleword of the oldest entry
+    logic [2:0] drain_dw;
+    logic       head_last_dw; // drain_dw is the only doubleword left in the head entry
+    integer dw;
+    always_comb begin
+        drain_dw = 0;
+        for (dw = 7; dw >= 0; dw = dw - 1)
+            if (sb_mask[head][dw] != 0)
+                drain_dw = dw[2:0];
+
+        head_last_dw = 1;
+        for (dw = 0; dw < 8; dw = dw + 1)
+            if (dw[2:0] != drain_dw && sb_mask[head][dw] != 0)
+                head_last_dw = 0;
+    end
+
+    assign drain_valid = !empty;
+    assign drain_addr  = {sb_line[head], drain_dw, 3'b000};
+    assign drain_data  = sb_data[head][drain_dw];
+    assign drain_mask  = sb_mask[head][drain_dw];
+
+    // A store merging into the head as it drains keeps it alive
+    logic pop;
+    assign pop = drain_done && head_last_dw && !(push_en && push_merge && youngest == head);
+
+
+    // ==== Load forwarding and snoop matching
+    logic [ 7:0]          ld_bytes;
+    logic                 ld_overlap;
+    logic [LOG_DEPTH-1:0] idx;
+    integer i;
+    always_comb begin
+        ld_bytes = byte_mask(ld_addr[2:0], ld_wlen);
+        ld_overlap = 0;
+        ld_fwd = 0;
+        ld_fwd_data = 0;
+        snoop_hit = 0;
+
+        // walk oldest to youngest, so the youngest overlapping store wins
+        for (i = 0; i < DEPTH; i = i + 1) begin
+            idx = head + i[LOG_DEPTH-1:0];
+            if (i < count) begin
+                if (sb_line[idx] == ld_addr[63:6] && (sb_mask[idx][ld_addr[5:3]] & ld_bytes) != 0) begin
+                    ld_overlap = 1;
+                    ld_fwd = (sb_mask[idx][ld_addr[5:3]] & ld_bytes) == ld_bytes;
+                    ld_fwd_data = sb_data[idx][ld_addr[5:3]];
+                end
+                if (sb_line[idx][63:12] == snoop_addr[63:12] && sb_line[idx][11:6] >= snoop_addr[11:6] && sb_line[idx][11:6] <= snoop_last)
+                    snoop_hit = 1;
+            end
+        end
+
+        ld_conflict = ld_overlap && !ld_fwd;
+    end
+
+
+    // ==== State
+    logic [LOG_DEPTH-1:0] push_slot;
+    logic                 push_new;
+    integer b, fdw;
+    assign push_slot = push_merge ? youngest : tail;
+    assign push_new  = push_en && push_ready && !push_merge;
+
+    always_ff @ (posedge clk) begin
+        if (reset) begin
+            head <= 0;
+            tail <= 0;
+            count <= 0;
+            sb_mask <= '{DEPTH{'{8{8'h00}}}};
+        end else begin
+            // Drained bytes are cleared before a merge in the same cycle sets its own
+            if (drain_done) begin
+                if (!drain_valid)
+                    $error("Store buffer: drain_done with nothing to drain");
+                sb_mask[head][drain_dw] <= 0;
+            end
+
+            if (push_en && push_ready) begin
+                if (push_new) begin
+                    sb_line[tail] <= push_addr[63:6];
+                    for (fdw = 0; fdw < 8; fdw = fdw + 1)
+                        sb_mask[tail][fdw] <= (fdw[2:0] == push_addr[5:3]) ? push_bytes : 8'h00;
+                end else if (drain_done && push_slot == head && push_addr[5:3] == drain_dw)
+                    sb_mask[push_slot][push_addr[5:3]] <= push_bytes;
+                else
+                    sb_mask[push_slot][push_addr[5:3]] <= sb_mask[push_slot][push_addr[5:3]] | push_bytes;
+
+                for (b = 0; b < 8; b = b + 1)
+                    if (push_bytes[b])
+                        sb_data[push_slot][push_addr[5:3]][8*b +: 8] <= push_data_shifted[8*b +: 8];
+            end
+
+            tail  <= tail + (push_new ? 1 : 0);
+            head  <= head + (pop ? 1 : 0);
+            count <= count + (push_new ? 1 : 0) - (pop ? 1 : 0);
+        end
+    end
+
+endmodule
+
+`endif
@@ -9,21 +9,36 @@
 #include <assert.h>
 #include <stdlib.h>
 #include <iostream>
+#include <fstream>
 #include <arpa/inet.h>
 #include <ncurses.h>
 #include <set>
+#include <signal.h>
+#include <errno.h>
 #include "system.h"
 #include "hardware.h"
+#include "axi_trace.h"
 #include "Vtop.h"
 
 #define STACK_PAGES     (100)
+#define FAULT_INVALIDATIONS (64*KILO) // PTE lines written by page faults between two posedges
 
 using namespace std;
 
 System* System::sys;
 
+// Host-side accesses through ram_virt to pages of the heap that have been
+// reserved (by brk/mmap) but not touched yet land here.  Anything else is a
+// real bug, so put the default handler back and let the access fault again.
+static void demand_paging_handler(int sig, siginfo_t* info, void* context) {
+    const char* addr = (const char*)info->si_addr;
+    System* sys = System::sys;
+    if (addr >= sys->ram_virt && addr < sys->ram_virt + sys->ramsize && sys->demand_fault(addr - sys->ram_virt)) return;
+    signal(SIGSEGV, SIG_DFL);
+}
+
 System::System(Vtop* top, uint64_t ramsize, const char* binaryfn, const int argc, char* argv[], int ps_per_clock)
-    : top(top), ps_per_clock(ps_per_clock), ramsize(ramsize), max_elf_addr(0), dram_offset(0), show_console(false), interrupts(0), w_count(0), ticks(0), ecall_brk(0), errno_addr(0ULL)
+    : top(top), ps_per_clock(ps_per_clock), ramsize(ramsize), phys_pages_allocated(0), max_elf_addr(0), dram_offset(0), show_console(false), interrupts(0), w_count(0), snoop_start(0), snoop_end(0), fault_invalidation_count(0), in_fault_handler(0), ticks(0), cycle(0), exit_code(0), idle_skipped_cycles(0), ecall_brk(0), errno_addr(0ULL), axi_trace(NULL), axi_trace_cycle(0), axi_trace_records(0), locality(NULL), pipeview(NULL), bbv(NULL)
 {
     sys = this;
 
@@ -35,16 +50,30 @@ System::System(Vtop* top, uint64_t ramsize, const char* binaryfn, const int argc
 
     assert(!full_system || !use_virtual_memory);
 
-    string ram_fn = string("/vtop-system-")+to_string(getpid());
-    ram_fd = shm_open(ram_fn.c_str(), O_RDWR|O_CREAT|O_EXCL, 0600);
-    assert(ram_fd != -1);
-    assert(shm_unlink(ram_fn.c_str()) == 0);
-    assert(ftruncate(ram_fd, ramsize) == 0);
-    ram = (char*)mmap(NULL, ramsize, PROT_READ|PROT_WRITE, MAP_SHARED, ram_fd, 0);
-    assert(ram != MAP_FAILED);
+    if (HARTS > 1 && !full_system) {
+        cerr << "HARTS=" << HARTS << " needs FULLSYSTEM=y, there is no multi-hart fake OS" << endl;
+        exit(-1);
+    }
+
+    char* IDLESKIP = getenv("IDLESKIP");
+    idle_skip = !IDLESKIP || (toupper(*IDLESKIP) != 'N');
+
+    char* HUGEPAGES = getenv("HUGEPAGES");
+    huge_pages = !HUGEPAGES ? HUGE_PAGES_NONE :
+                 (toupper(*HUGEPAGES) == 'Y' || toupper(*HUGEPAGES) == 'T') ? HUGE_PAGES_THP :
+                 (toupper(*HUGEPAGES) == 'H') ? HUGE_PAGES_HUGETLB : HUGE_PAGES_NONE;
+
+    map_ram();
+    phys_page_used.resize(ramsize/PAGE_SIZE);
     if (use_virtual_memory) {
       ram_virt = (char*)mmap(NULL, ramsize, PROT_NONE, MAP_ANONYMOUS|MAP_PRIVATE, -1, 0);
       assert(ram_virt != MAP_FAILED);
+      fault_invalidations.resize(FAULT_INVALIDATIONS);
+      struct sigaction sa;
+      memset(&sa, 0, sizeof(sa));
+      sa.sa_sigaction = demand_paging_handler;
+      sa.sa_flags = SA_SIGINFO;
+      assert(sigaction(SIGSEGV, &sa, NULL) == 0);
     } else {
       ram_virt = ram;
       if (full_system) dram_offset = DRAM_OFFSET;
@@ -82,12 +111,85 @@ System::System(Vtop* top, uint64_t ramsize, const char* binaryfn, const int argc
     DRAMSim::TransactionCompleteCB *write_cb = new DRAMSim::Callback<System, void, unsigned, uint64_t, uint64_t>(this, &System::dram_write_complete);
     dramsim->RegisterCallbacks(read_cb, write_cb, NULL);
     dramsim->setCPUClockSpeed(1000ULL*1000*1000*1000/ps_per_clock);
+
+    char* AXI_TRACE = getenv("AXI_TRACE");
+    if (AXI_TRACE && *AXI_TRACE) open_axi_trace(AXI_TRACE);
+
+    char* LOCALITY = getenv("LOCALITY");
+    if (LOCALITY && *LOCALITY) {
+        locality = new Locality(ramsize, dram_offset);
+        locality_file = LOCALITY;
+    }
+
+    // PIPEVIEW_WINDOW=<first>:<last> cycle since reset, either end may be left out
+    char* PIPEVIEW = getenv("PIPEVIEW");
+    if (PIPEVIEW && *PIPEVIEW) {
+        uint64_t first = 0, last = UINT64_MAX;
+        char* PIPEVIEW_WINDOW = getenv("PIPEVIEW_WINDOW");
+        if (PIPEVIEW_WINDOW && *PIPEVIEW_WINDOW) {
+            char* end;
+            first = strtoull(PIPEVIEW_WINDOW, &end, 0);
+            if (*end == ':' && end[1]) last = strtoull(end + 1, &end, 0);
+            if (*end || first > last) {
+                cerr << "PIPEVIEW_WINDOW should be <first>:<last>, got " << PIPEVIEW_WINDOW << endl;
+                exit(-1);
+            }
+        }
+        pipeview = new PipeView(PIPEVIEW, first, last);
+    }
+
+    // BBV_INTERVAL=<ops>, SimPoint's usual 100M by default
+    char* BBV = getenv("BBV");
+    if (BBV && *BBV) {
+        char* BBV_INTERVAL = getenv("BBV_INTERVAL");
+        uint64_t interval = (BBV_INTERVAL && *BBV_INTERVAL) ? strtoull(BBV_INTERVAL, NULL, 0) : 100*1000*1000;
+        if (!interval) {
+            cerr << "BBV_INTERVAL should be a number of ops, got " << BBV_INTERVAL << endl;
+            exit(-1);
+        }
+        bbv = new Bbv(BBV, interval);
+    }
+
+    host_start = std::chrono::steady_clock::now();
 }
 
 System::~System() {
+    uart_flush();
+
     assert(munmap(ram, ramsize) == 0);
     assert(!use_virtual_memory || munmap(ram_virt, ramsize) == 0);
-    assert(close(ram_fd) == 0);
+    assert(ram_fd == -1 || close(ram_fd) == 0);
+
+    const double host_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - host_start).count();
+    const uint64_t cycles = cycle - idle_skipped_cycles;
+    cerr << "Simulated " << std::dec << cycles << " cycles in " << host_seconds << "s of host time ("
+         << (uint64_t)(cycles / host_seconds / 1000) << " KHz)" << endl;
+
+    if (idle_skipped_cycles)
+        cerr << "Skipped " << std::dec << idle_skipped_cycles << " idle cycles while waiting in WFI" << endl;
+
+    if (axi_trace) {
+        assert(fclose(axi_trace) == 0);
+        cerr << "Recorded " << std::dec << axi_trace_records << " DRAM requests in the AXI trace" << endl;
+    }
+
+    if (locality) {
+        ofstream out(locality_file.c_str());
+        locality->report(out);
+        if (out) cerr << "Wrote the locality report to " << locality_file << endl;
+        else cerr << "Couldn't write the locality report to " << locality_file << endl;
+        delete locality;
+    }
+
+    if (pipeview) {
+        delete pipeview;
+        cerr << "Wrote the pipeline trace to " << getenv("PIPEVIEW") << endl;
+    }
+
+    if (bbv) {
+        delete bbv; // writes the last, partial interval
+        cerr << "Wrote basic-block vectors to " << getenv("BBV") << " (and per-interval cycles to " << getenv("BBV") << ".intervals)" << endl;
+    }
 
     if (show_console) {
         sleep(2);
@@ -95,6 +197,48 @@ System::~System() {
     }
 }
 
+// Guest ram is reserved, not committed: the host only backs the pages that
+// get touched, so a large RAM_SIZE costs nothing until it is used.  With
+// HAVETLB, pages of ram are also mapped into ram_virt, so it has to be a
+// shared memory file; otherwise plain anonymous memory will do.  HUGEPAGES=y
+// asks for transparent huge pages (for shared memory, that also needs
+// /sys/kernel/mm/transparent_hugepage/shmem_enabled set to advise), and
+// HUGEPAGES=hugetlb uses pages reserved in /proc/sys/vm/nr_hugepages.  Both
+// cut down on host TLB misses when the guest's working set is large.
+void System::map_ram() {
+    ram = (char*)MAP_FAILED;
+    ram_fd = -1;
+    if (use_virtual_memory) {
+        string ram_fn = string("/vtop-system-")+to_string(getpid());
+        ram_fd = shm_open(ram_fn.c_str(), O_RDWR|O_CREAT|O_EXCL, 0600);
+        assert(ram_fd != -1);
+        assert(shm_unlink(ram_fn.c_str()) == 0);
+        assert(ftruncate(ram_fd, ramsize) == 0);
+        if (huge_pages == HUGE_PAGES_HUGETLB) {
+            cerr << "HUGEPAGES=hugetlb is not supported with HAVETLB, using transparent huge pages instead" << endl;
+            huge_pages = HUGE_PAGES_THP;
+        }
+        ram = (char*)mmap(NULL, ramsize, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_NORESERVE, ram_fd, 0);
+    } else {
+        if (huge_pages == HUGE_PAGES_HUGETLB && ramsize % (2*MEGA)) {
+            cerr << "RAM_SIZE is not a multiple of 2MB, using transparent huge pages instead of hugetlb" << endl;
+            huge_pages = HUGE_PAGES_THP;
+        }
+        if (huge_pages == HUGE_PAGES_HUGETLB) {
+            ram = (char*)mmap(NULL, ramsize, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS|MAP_NORESERVE|MAP_HUGETLB, -1, 0);
+            if (ram == MAP_FAILED) {
+                cerr << "Could not map " << std::dec << ramsize/MEGA << "MB of hugetlb pages, using transparent huge pages instead" << endl;
+                huge_pages = HUGE_PAGES_THP;
+            }
+        }
+        if (ram == MAP_FAILED)
+            ram = (char*)mmap(NULL, ramsize, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS|MAP_NORESERVE, -1, 0);
+    }
+    assert(ram != MAP_FAILED);
+    if (huge_pages == HUGE_PAGES_THP && madvise(ram, ramsize, MADV_HUGEPAGE) != 0)
+        cerr << "madvise(MADV_HUGEPAGE) failed, ram will use regular pages" << endl;
+}
+
 void System::console() {
     show_console = true;
     if (show_console) {
@@ -106,26 +250,27 @@ void System::console() {
     }
 }
 
-void System::tick(int clk) {
+void System::posedge() {
 
     if (top->reset) {
         if (top->m_axi_arvalid || top->m_axi_awvalid)
             cerr << "Received a bus request during RESET.  Ignoring..." << endl;
         top->m_axi_awready = top->m_axi_wready = top->m_axi_arready = 1;
-        addr_to_tag.clear();
+        read_tags.clear();
+        write_tags.clear();
         r_queue.clear();
         resp_queue.clear();
         snoop_queue.clear();
         return;
     }
 
-    if (!clk) {
-        if (top->m_axi_rvalid && top->m_axi_rready) r_queue.pop_front();
-        if (top->m_axi_bvalid && top->m_axi_bready) resp_queue.pop_front();
-        if (top->m_axi_acvalid && top->m_axi_acready) snoop_queue.erase(snoop_queue.begin());
-        return;
-    }
+    for(sig_atomic_t i = 0; i < fault_invalidation_count; ++i) invalidate(fault_invalidations[i]);
+    fault_invalidation_count = 0;
+
+    skip_idle_cycles();
+    if (!file_syncs.empty() && snoop_queue.empty()) finish_file_syncs();
     rtc_tick(top);
+    if (full_system) virtio_tick(top);
 
     dramsim->update();    
 
@@ -147,14 +292,14 @@ void System::tick(int clk) {
             } else if (top->m_axi_arlen+1 != 8) {
                 cerr << "Read request with length != 8 (" << std::dec << top->m_axi_arlen << "+1)" << endl;
                 Verilated::gotFinish(true);
-            } else if (addr_to_tag.find(r_addr)!=addr_to_tag.end()) {
-                cerr << "Access for " << std::hex << r_addr << " already outstanding.  Ignoring..." << endl;
             } else {
                 assert(willAcceptTransaction(r_addr)); // if this gets triggered, need to rethink AXI "ready" signal strategy
                 assert(
                         dramsim->addTransaction(false, r_addr - dram_offset)
                       );
-                addr_to_tag[r_addr] = make_pair(top->m_axi_araddr, top->m_axi_arid);
+                if (axi_trace) trace_dram_request(r_addr - dram_offset, false);
+                if (locality) locality->access(r_addr - dram_offset, false);
+                read_tags.insert(make_pair(r_addr, make_pair(top->m_axi_araddr, (int)top->m_axi_arid)));
             }
         }
     }
@@ -185,14 +330,14 @@ void System::tick(int clk) {
             } else if (top->m_axi_awlen+1 != 8) {
                 cerr << "Write request with length != 8 (" << std::dec << top->m_axi_awlen << "+1)" << endl;
                 Verilated::gotFinish(true);
-            } else if (addr_to_tag.find(w_addr)!=addr_to_tag.end()) {
-                cerr << "Access for " << std::hex << w_addr << " already outstanding.  Ignoring..." << endl;
             } else {
                 assert(willAcceptTransaction(w_addr)); // if this gets triggered, need to rethink AXI "ready" signal strategy
                 assert(
                         dramsim->addTransaction(true, w_addr - dram_offset)
                       );
-                addr_to_tag[w_addr] = make_pair(top->m_axi_awaddr, top->m_axi_awid);
+                if (axi_trace) trace_dram_request(w_addr - dram_offset, true);
+                if (locality) locality->access(w_addr - dram_offset, true);
+                write_tags.insert(make_pair(w_addr, make_pair(top->m_axi_awaddr, (int)top->m_axi_awid)));
             }
         }
     }
@@ -215,33 +360,77 @@ void System::tick(int clk) {
     }
 
     top->m_axi_acvalid = 0;
-    if (!snoop_queue.empty()) {
-        top->m_axi_acvalid = 1;
-        top->m_axi_acaddr = *snoop_queue.begin();
-        top->m_axi_acsnoop = 0xD; // MakeInvalid
+    if (!snoop_queue.empty())
+        drive_snoop();
+}
+
+// If the core is parked on a WFI and nothing is in flight on the bus, no
+// state can change until the CLINT's next event, so jump straight to it.
+// DRAMSim2 has no way to advance its clock other than update(), so it is not
+// stepped through the gap; that's only right with no transaction inside it,
+// which the tags (one per addTransaction() not yet called back) vouch for.
+void System::skip_idle_cycles() {
+    if (top->wfi_idle) uart_flush(); // show a partial line (e.g. a prompt) while the guest waits, even with IDLESKIP=n
+    if (!idle_skip || top->wfi_idle != ALL_HARTS || !bus_quiescent() || virtio_busy()) return;
+    uint64_t now = cycle;
+    uint64_t next = clint_next_event_cycle();
+    if (next <= now+1) return;
+    uint64_t cycles = next - now - 1;
+    assert(read_tags.empty() && write_tags.empty()); // DRAMSim2 must be idle, see above
+    ticks += cycles * ps_per_clock;
+    cycle += cycles;
+    idle_skipped_cycles += cycles;
+}
+
+void System::open_axi_trace(const char* filename) {
+    axi_trace = fopen(filename, "wb");
+    if (!axi_trace) {
+        cerr << "Could not open AXI trace file " << filename << ": " << strerror(errno) << endl;
+        exit(-1);
     }
+    if (ramsize / 64 >= (1ULL << 31)) {
+        cerr << "RAM_SIZE is too large for the AXI trace format" << endl;
+        exit(-1);
+    }
+    setvbuf(axi_trace, NULL, _IOFBF, 1*MEGA);
+    axi_trace_header header = { AXI_TRACE_MAGIC, (uint32_t)ps_per_clock, (uint32_t)(ramsize / MEGA) };
+    assert(fwrite(&header, sizeof(header), 1, axi_trace) == 1);
+}
+
+void System::trace_dram_request(uint64_t dram_addr, bool is_write) {
+    uint64_t delta = cycle - axi_trace_cycle;
+    axi_trace_cycle = cycle;
+    for (; delta >= AXI_TRACE_SKIP; delta -= AXI_TRACE_SKIP) {
+        axi_trace_record skip = { AXI_TRACE_SKIP, AXI_TRACE_SKIP };
+        assert(fwrite(&skip, sizeof(skip), 1, axi_trace) == 1);
+    }
+    axi_trace_record record = { (uint32_t)delta, (uint32_t)((dram_addr / 64) << 1 | is_write) };
+    assert(fwrite(&record, sizeof(record), 1, axi_trace) == 1);
+    ++axi_trace_records;
 }
 
 void System::read_response(uint64_t addr, int tag, bool last) {
     r_queue.push_back(make_pair(addr, make_pair(tag, last)));
 }
 
+// DRAMSim2 completes requests to the same line in order, and equal keys in a
+// multimap stay in insertion order, so the first one is the one that's done
 void System::dram_read_complete(unsigned id, uint64_t address, uint64_t clock_cycle) {
-    map<uint64_t, pair<uint64_t, int> >::iterator tag = addr_to_tag.find(address + dram_offset);
-    assert(tag != addr_to_tag.end());
+    multimap<uint64_t, pair<uint64_t, int> >::iterator tag = read_tags.lower_bound(address + dram_offset);
+    assert(tag != read_tags.end() && tag->first == address + dram_offset);
     uint64_t orig_addr = tag->second.first;
     for(int i = 0; i < 64; i += 8)
         read_response(*((uint64_t*)(&ram[((orig_addr&(~63))+((orig_addr+i)&63)) - dram_offset])), tag->second.second, i+8>=64);
-    addr_to_tag.erase(tag);
+    read_tags.erase(tag);
 }
 
 void System::dram_write_complete(unsigned id, uint64_t address, uint64_t clock_cycle) {
     //printf("dram write complete for addr: %x\n", address);
     do_finish_write(address, 64);
-    map<uint64_t, pair<uint64_t, int> >::iterator tag = addr_to_tag.find(address + dram_offset);
-    assert(tag != addr_to_tag.end());
+    multimap<uint64_t, pair<uint64_t, int> >::iterator tag = write_tags.lower_bound(address + dram_offset);
+    assert(tag != write_tags.end() && tag->first == address + dram_offset);
     resp_queue.push_back(tag->second.second);
-    addr_to_tag.erase(tag);
+    write_tags.erase(tag);
 }
 
 void System::set_errno(const int new_errno) {
@@ -251,11 +440,50 @@ void System::set_errno(const int new_errno) {
     }
 }
 
-void System::invalidate(const uint64_t phy_addr) {
-    snoop_queue.insert(phy_addr & ~0x3fULL);
+// See AcSNOOP in enums.sv
+enum { SNOOP_CLEAN_INVALID = 0x9, SNOOP_CLEAN_INVALID_RANGE = 0xA, SNOOP_MAKE_INVALID_RANGE = 0xC, SNOOP_MAKE_INVALID = 0xD };
+
+// Invalidates the lines of [phy_addr, phy_addr+len) in the caches, after the
+// harness has written ram behind their back
+void System::invalidate(const uint64_t phy_addr, const uint64_t len) {
+    for(uint64_t line = phy_addr & ~0x3fULL; line < phy_addr+len; line += 64)
+        snoop_queue.insert(make_pair(line, (int)SNOOP_MAKE_INVALID)); // keeps a pending clean, if any
+}
+
+// Like invalidate(), but dirty data is written back to ram first.  Once the
+// snoops have been accepted (snoops_pending() goes false), ram is up to date.
+void System::clean_invalidate(const uint64_t phy_addr, const uint64_t len) {
+    for(uint64_t line = phy_addr & ~0x3fULL; line < phy_addr+len; line += 64)
+        snoop_queue[line] = SNOOP_CLEAN_INVALID;
+}
+
+// Puts the first queued line on the AC channel, along with the lines after it
+// that are in the same 4K page and want the same snoop: the caches take a run
+// of up to 64 lines as one range snoop, in a single cycle unless they have
+// dirty lines to write back.  So a 1MB read() costs 256 snoops, not 16k.
+void System::drive_snoop() {
+    map<uint64_t, int>::iterator first = snoop_queue.begin(), last = first, next = first;
+    while (++next != snoop_queue.end() && next->first == last->first + 64 &&
+           (next->first & ~0xfffULL) == (first->first & ~0xfffULL) && next->second == first->second)
+        last = next;
+    snoop_start = first->first;
+    snoop_end = last->first + 64;
+    top->m_axi_acvalid = 1;
+    if (first == last) {
+        top->m_axi_acaddr = first->first;
+        top->m_axi_acsnoop = first->second;
+    } else {
+        top->m_axi_acaddr = first->first | ((last->first >> 6) & 0x3f);
+        top->m_axi_acsnoop = first->second == SNOOP_CLEAN_INVALID ? SNOOP_CLEAN_INVALID_RANGE : SNOOP_MAKE_INVALID_RANGE;
+    }
 }
 
 uint64_t System::get_phys_page() {
+    if (phys_pages_allocated == ramsize/PAGE_SIZE) {
+        cerr << "Out of physical memory, all " << std::dec << phys_pages_allocated << " pages are in use" << endl;
+        exit(-1);
+    }
+    ++phys_pages_allocated;
     int page_no;
     do {
         page_no = rand()%(ramsize/PAGE_SIZE);
@@ -276,7 +504,7 @@ uint64_t System::get_pte(uint64_t base_addr, int vpn, bool isleaf, bool& allocat
             (*(uint64_t*)&ram[addr]) = (page_no<<10) | VALID_PAGE;
         else
             (*(uint64_t*)&ram[addr]) = (page_no<<10) | VALID_PAGE_DIR;
-        invalidate(addr);
+        invalidate_pte(addr);
         pte = *(uint64_t*) & ram[addr];
         if (VM_DEBUG) {
             cout << "Addr:" << std::dec << addr << endl;
@@ -318,12 +546,183 @@ uint64_t System::virt_to_phy(const uint64_t virt_addr) {
     return (pt_base_addr | phy_offset);
 }
 
+// brk and mmap only reserve address space, from the end of the ELF image up
+// to ecall_brk.  Pages in there get a physical page on first touch.  This
+// runs in the SIGSEGV handler, so the PTE snoops are left for posedge().
+bool System::demand_fault(const uint64_t virt_addr) {
+    if (virt_addr < (max_elf_addr & ~(PAGE_SIZE-1)) || virt_addr >= ecall_brk) return false;
+    in_fault_handler = 1;
+    virt_to_phy(virt_addr);
+    in_fault_handler = 0;
+    return true;
+}
+
+void System::invalidate_pte(const uint64_t addr) {
+    if (!in_fault_handler) {
+        invalidate(addr);
+        return;
+    }
+    if (fault_invalidation_count == (sig_atomic_t)fault_invalidations.size()) {
+        static const char msg[] = "Too many page faults between two cycles, raise FAULT_INVALIDATIONS\n";
+        (void)!write(STDERR_FILENO, msg, sizeof(msg)-1);
+        abort();
+    }
+    fault_invalidations[fault_invalidation_count] = addr;
+    fault_invalidation_count = fault_invalidation_count + 1;
+}
+
+// File-backed mmap for fake-os, at virt_addr (page aligned, already reserved
+// like an anonymous mmap).  The host file's pages are mapped straight into
+// guest memory, so nothing is copied up front.  Guest stores to a MAP_SHARED
+// mapping sit in the D$ like any other, though, so they only reach the file
+// once sync_file() has cleaned them out.  With HAVETLB a guest page is in
+// both ram and ram_virt, and two private mappings of a file would drift apart
+// once written, so MAP_PRIVATE there is read in with pread instead, as is
+// anything on hugetlb ram, which can't be remapped 4K at a time.  Past the
+// end of the file is left anonymous, since touching a mapped page beyond EOF
+// would SIGBUS the host.  Returns 0 or -errno.
+int System::map_file(const uint64_t virt_addr, const uint64_t len, const int fd, const off_t offset, const bool shared) {
+    struct stat st;
+    if (fstat(fd, &st) != 0) return -errno;
+    if (offset & (PAGE_SIZE-1)) return -EINVAL;
+    const uint64_t filelen = (uint64_t)st.st_size > (uint64_t)offset ? min<uint64_t>(len, st.st_size - offset) : 0;
+    const uint64_t maplen = (filelen + PAGE_SIZE-1) & ~(PAGE_SIZE-1);
+    const int flags = (shared ? MAP_SHARED : MAP_PRIVATE) | MAP_FIXED;
+
+    if (!use_virtual_memory && huge_pages != HUGE_PAGES_HUGETLB) {
+        if (maplen && mmap(ram + virt_addr, maplen, PROT_READ|PROT_WRITE, flags, fd, offset) == MAP_FAILED) return -errno;
+        if (shared)
+            for(uint64_t page = 0; page < maplen; page += PAGE_SIZE) shared_file_pages.insert(virt_addr + page);
+        return 0;
+    }
+
+    if (use_virtual_memory && shared) {
+        for(uint64_t page = 0; page < maplen; page += PAGE_SIZE) {
+            const uint64_t phys = virt_to_phy(virt_addr + page);
+            if (mmap(ram + phys, PAGE_SIZE, PROT_READ|PROT_WRITE, flags, fd, offset + page) == MAP_FAILED) {
+                const int err = errno;
+                unmap_file_page(virt_addr + page); // MAP_FIXED may have dropped what was there
+                for(uint64_t undo = 0; undo < page; undo += PAGE_SIZE) {
+                    shared_file_pages.erase(virt_addr + undo);
+                    unmap_file_page(virt_addr + undo);
+                }
+                return -err;
+            }
+            assert(mmap(ram_virt + virt_addr + page, PAGE_SIZE, PROT_READ|PROT_WRITE, flags, fd, offset + page) != MAP_FAILED);
+            shared_file_pages.insert(virt_addr + page);
+        }
+        return 0;
+    }
+
+    for(uint64_t page = 0; page < maplen; page += PAGE_SIZE) virt_to_phy(virt_addr + page); // prefault
+    for(uint64_t done = 0; done < filelen; ) {
+        const ssize_t n = pread(fd, ram_virt + virt_addr + done, filelen - done, offset + done);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) return -errno;
+        if (n == 0) break; // file shrank
+        done += n;
+    }
+    memset(ram_virt + virt_addr + filelen, 0, maplen - filelen); // rest of the last page, as mmap would
+    return 0;
+}
+
+// For msync and munmap (and at exit, over everything): cleans the shared
+// file pages in [virt_addr, virt_addr+len) out of the caches.  The host side
+// can only happen once the snoops are through, so posedge() finishes it with
+// finish_file_syncs(): msync, and for munmap, putting ram back under the
+// page.  Returns whether there was anything to do.
+bool System::sync_file(const uint64_t virt_addr, const uint64_t len, const bool unmap) {
+    const uint64_t end = virt_addr + len;
+    bool queued = false;
+    for(set<uint64_t>::iterator page = shared_file_pages.lower_bound(virt_addr & ~(PAGE_SIZE-1));
+        page != shared_file_pages.end() && *page < end; ++page) {
+        clean_invalidate(virt_to_phy(*page), PAGE_SIZE);
+        file_syncs.push_back(make_pair(*page, unmap));
+        queued = true;
+    }
+    return queued;
+}
+
+void System::finish_file_syncs() {
+    for(auto& sync : file_syncs) {
+        if (!shared_file_pages.count(sync.first)) continue; // unmapped by an earlier request
+        char* host = ram + virt_to_phy(sync.first);
+        if (msync(host, PAGE_SIZE, MS_SYNC) != 0)
+            cerr << "msync of guest page 0x" << std::hex << sync.first << " failed: " << strerror(errno) << endl;
+        if (sync.second) {
+            shared_file_pages.erase(sync.first);
+            unmap_file_page(sync.first);
+        }
+    }
+    file_syncs.clear();
+}
+
+// Puts ram back under a page that map_file() had mapped a file over
+void System::unmap_file_page(const uint64_t virt_page) {
+    if (use_virtual_memory) {
+        const uint64_t phys = virt_to_phy(virt_page);
+        assert(mmap(ram + phys, PAGE_SIZE, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_FIXED, ram_fd, phys) != MAP_FAILED);
+        assert(mmap(ram_virt + virt_page, PAGE_SIZE, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_FIXED, ram_fd, phys) != MAP_FAILED);
+    } else {
+        assert(mmap(ram + virt_page, PAGE_SIZE, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS|MAP_FIXED|MAP_NORESERVE, -1, 0) != MAP_FAILED);
+    }
+}
+
 void System::load_segment(const int fd, const size_t memsz, const size_t filesz, uint64_t virt_addr) {
     if (VM_DEBUG) cout << "Read " << std::dec << filesz << " bytes at " << std::hex << virt_addr << endl;
     for(size_t i = 0; i < memsz; ++i) assert(virt_to_phy(virt_addr + i)); // prefault
     assert(filesz == read(fd, &ram_virt[virt_addr], filesz));
 }
 
+// The DTB baked into bbl.bin has a fixed memory size, so rewrite the size
+// cells of the memory node's "reg" property to match RAM_SIZE.
+#define FDT_MAGIC      0xd00dfeed
+enum { FDT_BEGIN_NODE = 1, FDT_END_NODE = 2, FDT_PROP = 3, FDT_NOP = 4, FDT_END = 9 };
+
+static void patch_dtb_memory(char* dtb, const uint64_t ramsize) {
+    const uint32_t* header = (const uint32_t*)dtb;
+    if (ntohl(header[0]) != FDT_MAGIC) {
+        cerr << "No DTB header found, guest memory size is whatever bbl.bin says" << endl;
+        return;
+    }
+    const uint32_t* token = (const uint32_t*)(dtb + ntohl(header[2])); // off_dt_struct
+    const char* strings = dtb + ntohl(header[3]);                       // off_dt_strings
+    bool in_memory = false;
+    for(;;) {
+        switch(ntohl(*token++)) {
+            case FDT_BEGIN_NODE: {
+                const char* name = (const char*)token;
+                in_memory = !strncmp(name, "memory", 6);
+                token += (strlen(name) + 4) / 4;
+                break;
+            }
+            case FDT_END_NODE:
+                in_memory = false;
+                break;
+            case FDT_PROP: {
+                const uint32_t len = ntohl(token[0]);
+                uint32_t* data = (uint32_t*)(token + 2);
+                if (in_memory && !strcmp(strings + ntohl(token[1]), "reg")) {
+                    if (len == 16) { // #address-cells = #size-cells = 2
+                        data[2] = htonl(ramsize >> 32);
+                        data[3] = htonl(ramsize);
+                        return;
+                    }
+                    cerr << "DTB memory node has a " << std::dec << len << "-byte reg property, leaving it alone" << endl;
+                    return;
+                }
+                token += 2 + (len + 3) / 4;
+                break;
+            }
+            case FDT_NOP:
+                break;
+            default:
+                cerr << "No memory node found in the DTB, guest memory size is whatever bbl.bin says" << endl;
+                return;
+        }
+    }
+}
+
 uint64_t System::load_binary(const char* filename) {
 
     // open the elf file
@@ -335,10 +734,17 @@ uint64_t System::load_binary(const char* filename) {
       assert(sz == pread(fd, &ram[0], sz, 0));
       close(fd);
       #define MARKER "---CSE502---"
-      char* dtb = (char*)memmem((&ram[sz]-1000000), 1000000, MARKER, strlen(MARKER));
-      assert(dtb);
+      // bbl.bin carries its device tree after a marker near the end.  Bare-metal
+      // programs (mktest/bench) have none and set up their own stack.
+      const off_t search = min<off_t>(sz, 1000000);
+      char* dtb = (char*)memmem(&ram[sz]-search, search, MARKER, strlen(MARKER));
+      if (!dtb) {
+        cerr << "No device tree in " << filename << ", starting it bare-metal" << endl;
+        return dram_offset;
+      }
       top->stackptr = (dtb-&ram[0]+strlen(MARKER));
       cerr << "DTB is at 0x" << std::hex << top->stackptr << endl;
+      patch_dtb_memory(dtb+strlen(MARKER), ramsize);
       return dram_offset;
     }
 
@@ -6,9 +6,16 @@
 #include <set>
 #include <queue>
 #include <utility>
-#include <bitset>
+#include <vector>
+#include <string>
+#include <chrono>
+#include <stdio.h>
+#include <signal.h>
 #include "DRAMSim2/DRAMSim.h"
 #include "Vtop.h"
+#include "locality.h"
+#include "pipeview.h"
+#include "bbv.h"
 
 #define KILO (1024UL)
 #define MEGA (1024UL*1024)
@@ -20,6 +27,12 @@
 
 #define DRAM_OFFSET 0x80000000ULL
 
+// Harts in top.sv, from make HARTS=<n> (which passes -GHARTS too)
+#ifndef HARTS
+#define HARTS 1
+#endif
+#define ALL_HARTS ((1U << HARTS) - 1)
+
 typedef unsigned long __uint64_t;
 typedef __uint64_t uint64_t;
 typedef unsigned int __uint32_t;
@@ -34,7 +47,6 @@ class System {
 
     enum { IRQ_TIMER=0, IRQ_KBD=1 };
     int interrupts;
-    std::queue<char> keys;
     uint64_t errno_addr;
 
     bool show_console;
@@ -43,13 +55,27 @@ class System {
 
     list<pair<uint64_t, pair<int, bool> > > r_queue;
     list<int> resp_queue;
-    set<uint64_t> snoop_queue;
-    std::map<uint64_t, std::pair<uint64_t, int> > addr_to_tag;
+    map<uint64_t, int> snoop_queue; // line address -> snoop type
+    uint64_t snoop_start, snoop_end; // lines of the snoop on the bus, see drive_snoop()
+    // line -> (address, id) of each DRAM request in flight, oldest first.  The
+    // same line can be in flight more than once: harts fetch the same code,
+    // and a line a hart just wrote back can be another hart's next fill.
+    std::multimap<uint64_t, std::pair<uint64_t, int> > read_tags, write_tags;
+
+    // PTE lines written while handling a SIGSEGV (see demand_fault) can't go
+    // into snoop_queue from the handler, since the fault may have interrupted
+    // the harness inside it.  They go in these slots, reserved up front, and
+    // posedge() queues the snoops.
+    vector<uint64_t> fault_invalidations;
+    volatile sig_atomic_t fault_invalidation_count;
+    volatile sig_atomic_t in_fault_handler;
+    void invalidate_pte(const uint64_t addr);
 
     void dram_read_complete(unsigned id, uint64_t address, uint64_t clock_cycle);
     void dram_write_complete(unsigned id, uint64_t address, uint64_t clock_cycle);
 
-    bitset<GIGA/PAGE_SIZE> phys_page_used;
+    vector<bool> phys_page_used; // one per page of ram, sized at runtime
+    uint64_t phys_pages_allocated;
     uint64_t get_phys_page();
     uint64_t get_pte(uint64_t base_addr, int vpn, bool isleaf, bool& allocated);
     uint64_t load_elf_parts(int fileDescriptor, size_t size, const uint64_t virt_addr);
@@ -60,6 +86,32 @@ class System {
       // hack: false if /any/ memory channel can't accept transaction
       return dramsim->willAcceptTransaction();
     }
+    bool bus_quiescent() {
+      return !top->m_axi_arvalid && !top->m_axi_awvalid && !top->m_axi_wvalid && !w_count &&
+        r_queue.empty() && resp_queue.empty() && snoop_queue.empty() && read_tags.empty() && write_tags.empty();
+    }
+    void skip_idle_cycles();
+    void drive_snoop();
+
+    // Guest pages of MAP_SHARED file mappings (see map_file), and the ones
+    // msync/munmap asked for that wait on their clean snoops: (page, unmap)
+    set<uint64_t> shared_file_pages;
+    list<pair<uint64_t, bool> > file_syncs;
+    void finish_file_syncs();
+    void unmap_file_page(const uint64_t virt_page);
+
+    enum { HUGE_PAGES_NONE, HUGE_PAGES_THP, HUGE_PAGES_HUGETLB } huge_pages;
+    void map_ram();
+    std::chrono::steady_clock::time_point host_start;
+
+    FILE* axi_trace; // AXI_TRACE=<file>: record DRAM requests (see axi_trace.h)
+    uint64_t axi_trace_cycle;
+    uint64_t axi_trace_records;
+    void open_axi_trace(const char* filename);
+    void trace_dram_request(uint64_t dram_addr, bool is_write);
+
+    Locality* locality; // LOCALITY=<file>: report on DRAM access patterns at exit
+    std::string locality_file;
     
 public:
     static System* sys;
@@ -71,14 +123,30 @@ public:
 
     uint64_t ticks;
     int ps_per_clock;
+    uint64_t cycle; // ticks / ps_per_clock as of the last posedge, without the division
+    int exit_code;  // Vtop's, set by the guest through the test finisher
+
+    bool idle_skip;
+    uint64_t idle_skipped_cycles;
 
     bool use_virtual_memory, full_system;
 
+    PipeView* pipeview; // PIPEVIEW=<file>: Konata trace, fed from top.sv through DPI
+    Bbv* bbv;           // BBV=<file>: basic-block vectors for SimPoint, also through DPI
+
     void set_errno(const int new_errno);
-    void invalidate(const uint64_t phys_addr);
+    void invalidate(const uint64_t phys_addr, const uint64_t len = 1);
+    void clean_invalidate(const uint64_t phys_addr, const uint64_t len = 1);
+    bool snoops_pending() { return !snoop_queue.empty(); }
     uint64_t virt_to_phy(const uint64_t virt_addr);
+    bool demand_fault(const uint64_t virt_addr);
+    int map_file(const uint64_t virt_addr, const uint64_t len, const int fd, const off_t offset, const bool shared);
+    bool sync_file(const uint64_t virt_addr, const uint64_t len, const bool unmap);
+    bool files_syncing() { return !file_syncs.empty(); }
     void read_response(uint64_t addr, int tag, bool last);
 
+    std::queue<char> keys; // UART receive FIFO
+
     char* ram;
     uint64_t ramsize;
     char* ram_virt;
@@ -88,7 +156,14 @@ public:
     ~System();
 
     void console();
-    void tick(int clk);
+    void posedge();
+    // Only retires the handshakes that completed this cycle
+    void negedge() {
+        if (top->reset) return;
+        if (top->m_axi_rvalid && top->m_axi_rready) r_queue.pop_front();
+        if (top->m_axi_bvalid && top->m_axi_bready) resp_queue.pop_front();
+        if (top->m_axi_acvalid && top->m_axi_acready) snoop_queue.erase(snoop_queue.lower_bound(snoop_start), snoop_queue.lower_bound(snoop_end));
+    }
 };
 
 #endif
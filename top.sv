@@ -3,6 +3,7 @@
 `include "Sysbus.defs"
 `include "enums.sv"
 `include "decoder.sv"
+`include "rvc.sv"
 `include "alu.sv"
 `include "regfile.sv"
 `include "pipe_reg.sv"
@@ -10,23 +11,33 @@
 `include "memory_system.sv"
 `include "mem_stage.sv"
 `include "privilege.sv"
+`include "hart_interconnect.sv"
 
 
 //`define CPU_DEBUG_PRINT_JUMPS  //Enables jump-logging output
 //`define CPU_MAX_CYCLES_TO_RUN  'hF001000  //shuts down the cpu after this many clocks
 
-module top
+// One hart: a pipeline with its own MemorySystem.  top (at the end) has
+// HARTS of them.
+module Hart
 #(
   ID_WIDTH = 13,
   ADDR_WIDTH = 64,
   DATA_WIDTH = 64,
-  STRB_WIDTH = DATA_WIDTH/8
+  STRB_WIDTH = DATA_WIDTH/8,
+  ISSUE_WIDTH = 1, // 2 builds the dual-issue pipeline (see IF_pair), set with -GISSUE_WIDTH
+  HARTID = 0,
+  HARTS = 1
 )
 (
   input  clk,
          reset,
-         hz32768timer,
   input  [63:0] mtime,
+  input         mtip,     // CLINT timer interrupt (mtime >= mtimecmp)
+  input         msip,     // CLINT software interrupt
+  input         meip,     // PLIC external interrupt, M-mode context
+  input         seip,     // PLIC external interrupt, S-mode context
+  output        wfi_idle, // core is parked on a WFI, waiting for an interrupt
 
   // 64-bit addresses of the program entry point and initial stack pointer
   input  [63:0] entry,
@@ -167,15 +178,51 @@ module top
 
     // ------------------------BEGIN IF STAGE--------------------------
 
+    // ==== Fetch queue
+    // The I$ is read at fetch_pc, which runs ahead of the op being handed to
+    // ID.  A hit yields the rest of its 8-byte word, which the aligner below
+    // cuts into up to two ops, and fetched ops wait in the queue while the back
+    // end is stalled, so fetch keeps going through ID stalls and can get ahead
+    // of the next I$ miss.  With the queue empty, a hit bypasses it straight
+    // into ID.  Everything called IF_xxx below is about the op at the head.
+    localparam FQ_DEPTH = 8;
+    localparam LOG_FQ_DEPTH = 3;
+
+    logic [63:0] fetch_pc;     // 2-byte aligned
+    logic        fetch_halted; // don't fetch past an I$ page fault until the next redirect
+    logic [63:0] fq_pc    [FQ_DEPTH];
+    logic [31:0] fq_inst  [FQ_DEPTH]; // compressed ops are already expanded
+    logic        fq_rvc   [FQ_DEPTH]; // op was 2 bytes long
+    logic        fq_fault [FQ_DEPTH];
+    logic        fq_fault_hi [FQ_DEPTH]; // fault was in the second half of an op straddling a page
+    logic [63:0] fq_id    [FQ_DEPTH]; // op number, for the pipeline trace
+    logic [LOG_FQ_DEPTH-1:0] fq_head;
+    logic [LOG_FQ_DEPTH-1:0] fq_tail;
+    logic [LOG_FQ_DEPTH-1:0] fq_tail_plus1; // wraps around, unlike fq_tail+1
+    assign fq_tail_plus1 = fq_tail + 1;
+    logic [LOG_FQ_DEPTH:0]   fq_count;
+    logic        fq_empty;
+    assign fq_empty = fq_count == 0;
+
     logic [63:0] IF_pc;
     logic [31:0] IF_inst;
-    logic IF_fetch_valid; //if cache output is valid
+    logic        IF_rvc;
+    logic IF_fetch_valid; //if there's an op (or page fault) for ID
 
     logic IF_disable; // IF should sit quiet if we're waiting for traps to drain
     assign IF_disable = trap_in_pipeline; //Make sure we disable both input and output
 
+    // Interrupts are taken by sending a trap forward in place of the op at IF_pc
+    // (IF is disabled while a trap is in the pipeline, so this only fires once).
+    // CSRs are written in MEM, so an older csrci mstatus/sstatus or mie write
+    // still in ID..MEM would retire ahead of a trap injected now and the trap
+    // would be taken with interrupts already off: wait for those ops to leave
+    // MEM, by which time interrupt_pending has seen their write.
+    logic IF_take_interrupt;
+    assign IF_take_interrupt = priv_sys.interrupt_pending && !IF_disable && !serializing_in_pipeline;
+
     logic IF_stall;
-    assign IF_stall = !IF_fetch_valid; //note: fetch_valid might be a page fault
+    assign IF_stall = !IF_fetch_valid && !IF_take_interrupt; //note: fetch_valid might be a page fault
 
     // IF_is_executing is high only when the op in IF is passing into ID
     logic IF_is_executing;
@@ -190,75 +237,272 @@ module top
     logic [63:0] mem_sys_ic_req_addr; //cant assign directly to input of module, so do this instead
     logic mem_sys_ic_en;
 
-    assign mem_sys_ic_req_addr = IF_pc;
-    assign mem_sys_ic_en = !IF_disable; 
+    assign mem_sys_ic_req_addr = fetch_pc;
+    assign mem_sys_ic_en = !IF_disable && !fetch_halted && (fq_count <= FQ_DEPTH-2); // room for a whole fetch
+
+    // ==== Aligner
+    // With RVC, ops are 2 or 4 bytes and fetch_pc can be any even address.  The
+    // halfwords from fetch_pc to the end of the I$ word are cut into at most
+    // two ops, expanding compressed ones (rvc.sv); anything left is read again
+    // next cycle.  If the last halfword starts a 32-bit op, it's held in
+    // fetch_half while the next word (maybe in another line or page) is
+    // fetched, and a fault on that word is reported against the held op.
+    logic        fetch_half_valid;
+    logic [15:0] fetch_half;
+
+    logic [79:0] fa_stream;   // held halfword (if any), then the word from fetch_pc on
+    logic [ 2:0] fa_parcels;  // halfwords in fa_stream
+    logic [ 1:0] fa_len0;     // op lengths, in halfwords
+    logic [ 1:0] fa_len1;
+    logic [ 2:0] fa_used;     // halfwords of fa_stream cut into ops
+    logic        fa_hold;     // and the one after them goes into fetch_half
+    logic [ 2:0] fa_advance;  // halfwords fetch_pc moves forward
+
+    // What this cycle's I$ access produced
+    logic        fetch_fault;
+    logic        fetch_fault_hi;
+    logic [ 1:0] fetch_count;
+    logic [63:0] fetch_op_pc   [2];
+    logic [31:0] fetch_op_inst [2];
+    logic        fetch_op_rvc  [2];
+    logic [63:0] fetch_op_id   [2];
+    assign fetch_fault = mem_sys.ic_resp_valid && mem_sys.ic_resp_page_fault;
+    assign fetch_fault_hi = fetch_half_valid;
+
+    always_comb begin
+        fa_stream = fetch_half_valid ? {mem_sys.ic_resp_word >> {fetch_pc[2:1], 4'b0}, fetch_half}
+                                     : {16'b0, mem_sys.ic_resp_word >> {fetch_pc[2:1], 4'b0}};
+        fa_parcels = 3'd4 - {1'b0, fetch_pc[2:1]} + {2'b0, fetch_half_valid};
+
+        fa_len0 = (fa_stream[1:0] == 2'b11) ? 2 : 1;
+        fa_len1 = (fa_stream[16*fa_len0 +: 2] == 2'b11) ? 2 : 1;
+
+        fetch_op_pc[0]   = fetch_half_valid ? fetch_pc - 2 : fetch_pc;
+        fetch_op_pc[1]   = fetch_op_pc[0] + {61'b0, fa_len0, 1'b0};
+        fetch_op_inst[0] = (fa_len0 == 2) ? fa_stream[31:0] : rvc_expand(fa_stream[15:0]);
+        fetch_op_inst[1] = (fa_len1 == 2) ? fa_stream[16*fa_len0 +: 32] : rvc_expand(fa_stream[16*fa_len0 +: 16]);
+        fetch_op_rvc[0]  = fa_len0 == 1;
+        fetch_op_rvc[1]  = fa_len1 == 1;
+
+        fetch_count = 0;
+        fa_used = 0;
+        if (fetch_fault)
+            fetch_count = 1; // one faulting entry, for the op that touched the bad page
+        else if (mem_sys.ic_resp_valid && fa_parcels >= {1'b0, fa_len0}) begin
+            fetch_count = 1;
+            fa_used = {1'b0, fa_len0};
+            if (fa_parcels >= {1'b0, fa_len0} + {1'b0, fa_len1}) begin
+                fetch_count = 2;
+                fa_used = {1'b0, fa_len0} + {1'b0, fa_len1};
+            end
+        end
 
-    // Get response from I$
-    assign IF_fetch_valid = (mem_sys.ic_resp_valid);
-    assign IF_inst =       (mem_sys.ic_resp_inst);
+        fa_hold = mem_sys.ic_resp_valid && !fetch_fault && fa_parcels == fa_used + 1 &&
+                  fa_stream[16*fa_used +: 2] == 2'b11;
+        fa_advance = (!mem_sys.ic_resp_valid || fetch_fault) ? 0 :
+                     fa_used + {2'b0, fa_hold} - {2'b0, fetch_half_valid};
+    end
 
-    // On page fault, send a trap instruction forward
-    assign IF_gen_trap = mem_sys.ic_resp_page_fault;
-    assign IF_gen_trap_cause = IF_gen_trap ? MCAUSE_PAGEFAULT_I : 0;
-    assign IF_gen_trap_val   = IF_gen_trap ? IF_pc : 0; //on fault, mtval gets virtual address of op
+    // Every op gets a number as it's fetched, which follows it down the
+    // pipeline for the Konata trace (see the end of this file).  An interrupt
+    // taken with nothing fetched uses up a number too.
+    logic [63:0] fetch_next_id;
+    assign fetch_op_id[0] = fetch_next_id;
+    assign fetch_op_id[1] = fetch_next_id + 1;
+
+    // Head of the queue, or this cycle's fetch if the queue is empty
+    logic        IF_head_fault;
+    logic        IF_head_fault_hi;
+    assign IF_pc            = fq_empty ? fetch_op_pc[0]  : fq_pc[fq_head];
+    assign IF_rvc           = fq_empty ? fetch_op_rvc[0] : fq_rvc[fq_head];
+    assign IF_head_fault    = fq_empty ? fetch_fault     : fq_fault[fq_head];
+    assign IF_head_fault_hi = fq_empty ? fetch_fault_hi  : fq_fault_hi[fq_head];
+    logic [63:0] IF_id;
+    assign IF_id            = fq_empty ? fetch_op_id[0]  : fq_id[fq_head];
+    assign IF_fetch_valid = !IF_disable && (!fq_empty || fetch_count != 0);
+    assign IF_inst =       IF_take_interrupt ? 32'h0000_0013 : // NOP stands in for the interrupted op
+                           fq_empty ? fetch_op_inst[0] : fq_inst[fq_head];
+
+    // On interrupt or page fault, send a trap instruction forward
+    assign IF_gen_trap = IF_take_interrupt || (IF_fetch_valid && IF_head_fault);
+    assign IF_gen_trap_cause = IF_take_interrupt ? priv_sys.interrupt_cause :
+                               IF_gen_trap       ? MCAUSE_PAGEFAULT_I : 0;
+    assign IF_gen_trap_val   = (IF_gen_trap && !IF_take_interrupt) ? //on fault, mtval gets virtual address of op
+                               IF_pc + (IF_head_fault_hi ? 2 : 0) : 0; // (or of its second half, if that faulted)
 
     // ====  IF-stage next-PC logic
+    // - These are the conditions, in order
+    // - Conditions closer to the end of the pipeline take priority,
+    //   since they typically flush out any preceding them
+    // - Jumps and traps are special-cased, but still happen in
+    //   priority order
+    // - Can handle re-executing on a flush to any stage, even though
+    //   we don't use most of them (just for completeness)
+    // Any of these empties the fetch queue and restarts fetch at IF_redirect_pc.
+    logic        IF_redirect;
+    logic [63:0] IF_redirect_pc;
+    always_comb begin
+        IF_redirect = if_wr_en;
+        IF_redirect_pc = 0;
+        if (priv_sys.is_xret)                   // ===== Handle trap-related jumps
+            IF_redirect_pc = priv_sys.epc_addr & ~64'b001;
+        else if (priv_sys.jump_trap_handler)
+            IF_redirect_pc = priv_sys.handler_addr;
+        else if (flush_before_mem)              // === Reexecute on a flush in mem
+            IF_redirect_pc = MEM_reg.curr_pc + (MEM_reg.curr_deco.is_compressed ? 2 : 4); // start after instruction in MEM
+        else if (EX_do_jump)                    // === Do a jump
+            IF_redirect_pc = jump_target_address;
+        else if (flush_before_ex)               // === Re-execute on a non-jump flush to EX (not typical)
+            IF_redirect_pc = EX_reg.curr_pc + (EX_reg.curr_deco.is_compressed ? 2 : 4);
+        else if (flush_before_id)               // === Re-execute on a non-jump flush to ID  (not typical)
+            IF_redirect_pc = ID_reg.curr_pc + (ID_reg.curr_rvc ? 2 : 4);
+        else
+            IF_redirect = 0;                    // === Default: the head op moves into ID
+    end
+
+    // The head op (or bypassed fetch) leaves when IF advances without a redirect
+    logic IF_consume;
+    assign IF_consume = if_wr_en && !IF_redirect && (!fq_empty || fetch_count != 0);
+
+    // ==== Dual issue: the op after the head, which can go into ID's second slot
+    // It comes from the queue, or from this cycle's fetch if the queue runs out.
+    logic        IF1_avail;
+    logic [31:0] IF1_inst;
+    logic        IF1_rvc;
+    logic        IF1_fault;
+    logic [63:0] IF1_id;
+    logic [LOG_FQ_DEPTH-1:0] fq_head_plus1;
+    assign fq_head_plus1 = fq_head + 1;
+    always_comb begin
+        if (fq_count >= 2) begin
+            IF1_avail = 1;
+            IF1_inst  = fq_inst[fq_head_plus1];
+            IF1_rvc   = fq_rvc[fq_head_plus1];
+            IF1_fault = fq_fault[fq_head_plus1];
+            IF1_id    = fq_id[fq_head_plus1];
+        end else if (fq_count == 1) begin
+            IF1_avail = fetch_count != 0;
+            IF1_inst  = fetch_op_inst[0];
+            IF1_rvc   = fetch_op_rvc[0];
+            IF1_fault = fetch_fault;
+            IF1_id    = fetch_op_id[0];
+        end else begin
+            IF1_avail = fetch_count == 2;
+            IF1_inst  = fetch_op_inst[1];
+            IF1_rvc   = fetch_op_rvc[1];
+            IF1_fault = 0;
+            IF1_id    = fetch_op_id[1];
+        end
+    end
+
+    // Pairing rules are in hazard_unit. Neither op can be a fetch fault, and an
+    // interrupt replaces the head op, so nothing pairs with it.
+    logic IF_pair;
+    assign IF_pair = ISSUE_WIDTH == 2 && IF_fetch_valid && !IF_head_fault && !IF_take_interrupt &&
+                     IF1_avail && !IF1_fault && haz.can_pair;
+
+    // How many ops ID takes this cycle, and how many of those come from the
+    // queue (the rest come straight from this cycle's fetch)
+    logic [1:0] IF_consume_count;
+    logic [1:0] IF_from_queue;
+    logic [1:0] IF_from_fetch;
+    assign IF_consume_count = !IF_consume ? 0 : IF_pair ? 2 : 1;
+    assign IF_from_queue = (fq_count >= {2'b0, IF_consume_count}) ? IF_consume_count : fq_count[1:0];
+    assign IF_from_fetch = IF_consume_count - IF_from_queue;
+
     always_ff @ (posedge clk) begin
         if (reset) begin
             $display("Entry: %x", entry);
-            IF_pc <= entry;
-        end 
-        
-        else if (if_wr_en) begin
-            //TODO: IF_PC logic: (in order of priority)
-            // if IF is disabled (i.e. there's a trap in the pipeline, we
-            // don't care what happens
-
-            // - These are the conditions, in order
-            // - Conditions closer to the end of the pipeline take priority,
-            //   since they typically flush out any preceding them
-            // - Jumps and traps are special-cased, but still happen in
-            //   priority order
-            // - Can handle re-executing on a flush to any stage, even though
-            //   we don't use most of them (just for completeness)
-
-            if (priv_sys.is_xret) begin        // ===== Handle trap-related jumps
-                IF_pc <= priv_sys.epc_addr & ~64'b011;
-            end
-            else if (priv_sys.jump_trap_handler) begin
-                IF_pc <= priv_sys.handler_addr;
-            end
-
-            else if (flush_before_wb) begin     // === (this should never happen)
-                $error("ERROR: FLUSH_BEFORE_WB should only happen if we're jumping for a trap");
-            end
+            fetch_pc <= entry;
+            fetch_halted <= 0;
+            fetch_half_valid <= 0;
+            fetch_next_id <= 0;
+            fq_head <= 0;
+            fq_tail <= 0;
+            fq_count <= 0;
+        end
 
-            else if (flush_before_mem) begin    // === Reexecute on a flush in mem
-                if (!MEM_reg.valid) $error ("ERROR: flush_before_mem expects inst in MEM, found bubble");
-                IF_pc <= MEM_reg.curr_pc + 4; // start after instruction in MEM
+        else if (IF_redirect) begin
+            if (!priv_sys.is_xret && !priv_sys.jump_trap_handler) begin
+                if (flush_before_wb) $error("ERROR: FLUSH_BEFORE_WB should only happen if we're jumping for a trap");
+                else if (flush_before_mem && !MEM_reg.valid) $error ("ERROR: flush_before_mem expects inst in MEM, found bubble");
             end
+            fetch_pc <= IF_redirect_pc;
+            fetch_halted <= 0;
+            fetch_half_valid <= 0;
+            fq_head <= 0;
+            fq_tail <= 0;
+            fq_count <= 0;
+        end
 
-            else if (EX_do_jump) begin          // === Do a jump
-                    IF_pc <= jump_target_address;
+        else begin
+            // Push what was fetched, minus any ops that bypassed the queue into ID
+            if (fetch_count > IF_from_fetch) begin
+                fq_pc[fq_tail]       <= fetch_op_pc[IF_from_fetch[0]];
+                fq_inst[fq_tail]     <= fetch_op_inst[IF_from_fetch[0]];
+                fq_rvc[fq_tail]      <= fetch_op_rvc[IF_from_fetch[0]];
+                fq_fault[fq_tail]    <= (IF_from_fetch == 0) ? fetch_fault    : 0;
+                fq_fault_hi[fq_tail] <= (IF_from_fetch == 0) ? fetch_fault_hi : 0;
+                fq_id[fq_tail]       <= fetch_op_id[IF_from_fetch[0]];
             end
-
-
-            else if (flush_before_ex) begin     // === Re-execute on a non-jump flush to EX (not typical)
-                if(!EX_reg.valid) $error("ERROR: flush_before_ex expects inst in EX, found bubble");
-                IF_pc <= EX_reg.curr_pc + 4;
+            if (fetch_count == 2 && IF_from_fetch == 0) begin
+                fq_pc[fq_tail_plus1]       <= fetch_op_pc[1];
+                fq_inst[fq_tail_plus1]     <= fetch_op_inst[1];
+                fq_rvc[fq_tail_plus1]      <= fetch_op_rvc[1];
+                fq_fault[fq_tail_plus1]    <= 0;
+                fq_fault_hi[fq_tail_plus1] <= 0;
+                fq_id[fq_tail_plus1]       <= fetch_op_id[1];
             end
-            else if (flush_before_id) begin     // === Re-execute on a non-jump flush to ID  (not typical)
-                if(!ID_reg.valid) $error("ERROR: flush_before_id expects inst in ID, found bubble");
-                IF_pc <= ID_reg.curr_pc + 4;
+            fq_tail <= fq_tail + (fetch_count - IF_from_fetch);
+            fq_head <= fq_head + IF_from_queue;
+            fq_count <= fq_count + fetch_count - IF_consume_count;
+            fetch_next_id <= fetch_next_id + {62'b0, fetch_count} +
+                             ((IF_take_interrupt && IF_is_executing && fq_empty && fetch_count == 0) ? 1 : 0);
+
+            fetch_pc <= fetch_pc + {60'b0, fa_advance, 1'b0};
+            if (mem_sys.ic_resp_valid) begin
+                fetch_half_valid <= fa_hold;
+                fetch_half <= fa_stream[16*fa_used +: 16];
             end
+            if (fetch_fault) fetch_halted <= 1;
+        end
+    end
 
-            
-            else begin                          // === Default PC logic: advance:  
-                IF_pc <= IF_pc+4;
+    // ==== Fetch queue statistics, printed at the end of the run
+    logic [63:0] perf_cycles;
+    logic [63:0] perf_fq_occupancy; // sum over all cycles, for the average
+    logic [63:0] perf_fetch_starved; // ID could have taken an op, but fetch had none
+    logic [63:0] perf_fetched;       // ops out of the aligner (including ones later flushed)
+    logic [63:0] perf_fetched_rvc;   // of which were compressed
+    always_ff @ (posedge clk) begin
+        if (reset) begin
+            perf_cycles <= 0;
+            perf_fq_occupancy <= 0;
+            perf_fetch_starved <= 0;
+            perf_fetched <= 0;
+            perf_fetched_rvc <= 0;
+        end else begin
+            perf_cycles <= perf_cycles + 1;
+            perf_fq_occupancy <= perf_fq_occupancy + fq_count;
+            if (id_wr_en && IF_stall && !IF_disable) perf_fetch_starved <= perf_fetch_starved + 1;
+            if (!fetch_fault && !IF_redirect) begin
+                perf_fetched <= perf_fetched + fetch_count;
+                perf_fetched_rvc <= perf_fetched_rvc + (fetch_count >= 1 && fetch_op_rvc[0] ? 1 : 0)
+                                                     + (fetch_count == 2 && fetch_op_rvc[1] ? 1 : 0);
             end
         end
     end
 
+    final begin
+        if (perf_cycles != 0)
+            $display("Fetch queue: average occupancy %0d.%02d of %0d, starved ID for %0d of %0d cycles",
+                     perf_fq_occupancy / perf_cycles, (perf_fq_occupancy * 100 / perf_cycles) % 100, FQ_DEPTH,
+                     perf_fetch_starved, perf_cycles);
+        if (perf_fetched != 0)
+            $display("Fetch: %0d ops, %0d compressed (%0d%%)",
+                     perf_fetched, perf_fetched_rvc, perf_fetched_rvc * 100 / perf_fetched);
+    end
+
 
     // ------------------------END IF STAGE----------------------------
 
@@ -274,10 +518,18 @@ module top
         // incoming signals for next step's ID
         .next_pc(IF_pc),
         .next_inst(IF_inst),
+        .next_rvc(IF_rvc),
+        .next_valid1(IF_pair),
+        .next_inst1(IF1_inst),
+        .next_rvc1(IF1_rvc),
 
         // outgoing signals for current ID stage
         .curr_pc(),
         .curr_inst(),
+        .curr_rvc(),
+        .valid1(),
+        .curr_inst1(),
+        .curr_rvc1(),
 
         // === Trap signals
         .next_trapped   (IF_gen_trap),
@@ -302,6 +554,7 @@ module top
 
     Decoder d(
         .inst(ID_reg.curr_inst),
+        .compressed(ID_reg.curr_rvc),
         .valid(ID_reg.valid),
         .pc(ID_reg.curr_pc),
         .out(ID_deco),
@@ -312,10 +565,36 @@ module top
         .gen_trap_cause(ID_gen_trap_cause),
         .gen_trap_val(ID_gen_trap_val)
     );
+
+    // Second slot of a dual-issue pair: always the op right after ID_reg.curr_pc.
+    // Pairing only lets in plain ALU ops, which never trap in decode.
+    decoded_inst_t ID_deco1; 
+    logic          ID_gen_trap1;
+
+    Decoder d1(
+        .inst(ID_reg.curr_inst1),
+        .compressed(ID_reg.curr_rvc1),
+        .valid(ID_reg.valid1),
+        .pc(ID_reg.curr_pc + (ID_reg.curr_rvc ? 2 : 4)),
+        .out(ID_deco1),
+
+        .curr_priv_mode(curr_priv_mode),
+
+        .gen_trap(ID_gen_trap1),
+        .gen_trap_cause(),
+        .gen_trap_val()
+    );
+
+    always_ff @ (posedge clk) begin
+        if (ID_reg.valid1 && ID_gen_trap1)
+            $error("ERROR: op paired into the second slot traps in decode, inst=%x", ID_reg.curr_inst1);
+    end
     
     // Register file
     logic [63:0] ID_out1;
     logic [63:0] ID_out2;
+    logic [63:0] ID_out3; // second slot's rs1/rs2
+    logic [63:0] ID_out4;
 
     // Ecall values (FOR TEMP ECALL HACK)
     logic [63:0] a0, a1, a2, a3, a4, a5, a6, a7;
@@ -330,6 +609,11 @@ module top
     // and which actually has something to writeback (en_rd)
     //TODO: change this to be WB_complete
 
+    // Second slot writes back with the main op, unless the main op trapped
+    // (then it gets re-executed after the trap returns)
+    logic writeback1_en;
+    assign writeback1_en = WB_reg.valid1 && !WB_reg.curr_trapped && !wb_stage.stall && WB_reg.curr_deco1.en_rd;
+
     RegFile rf(
         .clk(clk),
         .reset(reset),
@@ -342,8 +626,17 @@ module top
         .wb_data(WB_result),
         .wb_en(writeback_en),
 
+        .read_addr3(ID_deco1.rs1),
+        .read_addr4(ID_deco1.rs2),
+
+        .wb_addr2(WB_reg.curr_deco1.rd),
+        .wb_data2(WB_reg.curr_result1),
+        .wb_en2(writeback1_en),
+
         .out1(ID_out1),
         .out2(ID_out2),
+        .out3(ID_out3),
+        .out4(ID_out4),
 
         .a0(a0), .a1(a1), .a2(a2), .a3(a3), .a4(a4), .a5(a5), .a6(a6), .a7(a7)
     );
@@ -368,12 +661,20 @@ module top
         .next_deco(ID_deco), // includes pc & immed
         .next_val_rs1(ID_out1),
         .next_val_rs2(ID_out2),
+        .next_valid1(ID_reg.valid1),
+        .next_deco1(ID_deco1),
+        .next_val1_rs1(ID_out3),
+        .next_val1_rs2(ID_out4),
 
         // Data signals for current EX step
         .curr_pc(),
         .curr_deco(),
         .curr_val_rs1(),
         .curr_val_rs2(),
+        .valid1(),
+        .curr_deco1(),
+        .curr_val1_rs1(),
+        .curr_val1_rs2(),
 
         // === Trap signals
         .next_trapped   (ID_gen_trap || ID_reg.curr_trapped),
@@ -440,8 +741,8 @@ module top
 
     //Deciding EXEC_stage output
     always_comb begin
-        if (EX_do_jump) begin // Jumps store return addr (pc+4)
-            exec_result = EX_reg.curr_pc + 4 ; //(For JAL/JALR. Branches will discard it anyway)
+        if (EX_do_jump) begin // Jumps store return addr (pc+4, or pc+2 for compressed ops)
+            exec_result = EX_reg.curr_pc + (EX_deco.is_compressed ? 2 : 4); //(For JAL/JALR. Branches will discard it anyway)
 
         end else if (EX_deco.keep_pc_plus_immed) begin //FOR AUIPC
             exec_result = EX_reg.curr_pc + EX_deco.immed;
@@ -454,6 +755,36 @@ module top
     end
 
 
+    // == Second ALU, for the second slot (plain ALU ops only: no jumps, no memory)
+    decoded_inst_t EX_deco1;
+    assign EX_deco1 = EX_reg.curr_deco1;
+
+    logic [63:0] alu1_out;
+    logic [63:0] exec_result1;
+
+    Alu a1(
+        .a(EX_reg.curr_val1_rs1),
+        .b(EX_deco1.alu_use_immed ? EX_deco1.immed : EX_reg.curr_val1_rs2),
+        .funct3  (EX_deco1.funct3),
+        .funct7  (EX_deco1.funct7),
+        .width_32(EX_deco1.alu_width_32),
+        .is_load(0),
+        .is_store(0),
+        .is_atomic(0),
+
+        .result(alu1_out)
+    );
+
+    always_comb begin
+        if (EX_deco1.keep_pc_plus_immed) //FOR AUIPC (second slot is right after the first)
+            exec_result1 = EX_reg.curr_pc + (EX_deco.is_compressed ? 2 : 4) + EX_deco1.immed;
+        else if (EX_deco1.alu_nop)
+            exec_result1 = EX_reg.curr_val1_rs1;
+        else
+            exec_result1 = alu1_out;
+    end
+
+
     //== Some dummy signals for debugging (since gtkwave can't show packed structs
     logic [63:0] EX_immed = EX_deco.immed;
     logic [4:0] EX_rs1 = EX_deco.rs1;
@@ -475,12 +806,18 @@ module top
         .next_deco(EX_deco), // includes pc & immed
         .next_data(exec_result),  // result from ALU or other primary value
         .next_data2(EX_reg.curr_val_rs2), // extra value if needed (e.g. for stores, etc)
+        .next_valid1(EX_reg.valid1 && !EX_do_jump), // a taken jump drops the op after it
+        .next_deco1(EX_deco1),
+        .next_data1(exec_result1),
 
         // Data signals for current MEM step
         .curr_pc(),
         .curr_deco(),
         .curr_data(),
         .curr_data2(),
+        .valid1(),
+        .curr_deco1(),
+        .curr_data1(),
 
         .next_do_jump(EX_do_jump),
         .next_jump_target(jump_target_address),
@@ -506,6 +843,11 @@ module top
     logic [63:0] csr_result;
     assign csr_rs1_val = (MEM_reg.curr_deco.csr_immed) ? MEM_reg.curr_deco.rs1 : MEM_reg.curr_data;
 
+    // Ops retiring this cycle (the second slot doesn't retire if the main op traps)
+    logic [1:0] inst_retire_count;
+    assign inst_retire_count = {1'b0, WB_reg.valid && WB_reg.wr_en} +
+                               {1'b0, WB_reg.valid1 && WB_reg.wr_en && !WB_reg.curr_trapped};
+
     logic [63:0] mem_stage_result;
     assign mem_stage_result = (MEM_reg.curr_deco.is_csr) ? csr_result :
                               (MEM_reg.curr_deco.is_atomic) ? atomic_result : mem_ex_rdata;
@@ -514,11 +856,15 @@ module top
     //other-modules section
     Privilege_System priv_sys(
         .clk,
-        .hz32768timer,
         .reset,
 
-        .inst_retire(WB_reg.valid && WB_reg.wr_en),
+        .inst_retire(inst_retire_count),
+        .mhartid(HARTID),
         .mtime,
+        .mtip,
+        .msip,
+        .meip,
+        .seip,
 
         // ==== MEM CSR op inputs (TODO: move these into mem_stage and rename)
         .valid(MEM_reg.valid),
@@ -548,6 +894,9 @@ module top
 
         // === Misc
         .modifying_satp(),
+        .wfi_wakeup(),
+        .interrupt_pending(),
+        .interrupt_cause(),
         .curr_priv_mode
     );
 
@@ -565,6 +914,7 @@ module top
         .advance(mem_wr_en), //TODO: this might be incorrect if wb can stall
 
         .op_trapped(MEM_reg.curr_trapped), // was the incoming instruction trapped from prev stage
+        .wfi_wakeup(priv_sys.wfi_wakeup),  // lets a WFI in MEM complete
 
         //outputs
         .stall(),
@@ -580,18 +930,32 @@ module top
         .force_pipeline_flush(),
         .tlb_invalidate(), //goes to mem_sys
 
+        .snoop_taken(m_axi_acvalid && m_axi_acready),
+        .snoop_addr (m_axi_acaddr),
+        .snoop_last (m_axi_acsnoop == SNOOP_CLEAN_INVALID_RANGE || m_axi_acsnoop == SNOOP_MAKE_INVALID_RANGE ? m_axi_acaddr[5:0] : m_axi_acaddr[11:6]),
+        .snoop_lock (), //goes to mem_sys
+
         // === D$ interface (passed to MemorySystem)
         .dc_en            (),  // input ports get read in at MemorySystem instantiation
         .dc_in_addr       (),  // since you can't assign directly to an input port
         .dc_write_en      (),
         .dc_in_wdata      (),
         .dc_in_wlen       (),
+        .dc_in_sync       (),
         .dc_out_rdata     (mem_sys.dc_out_rdata),
         .dc_out_rvalid    (mem_sys.dc_out_rvalid),
         .dc_out_write_done(mem_sys.dc_out_write_done),
-        .dc_out_page_fault(mem_sys.dc_out_page_fault)
+        .dc_out_page_fault(mem_sys.dc_out_page_fault),
+        .dc_out_paddr     (mem_sys.dc_out_paddr),
+        .dc_sb_empty      (mem_sys.dc_sb_empty)
     );
 
+    // Tells the harness that nothing will happen until the next interrupt,
+    // so it can fast-forward simulated time (see System::tick).
+    // Not while the store buffer still has stores to drain.
+    assign wfi_idle = MEM_reg.valid && !MEM_reg.curr_trapped && MEM_reg.curr_deco.is_wfi && !priv_sys.wfi_wakeup
+                      && mem_sys.dc_sb_empty;
+
     // ------------------------END MEM STAGE----------------------------
 
     WB_reg WB_reg(
@@ -608,12 +972,18 @@ module top
         .next_deco(MEM_reg.curr_deco),
         .next_alu_result(MEM_reg.curr_data),
         .next_mem_result(mem_stage_result),
+        .next_valid1(MEM_reg.valid1),
+        .next_deco1(MEM_reg.curr_deco1),
+        .next_result1(MEM_reg.curr_data1),
 
         // Data signals for current WB step
         .curr_pc(), //goes out to priv_sys
         .curr_deco(),
         .curr_alu_result(),
         .curr_mem_result(),
+        .valid1(),
+        .curr_deco1(),
+        .curr_result1(),
 
         .next_do_jump(MEM_reg.curr_do_jump),
         .next_jump_target(MEM_reg.curr_jump_target),
@@ -661,6 +1031,63 @@ module top
 
 
 
+    // ==== IPC, printed at the end of the run (compare ISSUE_WIDTH=1 against 2)
+    logic [63:0] perf_retired;
+    logic [63:0] perf_retired_paired; // ops that retired from the second slot
+    always_ff @ (posedge clk) begin
+        if (reset) begin
+            perf_retired <= 0;
+            perf_retired_paired <= 0;
+        end else begin
+            perf_retired <= perf_retired + inst_retire_count;
+            if (WB_reg.valid1 && WB_reg.wr_en && !WB_reg.curr_trapped)
+                perf_retired_paired <= perf_retired_paired + 1;
+        end
+    end
+
+    final begin
+        if (perf_cycles != 0 && HARTS > 1)
+            $display("Hart %0d: issue width %0d: retired %0d ops in %0d cycles, IPC %0d.%03d, %0d from the second slot",
+                     HARTID, ISSUE_WIDTH, perf_retired, perf_cycles,
+                     perf_retired / perf_cycles, (perf_retired * 1000 / perf_cycles) % 1000,
+                     perf_retired_paired);
+        else if (perf_cycles != 0)
+            $display("Issue width %0d: retired %0d ops in %0d cycles, IPC %0d.%03d, %0d from the second slot",
+                     ISSUE_WIDTH, perf_retired, perf_cycles,
+                     perf_retired / perf_cycles, (perf_retired * 1000 / perf_cycles) % 1000,
+                     perf_retired_paired);
+    end
+
+
+    // ==== Basic-block vectors for SimPoint (BBV=<file>, see bbv.h)
+    // Counts retiring ops and reports each run of them that ends in a taken
+    // jump or a trap.  The trapping op itself doesn't retire.  Hart 0 only.
+    logic        bbv_on;        // asked at reset, so a normal run only pays for this test
+    logic [63:0] bbv_block_pc;  // first op of the block retiring so far
+    logic [63:0] bbv_block_ops; // 0: the next op to retire starts a block
+    logic [63:0] bbv_first_pc;
+    logic [63:0] bbv_ops;
+    logic        bbv_block_ends;
+    assign bbv_first_pc   = (bbv_block_ops == 0) ? WB_reg.curr_pc : bbv_block_pc;
+    assign bbv_ops        = bbv_block_ops + (WB_reg.curr_trapped ? 0 : {62'b0, inst_retire_count});
+    assign bbv_block_ends = WB_reg.curr_trapped || WB_reg.curr_do_jump;
+
+    always_ff @ (posedge clk) begin
+        if (reset) begin
+            bbv_on <= HARTID == 0 && bbv_enabled() != 0;
+            bbv_block_ops <= 0;
+        end else if (bbv_on && WB_reg.valid && WB_reg.wr_en) begin
+            if (bbv_block_ends) begin
+                if (bbv_ops != 0) bbv_block(bbv_first_pc, WB_reg.curr_pc, bbv_ops, perf_cycles);
+                bbv_block_ops <= 0;
+            end else begin
+                bbv_block_pc <= bbv_first_pc;
+                bbv_block_ops <= bbv_ops;
+            end
+        end
+    end
+
+
     // ------------------------END WB STAGE-----------------------------
     
     // -------Modules outside of pipeline (e.g. hazard detection)-------
@@ -677,8 +1104,23 @@ module top
         .mem_valid(MEM_reg.valid),
         .wb_valid (WB_reg.valid),
 
+        .ID_deco1 (ID_deco1),
+        .EX_deco1 (EX_deco1),
+        .MEM_deco1(MEM_reg.curr_deco1),
+        .WB_deco1 (WB_reg.curr_deco1),
+
+        .id_valid1 (ID_reg.valid1),
+        .ex_valid1 (EX_reg.valid1),
+        .mem_valid1(MEM_reg.valid1),
+        .wb_valid1 (WB_reg.valid1),
+
+        // Dual-issue pairing
+        .IF_inst0(IF_inst),
+        .IF_inst1(IF1_inst),
+
         // Outputs data hazards detected
-        .data_hazard_ID()
+        .data_hazard_ID(),
+        .can_pair()
 
     );
 
@@ -711,6 +1153,12 @@ module top
     // Or else IF will disable itself in the same cycle that it detects a thing
     assign trap_in_pipeline = (ID_is_trap || EX_is_trap || MEM_is_trap || WB_is_trap);
 
+    logic serializing_in_pipeline; // CSR, xRET or WFI in ID..MEM: hold off interrupts until it's done
+    assign serializing_in_pipeline =
+        (ID_reg.valid  && (ID_deco.is_csr           || ID_deco.is_trap_ret           || ID_deco.is_wfi)) ||
+        (EX_reg.valid  && (EX_reg.curr_deco.is_csr  || EX_reg.curr_deco.is_trap_ret  || EX_reg.curr_deco.is_wfi)) ||
+        (MEM_reg.valid && (MEM_reg.curr_deco.is_csr || MEM_reg.curr_deco.is_trap_ret || MEM_reg.curr_deco.is_wfi));
+
     assign flush_before_id  = ID_is_trap  || 0;
     assign flush_before_ex  = EX_is_trap  || EX_do_jump;
     assign flush_before_mem = MEM_is_trap || mem_stage.force_pipeline_flush || priv_sys.modifying_satp;
@@ -772,13 +1220,14 @@ module top
 
         // TLB flushes on SATP write or sfence
         .tlb_invalidate(mem_stage.tlb_invalidate || priv_sys.modifying_satp),
+        .snoop_lock(mem_stage.snoop_lock),
 
         //I$ ports
         .ic_req_addr(mem_sys_ic_req_addr),  // this is assigned from a signal since it's an input
-        .ic_en(!IF_disable), // TODO: wire this to IF_disable
+        .ic_en(mem_sys_ic_en),
         .ic_resp_valid(),    //Outputs
         .ic_resp_page_fault(),
-        .ic_resp_inst(),
+        .ic_resp_word(),
 
         //D$ ports
         .dc_en      (mem_stage.dc_en), 
@@ -786,15 +1235,16 @@ module top
         .dc_write_en(mem_stage.dc_write_en), // write=1, read=0
         .dc_in_wdata(mem_stage.dc_in_wdata),
         .dc_in_wlen (mem_stage.dc_in_wlen),  // wlen is log(#bytes), 3 = 64bit write
+        .dc_in_sync (mem_stage.dc_in_sync),  // atomics bypass the store buffer
 
         .dc_out_rdata(), .dc_out_rvalid(), .dc_out_write_done(),
-        .dc_out_page_fault(),
+        .dc_out_page_fault(), .dc_out_paddr(), .dc_sb_empty(),
 
         .* //slurp all the AXI ports it needs
     );
 
     always_ff @ (posedge clk) begin //Assert intructions aligned
-        if (IF_pc[1:0] != 2'b00) 
+        if (IF_pc[0] != 1'b0) 
             $error("ERROR: executing unaligned instruction at IF_pc=%x", IF_pc);
     end
 
@@ -881,7 +1331,252 @@ module top
     end
 `endif
 
+    // ==== Pipeline trace for Konata (PIPEVIEW=<file>, see pipeview.h)
+    // The op numbers handed out in IF ride along with each pipe reg.  For
+    // cycles inside PIPEVIEW_WINDOW, the harness is told what was fetched,
+    // which op sits in each stage, and why ops behind some stage got flushed.
+    // Hart 0 only.
+    logic [63:0] ID_op_id,  ID_op_id1;
+    logic [63:0] EX_op_id,  EX_op_id1;
+    logic [63:0] MEM_op_id, MEM_op_id1;
+    logic [63:0] WB_op_id,  WB_op_id1;
+    always_ff @ (posedge clk) begin
+        if (id_wr_en)  begin ID_op_id  <= IF_id;     ID_op_id1  <= IF1_id;     end
+        if (ex_wr_en)  begin EX_op_id  <= ID_op_id;  EX_op_id1  <= ID_op_id1;  end
+        if (mem_wr_en) begin MEM_op_id <= EX_op_id;  MEM_op_id1 <= EX_op_id1;  end
+        if (wb_wr_en)  begin WB_op_id  <= MEM_op_id; WB_op_id1  <= MEM_op_id1; end
+    end
+
+    // Same priority as IF_redirect_pc (PV_FLUSH_* in pipeview.h)
+    int          pv_flush;
+    logic [63:0] pv_flush_id; // op the flush is behind
+    always_comb begin
+        pv_flush = 0;
+        pv_flush_id = 0;
+        if (IF_redirect) begin
+            if (priv_sys.is_xret || priv_sys.jump_trap_handler) begin
+                pv_flush = 1;
+                pv_flush_id = WB_op_id;
+            end else if (flush_before_mem) begin
+                pv_flush = 2;
+                pv_flush_id = MEM_op_id;
+            end else if (EX_do_jump) begin
+                pv_flush = 3;
+                pv_flush_id = EX_op_id;
+            end else if (flush_before_ex || flush_before_id) begin
+                pv_flush = 4;
+                pv_flush_id = EX_is_trap ? EX_op_id : ID_op_id;
+            end
+        end
+    end
+
+    always_ff @ (posedge clk) begin
+        if (!reset && HARTID == 0 && pipeview_enabled(perf_cycles) != 0) begin
+            if (!IF_redirect) begin // a redirect throws away this cycle's fetch
+                if (fetch_count >= 1) pipeview_fetch(fetch_op_id[0], fetch_op_pc[0], fetch_op_inst[0], fetch_op_rvc[0], fetch_fault);
+                if (fetch_count == 2) pipeview_fetch(fetch_op_id[1], fetch_op_pc[1], fetch_op_inst[1], fetch_op_rvc[1], 0);
+            end
+            if (ID_reg.valid)   pipeview_stage(1, ID_op_id,   ID_stall);
+            if (ID_reg.valid1)  pipeview_stage(1, ID_op_id1,  ID_stall);
+            if (EX_reg.valid)   pipeview_stage(2, EX_op_id,   0);
+            if (EX_reg.valid1)  pipeview_stage(2, EX_op_id1,  0);
+            if (MEM_reg.valid)  pipeview_stage(3, MEM_op_id,  mem_stage.stall);
+            if (MEM_reg.valid1) pipeview_stage(3, MEM_op_id1, mem_stage.stall);
+            if (WB_reg.valid)   pipeview_stage(4, WB_op_id,   wb_stage.stall);
+            if (WB_reg.valid1)  pipeview_stage(4, WB_op_id1,  wb_stage.stall);
+            pipeview_cycle(pv_flush, pv_flush_id, WB_reg.valid && WB_reg.curr_trapped, WB_op_id,
+                           WB_reg.curr_deco.is_trap_ret, WB_reg.curr_trap_cause, WB_reg.curr_trap_val);
+        end
+    end
+
     initial begin
+        if (HARTID == 0)
             $display("Initializing top, entry point = 0x%x", entry);
     end
 endmodule
+
+
+// What the harness sees: HARTS copies of Hart sharing the one AXI port through
+// Hart_interconnect, which keeps their D$s coherent.  Each hart has its own
+// interrupt lines (bit h is hart h) and mhartid; they all start at entry.
+// With HARTS=1 the one hart is wired straight through.
+module top
+#(
+  ID_WIDTH = 13,
+  ADDR_WIDTH = 64,
+  DATA_WIDTH = 64,
+  STRB_WIDTH = DATA_WIDTH/8,
+  ISSUE_WIDTH = 1, // 2 builds the dual-issue pipeline (see IF_pair), set with -GISSUE_WIDTH
+  HARTS = 1        // up to 4, set with -GHARTS
+)
+(
+  input  clk,
+         reset,
+  input  [63:0] mtime,
+  input  [HARTS-1:0] mtip,     // CLINT timer interrupts (mtime >= mtimecmp)
+  input  [HARTS-1:0] msip,     // CLINT software interrupts
+  input  [HARTS-1:0] meip,     // PLIC external interrupts, M-mode contexts
+  input  [HARTS-1:0] seip,     // PLIC external interrupts, S-mode contexts
+  output [HARTS-1:0] wfi_idle, // hart is parked on a WFI, waiting for an interrupt
+
+  // 64-bit addresses of the program entry point and initial stack pointer
+  input  [63:0] entry,
+  input  [63:0] stackptr,
+  input  [63:0] satp,
+
+  // interface to connect to the bus
+  output  wire [ID_WIDTH-1:0]     m_axi_awid,
+  output  wire [ADDR_WIDTH-1:0]   m_axi_awaddr,
+  output  wire [7:0]              m_axi_awlen,
+  output  wire [2:0]              m_axi_awsize,
+  output  wire [1:0]              m_axi_awburst,
+  output  wire                    m_axi_awlock,
+  output  wire [3:0]              m_axi_awcache,
+  output  wire [2:0]              m_axi_awprot,
+  output  wire                    m_axi_awvalid,
+  input   wire                    m_axi_awready,
+  output  wire [DATA_WIDTH-1:0]   m_axi_wdata,
+  output  wire [STRB_WIDTH-1:0]   m_axi_wstrb,
+  output  wire                    m_axi_wlast,
+  output  wire                    m_axi_wvalid,
+  input   wire                    m_axi_wready,
+  input   wire [ID_WIDTH-1:0]     m_axi_bid,
+  input   wire [1:0]              m_axi_bresp,
+  input   wire                    m_axi_bvalid,
+  output  wire                    m_axi_bready,
+  output  wire [ID_WIDTH-1:0]     m_axi_arid,
+  output  wire [ADDR_WIDTH-1:0]   m_axi_araddr,
+  output  wire [7:0]              m_axi_arlen,
+  output  wire [2:0]              m_axi_arsize,
+  output  wire [1:0]              m_axi_arburst,
+  output  wire                    m_axi_arlock,
+  output  wire [3:0]              m_axi_arcache,
+  output  wire [2:0]              m_axi_arprot,
+  output  wire                    m_axi_arvalid,
+  input   wire                    m_axi_arready,
+  input   wire [ID_WIDTH-1:0]     m_axi_rid,
+  input   wire [DATA_WIDTH-1:0]   m_axi_rdata,
+  input   wire [1:0]              m_axi_rresp,
+  input   wire                    m_axi_rlast,
+  input   wire                    m_axi_rvalid,
+  output  wire                    m_axi_rready,
+  input   wire                    m_axi_acvalid,
+  output  wire                    m_axi_acready,
+  input   wire [ADDR_WIDTH-1:0]   m_axi_acaddr,
+  input   wire [3:0]              m_axi_acsnoop
+);
+
+    generate
+    if (HARTS == 1) begin : one_hart
+        Hart #(.ID_WIDTH(ID_WIDTH), .ADDR_WIDTH(ADDR_WIDTH), .DATA_WIDTH(DATA_WIDTH), .STRB_WIDTH(STRB_WIDTH),
+               .ISSUE_WIDTH(ISSUE_WIDTH), .HARTID(0), .HARTS(1)) hart (.*);
+
+    end else begin : harts
+        wire [ID_WIDTH-1:0]     hart_m_axi_awid       [HARTS];
+        wire [ADDR_WIDTH-1:0]   hart_m_axi_awaddr     [HARTS];
+        wire [7:0]              hart_m_axi_awlen      [HARTS];
+        wire [2:0]              hart_m_axi_awsize     [HARTS];
+        wire [1:0]              hart_m_axi_awburst    [HARTS];
+        wire                    hart_m_axi_awlock     [HARTS];
+        wire [3:0]              hart_m_axi_awcache    [HARTS];
+        wire [2:0]              hart_m_axi_awprot     [HARTS];
+        wire                    hart_m_axi_awvalid    [HARTS];
+        wire                    hart_m_axi_awready    [HARTS];
+        wire [DATA_WIDTH-1:0]   hart_m_axi_wdata      [HARTS];
+        wire [STRB_WIDTH-1:0]   hart_m_axi_wstrb      [HARTS];
+        wire                    hart_m_axi_wlast      [HARTS];
+        wire                    hart_m_axi_wvalid     [HARTS];
+        wire                    hart_m_axi_wready     [HARTS];
+        wire [ID_WIDTH-1:0]     hart_m_axi_bid        [HARTS];
+        wire [1:0]              hart_m_axi_bresp      [HARTS];
+        wire                    hart_m_axi_bvalid     [HARTS];
+        wire                    hart_m_axi_bready     [HARTS];
+        wire [ID_WIDTH-1:0]     hart_m_axi_arid       [HARTS];
+        wire [ADDR_WIDTH-1:0]   hart_m_axi_araddr     [HARTS];
+        wire [7:0]              hart_m_axi_arlen      [HARTS];
+        wire [2:0]              hart_m_axi_arsize     [HARTS];
+        wire [1:0]              hart_m_axi_arburst    [HARTS];
+        wire                    hart_m_axi_arlock     [HARTS];
+        wire [3:0]              hart_m_axi_arcache    [HARTS];
+        wire [2:0]              hart_m_axi_arprot     [HARTS];
+        wire                    hart_m_axi_arvalid    [HARTS];
+        wire                    hart_m_axi_arready    [HARTS];
+        wire [ID_WIDTH-1:0]     hart_m_axi_rid        [HARTS];
+        wire [DATA_WIDTH-1:0]   hart_m_axi_rdata      [HARTS];
+        wire [1:0]              hart_m_axi_rresp      [HARTS];
+        wire                    hart_m_axi_rlast      [HARTS];
+        wire                    hart_m_axi_rvalid     [HARTS];
+        wire                    hart_m_axi_rready     [HARTS];
+        wire                    hart_m_axi_acvalid    [HARTS];
+        wire                    hart_m_axi_acready    [HARTS];
+        wire [ADDR_WIDTH-1:0]   hart_m_axi_acaddr     [HARTS];
+        wire [3:0]              hart_m_axi_acsnoop    [HARTS];
+
+        for (genvar h = 0; h < HARTS; h++) begin : hart
+            Hart #(.ID_WIDTH(ID_WIDTH), .ADDR_WIDTH(ADDR_WIDTH), .DATA_WIDTH(DATA_WIDTH), .STRB_WIDTH(STRB_WIDTH),
+                   .ISSUE_WIDTH(ISSUE_WIDTH), .HARTID(h), .HARTS(HARTS)) hart (
+                .clk,
+                .reset,
+                .mtime,
+                .mtip    (mtip[h]),
+                .msip    (msip[h]),
+                .meip    (meip[h]),
+                .seip    (seip[h]),
+                .wfi_idle(wfi_idle[h]),
+                .entry,
+                .stackptr,
+                .satp,
+
+                .m_axi_awid    (hart_m_axi_awid[h]),
+                .m_axi_awaddr  (hart_m_axi_awaddr[h]),
+                .m_axi_awlen   (hart_m_axi_awlen[h]),
+                .m_axi_awsize  (hart_m_axi_awsize[h]),
+                .m_axi_awburst (hart_m_axi_awburst[h]),
+                .m_axi_awlock  (hart_m_axi_awlock[h]),
+                .m_axi_awcache (hart_m_axi_awcache[h]),
+                .m_axi_awprot  (hart_m_axi_awprot[h]),
+                .m_axi_awvalid (hart_m_axi_awvalid[h]),
+                .m_axi_awready (hart_m_axi_awready[h]),
+                .m_axi_wdata   (hart_m_axi_wdata[h]),
+                .m_axi_wstrb   (hart_m_axi_wstrb[h]),
+                .m_axi_wlast   (hart_m_axi_wlast[h]),
+                .m_axi_wvalid  (hart_m_axi_wvalid[h]),
+                .m_axi_wready  (hart_m_axi_wready[h]),
+                .m_axi_bid     (hart_m_axi_bid[h]),
+                .m_axi_bresp   (hart_m_axi_bresp[h]),
+                .m_axi_bvalid  (hart_m_axi_bvalid[h]),
+                .m_axi_bready  (hart_m_axi_bready[h]),
+                .m_axi_arid    (hart_m_axi_arid[h]),
+                .m_axi_araddr  (hart_m_axi_araddr[h]),
+                .m_axi_arlen   (hart_m_axi_arlen[h]),
+                .m_axi_arsize  (hart_m_axi_arsize[h]),
+                .m_axi_arburst (hart_m_axi_arburst[h]),
+                .m_axi_arlock  (hart_m_axi_arlock[h]),
+                .m_axi_arcache (hart_m_axi_arcache[h]),
+                .m_axi_arprot  (hart_m_axi_arprot[h]),
+                .m_axi_arvalid (hart_m_axi_arvalid[h]),
+                .m_axi_arready (hart_m_axi_arready[h]),
+                .m_axi_rid     (hart_m_axi_rid[h]),
+                .m_axi_rdata   (hart_m_axi_rdata[h]),
+                .m_axi_rresp   (hart_m_axi_rresp[h]),
+                .m_axi_rlast   (hart_m_axi_rlast[h]),
+                .m_axi_rvalid  (hart_m_axi_rvalid[h]),
+                .m_axi_rready  (hart_m_axi_rready[h]),
+                .m_axi_acvalid (hart_m_axi_acvalid[h]),
+                .m_axi_acready (hart_m_axi_acready[h]),
+                .m_axi_acaddr  (hart_m_axi_acaddr[h]),
+                .m_axi_acsnoop (hart_m_axi_acsnoop[h])
+            );
+        end
+
+        Hart_interconnect #(HARTS, ID_WIDTH, ADDR_WIDTH, DATA_WIDTH, STRB_WIDTH) hart_interconnect (.*);
+    end
+    endgenerate
+
+    initial begin
+        if (HARTS < 1 || HARTS > 4) begin
+            $display("HARTS=%0d: only 1 to 4 harts are supported", HARTS);
+            $finish;
+        end
+    end
+endmodule
@@ -0,0 +1,324 @@
+#include <iostream>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <assert.h>
+#include "system.h"
+#include "hardware.h"
+
+using namespace std;
+
+// ==== virtio-mmio block device (legacy, version 1 register layout)
+// The disk is the file named by DISK_IMAGE, mmap'ed shared so guest writes go
+// straight to it.  Requests are served by copying between that mapping and
+// System::ram.  The caches are not coherent with ram, so a notify is handled
+// in phases, each waiting for the previous phase's snoops to be accepted:
+//   1. clean+invalidate the rings, so the descriptors in ram are current
+//   2. walk the new chains and clean+invalidate every buffer they point to
+//   3. do the copies, write the used ring, and invalidate everything written
+//   4. raise the interrupt, once the guest can no longer see stale lines
+// Without DISK_IMAGE, the device reports ID 0 ("no device") and Linux skips it.
+
+enum {
+    VIRTIO_MMIO_MAGIC_VALUE = 0x000, VIRTIO_MMIO_VERSION = 0x004, VIRTIO_MMIO_DEVICE_ID = 0x008, VIRTIO_MMIO_VENDOR_ID = 0x00c,
+    VIRTIO_MMIO_HOST_FEATURES = 0x010, VIRTIO_MMIO_HOST_FEATURES_SEL = 0x014,
+    VIRTIO_MMIO_GUEST_FEATURES = 0x020, VIRTIO_MMIO_GUEST_FEATURES_SEL = 0x024, VIRTIO_MMIO_GUEST_PAGE_SIZE = 0x028,
+    VIRTIO_MMIO_QUEUE_SEL = 0x030, VIRTIO_MMIO_QUEUE_NUM_MAX = 0x034, VIRTIO_MMIO_QUEUE_NUM = 0x038,
+    VIRTIO_MMIO_QUEUE_ALIGN = 0x03c, VIRTIO_MMIO_QUEUE_PFN = 0x040, VIRTIO_MMIO_QUEUE_NOTIFY = 0x050,
+    VIRTIO_MMIO_INTERRUPT_STATUS = 0x060, VIRTIO_MMIO_INTERRUPT_ACK = 0x064, VIRTIO_MMIO_STATUS = 0x070,
+    VIRTIO_MMIO_CONFIG = 0x100
+};
+
+enum { VIRTIO_ID_BLOCK = 2, VIRTIO_VENDOR = 0x554d4551 /* "QEMU" */, VIRTIO_MAGIC = 0x74726976 /* "virt" */ };
+enum { VIRTIO_BLK_F_RO = 5, VIRTIO_BLK_F_FLUSH = 9 };
+enum { VIRTIO_BLK_T_IN = 0, VIRTIO_BLK_T_OUT = 1, VIRTIO_BLK_T_FLUSH = 4, VIRTIO_BLK_T_GET_ID = 8 };
+enum { VIRTIO_BLK_S_OK = 0, VIRTIO_BLK_S_IOERR = 1, VIRTIO_BLK_S_UNSUPP = 2 };
+enum { VRING_DESC_F_NEXT = 1, VRING_DESC_F_WRITE = 2 };
+enum { VIRTIO_INT_USED_RING = 1 };
+
+#define VIRTIO_QUEUE_NUM_MAX 128
+#define SECTOR_SIZE 512
+
+struct vring_desc { uint64_t addr; uint32_t len; uint16_t flags, next; };
+struct vring_used_elem { uint32_t id, len; };
+struct virtio_blk_outhdr { uint32_t type, ioprio; uint64_t sector; };
+
+static struct {
+    bool probed;
+    char* image; // the mmap'ed disk, or NULL
+    uint64_t size;
+    bool read_only;
+} disk;
+
+static uint32_t host_features_sel, queue_num, queue_pfn, interrupt_status, status;
+static uint32_t guest_page_size = PAGE_SIZE, queue_align = PAGE_SIZE;
+static uint16_t last_avail_idx, used_idx, avail_end;
+static bool notified;
+static enum { VIRTIO_IDLE, VIRTIO_FETCH_RINGS, VIRTIO_FETCH_BUFFERS, VIRTIO_COMPLETE } phase;
+
+static void virtio_open_disk() {
+    if (disk.probed) return;
+    disk.probed = true;
+    const char* DISK_IMAGE = getenv("DISK_IMAGE");
+    if (!DISK_IMAGE || !*DISK_IMAGE) return;
+    int fd = open(DISK_IMAGE, O_RDWR);
+    if (fd == -1) {
+        fd = open(DISK_IMAGE, O_RDONLY);
+        disk.read_only = true;
+    }
+    struct stat st;
+    if (fd == -1 || fstat(fd, &st) != 0 || st.st_size < SECTOR_SIZE) {
+        cerr << "Could not open DISK_IMAGE " << DISK_IMAGE << ", there will be no block device" << endl;
+        if (fd != -1) close(fd);
+        return;
+    }
+    disk.size = st.st_size & ~(uint64_t)(SECTOR_SIZE-1);
+    disk.image = (char*)mmap(NULL, disk.size, disk.read_only ? PROT_READ : PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+    assert(disk.image != MAP_FAILED);
+    assert(close(fd) == 0); // the mapping keeps the file open
+}
+
+// Pointer into System::ram for a guest physical range, or NULL if it isn't all in ram
+static char* guest_ram(const uint64_t addr, const uint64_t len) {
+    const uint64_t dram_offset = System::sys->dram_offset;
+    if (addr < dram_offset || addr - dram_offset > System::sys->ramsize || len > System::sys->ramsize - (addr - dram_offset)) {
+        cerr << "virtio-blk DMA to " << std::hex << addr << "+" << len << " is outside of memory" << endl;
+        return NULL;
+    }
+    return System::sys->ram + (addr - dram_offset);
+}
+
+// Legacy vring layout: descriptor table, then the avail ring, then the used ring on the next queue_align boundary
+static uint64_t vring_desc_addr()  { return (uint64_t)queue_pfn * guest_page_size; }
+static uint64_t vring_avail_addr() { return vring_desc_addr() + sizeof(vring_desc)*queue_num; }
+static uint64_t vring_used_addr()  { return (vring_avail_addr() + 2*(3+queue_num) + queue_align-1) & ~(uint64_t)(queue_align-1); }
+static uint64_t vring_used_size()  { return 2*3 + sizeof(vring_used_elem)*queue_num; }
+
+static vring_desc* vring_desc_entry(const uint16_t idx) {
+    return (vring_desc*)guest_ram(vring_desc_addr() + sizeof(vring_desc)*(idx % queue_num), sizeof(vring_desc));
+}
+
+static uint16_t* vring_avail() {
+    return (uint16_t*)guest_ram(vring_avail_addr(), 2*(3+queue_num)); // flags, idx, ring[], used_event
+}
+
+static void virtio_reset() {
+    host_features_sel = queue_num = queue_pfn = interrupt_status = status = 0;
+    queue_align = guest_page_size = PAGE_SIZE;
+    last_avail_idx = used_idx = avail_end = 0;
+    notified = false;
+    phase = VIRTIO_IDLE;
+    plic_set_level(VIRTIO_BLK_IRQ, false);
+}
+
+// Serve one request chain, returning the number of bytes written into guest memory
+static uint32_t virtio_blk_request(const uint16_t head) {
+    vring_desc* desc = vring_desc_entry(head);
+    if (!desc) return 0;
+    virtio_blk_outhdr hdr;
+    const char* hdr_ram = guest_ram(desc->addr, sizeof(hdr));
+    if (!hdr_ram || desc->len < sizeof(hdr) || !(desc->flags & VRING_DESC_F_NEXT)) {
+        cerr << "Malformed virtio-blk request header at descriptor " << std::dec << head << endl;
+        return 0;
+    }
+    memcpy(&hdr, hdr_ram, sizeof(hdr));
+
+    uint8_t result = VIRTIO_BLK_S_OK;
+    uint64_t pos = hdr.sector * SECTOR_SIZE;
+    uint32_t written = 0;
+    switch(hdr.type) {
+        case VIRTIO_BLK_T_IN: case VIRTIO_BLK_T_OUT: case VIRTIO_BLK_T_GET_ID:
+            break;
+        case VIRTIO_BLK_T_FLUSH: // has no data buffers
+            if (msync(disk.image, disk.size, MS_SYNC) != 0) result = VIRTIO_BLK_S_IOERR;
+            break;
+        default:
+            result = VIRTIO_BLK_S_UNSUPP;
+            break;
+    }
+    for(int n = 0; n < queue_num; ++n) {
+        desc = vring_desc_entry(desc->next);
+        if (!desc) return written;
+        char* buf = guest_ram(desc->addr, desc->len);
+        if (!buf) result = VIRTIO_BLK_S_IOERR;
+
+        if (!(desc->flags & VRING_DESC_F_NEXT)) { // the last descriptor is the status byte
+            if (buf) {
+                *buf = result;
+                System::sys->invalidate(desc->addr);
+                ++written;
+            }
+            return written;
+        }
+        if (!buf) continue;
+
+        switch(hdr.type) {
+            case VIRTIO_BLK_T_IN:
+                if (pos > disk.size || desc->len > disk.size - pos) { result = VIRTIO_BLK_S_IOERR; break; }
+                memcpy(buf, disk.image + pos, desc->len);
+                System::sys->invalidate(desc->addr, desc->len);
+                written += desc->len;
+                pos += desc->len;
+                break;
+            case VIRTIO_BLK_T_OUT:
+                if (disk.read_only || pos > disk.size || desc->len > disk.size - pos) { result = VIRTIO_BLK_S_IOERR; break; }
+                memcpy(disk.image + pos, buf, desc->len);
+                pos += desc->len;
+                break;
+            case VIRTIO_BLK_T_GET_ID: {
+                char id[20] = "cse502-virtio-blk";
+                memcpy(buf, id, min<uint32_t>(desc->len, sizeof(id)));
+                System::sys->invalidate(desc->addr, desc->len);
+                written += desc->len;
+                break;
+            }
+        }
+    }
+    cerr << "virtio-blk request chain at descriptor " << std::dec << head << " does not end" << endl;
+    return written;
+}
+
+void virtio_tick(Vtop* top) {
+    plic_update(top);
+    if (phase == VIRTIO_IDLE && !notified) return;
+    if (!queue_pfn || !queue_num || !disk.image) {
+        notified = false;
+        return;
+    }
+    if (System::sys->snoops_pending()) return; // the previous phase's lines aren't in ram yet
+
+    uint16_t* avail = vring_avail();
+    if (!avail) {
+        notified = false;
+        phase = VIRTIO_IDLE;
+        return;
+    }
+    switch(phase) {
+        case VIRTIO_IDLE:
+            notified = false;
+            System::sys->clean_invalidate(vring_desc_addr(), vring_used_addr() + vring_used_size() - vring_desc_addr());
+            phase = VIRTIO_FETCH_RINGS;
+            break;
+
+        case VIRTIO_FETCH_RINGS:
+            avail_end = avail[1];
+            for(uint16_t i = last_avail_idx; i != avail_end; ++i) {
+                vring_desc* desc = vring_desc_entry(avail[2 + i % queue_num]);
+                for(int n = 0; desc && n < queue_num; ++n) {
+                    System::sys->clean_invalidate(desc->addr, desc->len);
+                    if (!(desc->flags & VRING_DESC_F_NEXT)) break;
+                    desc = vring_desc_entry(desc->next);
+                }
+            }
+            phase = VIRTIO_FETCH_BUFFERS;
+            break;
+
+        case VIRTIO_FETCH_BUFFERS: {
+            vring_used_elem* used_ring = (vring_used_elem*)guest_ram(vring_used_addr() + 4, sizeof(vring_used_elem)*queue_num);
+            uint16_t* used_idx_ram = (uint16_t*)guest_ram(vring_used_addr() + 2, 2);
+            if (!used_ring || !used_idx_ram) {
+                phase = VIRTIO_IDLE;
+                return;
+            }
+            for(; last_avail_idx != avail_end; ++last_avail_idx) {
+                const uint16_t head = avail[2 + last_avail_idx % queue_num];
+                used_ring[used_idx % queue_num].id = head;
+                used_ring[used_idx % queue_num].len = virtio_blk_request(head);
+                ++used_idx;
+            }
+            *used_idx_ram = used_idx;
+            System::sys->invalidate(vring_used_addr(), vring_used_size());
+            phase = VIRTIO_COMPLETE;
+            break;
+        }
+
+        case VIRTIO_COMPLETE:
+            interrupt_status |= VIRTIO_INT_USED_RING;
+            plic_set_level(VIRTIO_BLK_IRQ, true);
+            plic_update(top);
+            phase = VIRTIO_IDLE;
+            break;
+    }
+}
+
+// Nothing may be skipped while a notify is being worked through
+bool virtio_busy() {
+    return notified || phase != VIRTIO_IDLE;
+}
+
+static uint32_t virtio_blk_reg(const uint64_t offset) {
+    switch(offset) {
+        case VIRTIO_MMIO_MAGIC_VALUE:      return VIRTIO_MAGIC;
+        case VIRTIO_MMIO_VERSION:          return 1;
+        case VIRTIO_MMIO_DEVICE_ID:        return disk.image ? VIRTIO_ID_BLOCK : 0;
+        case VIRTIO_MMIO_VENDOR_ID:        return VIRTIO_VENDOR;
+        case VIRTIO_MMIO_HOST_FEATURES:    return host_features_sel ? 0 : (1 << VIRTIO_BLK_F_FLUSH) | (disk.read_only << VIRTIO_BLK_F_RO);
+        case VIRTIO_MMIO_QUEUE_NUM_MAX:    return VIRTIO_QUEUE_NUM_MAX;
+        case VIRTIO_MMIO_QUEUE_PFN:        return queue_pfn;
+        case VIRTIO_MMIO_INTERRUPT_STATUS: return interrupt_status;
+        case VIRTIO_MMIO_STATUS:           return status;
+        default:
+            cerr << "Read request of virtio-blk offset (" << std::hex << offset << ") unsupported, but will return 0 and keep going" << endl;
+            return 0;
+    }
+}
+
+// Linux reads the config space (just the capacity, in sectors) a byte at a time
+void virtio_blk_read(const Device* self, Vtop* top) {
+    virtio_open_disk();
+    const uint64_t offset = top->m_axi_araddr - self->start;
+    uint64_t val = 0;
+    if (offset >= VIRTIO_MMIO_CONFIG) {
+        const uint64_t capacity = disk.size / SECTOR_SIZE;
+        const uint64_t config_offset = offset - VIRTIO_MMIO_CONFIG;
+        const uint64_t size = 1 << top->m_axi_arsize;
+        if (config_offset + size <= sizeof(capacity)) memcpy(&val, (const char*)&capacity + config_offset, size);
+    } else if (top->m_axi_arsize == 2) {
+        val = virtio_blk_reg(offset);
+    } else {
+        cerr << "Read request of virtio-blk address (" << std::hex << top->m_axi_araddr << ") with size " << std::dec << (1 << top->m_axi_arsize) << " unsupported" << endl;
+        Verilated::gotFinish(true);
+    }
+    System::sys->read_response(val << ((offset & 7)*8), top->m_axi_arid, true);
+}
+
+void virtio_blk_write_data(const Device* self, Vtop* top) {
+    virtio_open_disk();
+    const uint64_t offset = System::sys->w_addr - self->start;
+    const uint32_t val = top->m_axi_wdata;
+    if (top->m_axi_wstrb != 0x0F) {
+        cerr << "Write request of virtio-blk address with unsupported strobe value (" << std::hex << (int)(top->m_axi_wstrb) << ")" << endl;
+        Verilated::gotFinish(true);
+        return;
+    }
+    switch(offset) {
+        case VIRTIO_MMIO_HOST_FEATURES_SEL:  host_features_sel = val; break;
+        case VIRTIO_MMIO_GUEST_FEATURES:     break; // nothing we offer changes how requests are served
+        case VIRTIO_MMIO_GUEST_FEATURES_SEL: break;
+        case VIRTIO_MMIO_GUEST_PAGE_SIZE:    guest_page_size = val; break;
+        case VIRTIO_MMIO_QUEUE_SEL:          if (val != 0) cerr << "virtio-blk only has queue 0, ignoring selection of " << std::dec << val << endl; break;
+        case VIRTIO_MMIO_QUEUE_NUM:          queue_num = min<uint32_t>(val, VIRTIO_QUEUE_NUM_MAX); break;
+        case VIRTIO_MMIO_QUEUE_ALIGN:
+            if (val && !(val & (val-1))) queue_align = val;
+            else cerr << "virtio-blk queue alignment " << std::dec << val << " is not a power of 2, ignoring" << endl;
+            break;
+        case VIRTIO_MMIO_QUEUE_PFN:
+            queue_pfn = val;
+            last_avail_idx = used_idx = 0;
+            break;
+        case VIRTIO_MMIO_QUEUE_NOTIFY:       notified = true; break;
+        case VIRTIO_MMIO_INTERRUPT_ACK:
+            interrupt_status &= ~val;
+            plic_set_level(VIRTIO_BLK_IRQ, interrupt_status != 0);
+            break;
+        case VIRTIO_MMIO_STATUS:
+            if (val == 0) virtio_reset();
+            else status = val;
+            break;
+        default:
+            cerr << "Write request of virtio-blk offset (" << std::hex << offset << ") unsupported, but will keep going anyway" << endl;
+            break;
+    }
+}